@@ -112,6 +112,7 @@ BaseApplication::BaseApplication(Context* context) :
     context_->RegisterFactory<Generator>();
 
     BehaviourTree::RegisterFactory(context_);
+    BehaviourTreeSystem::RegisterObject(context_);
 
 #ifdef __ANDROID__
     configurationFile_ = GetSubsystem<FileSystem>()->GetUserDocumentsDir() + DOCUMENTS_DIR + "/config.cfg";
@@ -196,6 +197,7 @@ void BaseApplication::Start()
     context_->RegisterSubsystem(new WindowManager(context_));
     context_->RegisterSubsystem(new Achievements(context_));
     context_->RegisterSubsystem(new Generator(context_));
+    context_->RegisterSubsystem(new BehaviourTreeSystem(context_));
 
 #if defined(URHO3D_LUA) || defined(URHO3D_ANGELSCRIPT)
     context_->RegisterSubsystem(new ModLoader(context_));
@@ -218,6 +220,10 @@ void BaseApplication::Start()
 
     ApplyGraphicsSettings();
 
+    if (GetSubsystem<ConfigManager>()->GetBool("engine", "ConfigHotReload", true)) {
+        GetSubsystem<ConfigManager>()->StartWatching();
+    }
+
     // Initialize the first level from the config file
     VariantMap& eventData = GetEventDataMap();
     if (GetSubsystem<ConfigManager>()->GetBool("server", "Dedicated", false)) {
@@ -236,6 +242,9 @@ void BaseApplication::Start()
 
 void BaseApplication::Stop()
 {
+    // Write delayed savegame changes before the subsystems are destroyed
+    GetSubsystem<State>()->Flush();
+    GetSubsystem<Achievements>()->Flush();
 }
 
 void BaseApplication::LoadConfig(String filename, String prefix, bool isMain)
@@ -244,6 +253,21 @@ void BaseApplication::LoadConfig(String filename, String prefix, bool isMain)
     JSONFile json(context_);
     json.LoadFile(GetSubsystem<FileSystem>()->GetProgramDir() + filename);
     JSONValue& content = json.GetRoot();
+
+    // Reloaded file only notifies about the values which changed
+    auto setValue = [&](const String& name, const Variant& value) {
+        Variant current = engine_->GetGlobalVar(name);
+        engine_->SetGlobalVar(name, value);
+        if (!current.IsEmpty() && current != value) {
+            using namespace ConfigChanged;
+            VariantMap& data = GetEventDataMap();
+            data[P_SECTION] = prefix;
+            data[P_PARAMETER] = name;
+            data[P_VALUE] = value;
+            SendEvent(E_CONFIG_CHANGED, data);
+        }
+    };
+
     if (content.IsObject()) {
         for (auto it = content.Begin(); it != content.End(); ++it) {
 
@@ -253,20 +277,21 @@ void BaseApplication::LoadConfig(String filename, String prefix, bool isMain)
                 globalSettings_[StringHash((*it).first_)] = (*it).first_;
             }
             if ((*it).second_.IsBool()) {
-                engine_->SetGlobalVar(prefix + (*it).first_, (*it).second_.GetBool());
+                setValue(prefix + (*it).first_, (*it).second_.GetBool());
             }
             if ((*it).second_.IsString()) {
-                engine_->SetGlobalVar(prefix + (*it).first_, (*it).second_.GetString());
+                setValue(prefix + (*it).first_, (*it).second_.GetString());
             }
             if ((*it).second_.IsNumber()) {
                 if ((*it).second_.GetNumberType() == JSONNT_FLOAT_DOUBLE) {
-                    engine_->SetGlobalVar(prefix + (*it).first_, (*it).second_.GetFloat());
+                    setValue(prefix + (*it).first_, (*it).second_.GetFloat());
                 }
                 if ((*it).second_.GetNumberType() == JSONNT_INT) {
-                    engine_->SetGlobalVar(prefix + (*it).first_, (*it).second_.GetInt());
+                    setValue(prefix + (*it).first_, (*it).second_.GetInt());
                 }
             }
         }
+        GetSubsystem<ConfigManager>()->WatchFile(GetSubsystem<FileSystem>()->GetProgramDir() + filename, filename, prefix);
     }
     else {
         URHO3D_LOGERROR("Config file " + filename + " format is not correct!");
@@ -282,6 +307,62 @@ void BaseApplication::HandleLoadConfig(StringHash eventType, VariantMap& eventDa
     }
 }
 
+void BaseApplication::HandleConfigChanged(StringHash eventType, VariantMap& eventData)
+{
+    using namespace ConfigChanged;
+    String section = eventData[P_SECTION].GetString().ToLower();
+    String parameter = eventData[P_PARAMETER].GetString();
+    // Value keeps the type it was set with, GetString would be empty for bool and number values
+    String value = eventData[P_VALUE].ToString();
+    URHO3D_LOGINFO("Config changed " + section + "." + parameter + "=" + value);
+
+    if (section == "audio") {
+        if (parameter == SOUND_MASTER || parameter == SOUND_EFFECT || parameter == SOUND_AMBIENT
+            || parameter == SOUND_VOICE || parameter == SOUND_MUSIC) {
+            engine_->SetGlobalVar(parameter, ToFloat(value));
+            GetSubsystem<Audio>()->SetMasterGain(parameter, ToFloat(value));
+        }
+    } else if (section == "engine") {
+        if (parameter == "FPSLimit") {
+            GetSubsystem<Engine>()->SetMaxFps(ToInt(value));
+        } else if (parameter == "LogLevel") {
+            GetSubsystem<Log>()->SetLevel(ToInt(value));
+        } else if (parameter == "LogQuiet") {
+            GetSubsystem<Log>()->SetQuiet(ToBool(value));
+        } else if (parameter == "LogTimestamp") {
+            GetSubsystem<Log>()->SetTimeStamp(ToBool(value));
+        }
+    } else if (section == "graphics") {
+        auto* renderer = GetSubsystem<Renderer>();
+        if (!renderer) {
+            return;
+        }
+        if (parameter == "TextureQuality") {
+            renderer->SetTextureQuality((MaterialQuality) ToInt(value));
+        } else if (parameter == "MaterialQuality") {
+            renderer->SetMaterialQuality((MaterialQuality) ToInt(value));
+        } else if (parameter == "DrawShadows") {
+            renderer->SetDrawShadows(ToBool(value));
+        } else if (parameter == "ShadowMapSize") {
+            renderer->SetShadowMapSize(ToInt(value));
+        } else if (parameter == "ShadowQuality") {
+            renderer->SetShadowQuality((ShadowQuality) ToInt(value));
+        } else if (parameter == "MaxOccluderTriangles") {
+            renderer->SetMaxOccluderTriangles(ToInt(value));
+        } else if (parameter == "DynamicInstancing") {
+            renderer->SetDynamicInstancing(ToBool(value));
+        } else if (parameter == "SpecularLighting") {
+            renderer->SetSpecularLighting(ToBool(value));
+        } else if (parameter == "HDRRendering") {
+            renderer->SetHDRRendering(ToBool(value));
+        }
+    } else if (section == "postprocess") {
+        SendEvent("postprocess");
+    } else if (section == "mouse" || section == "joystick" || section == "keyboard") {
+        GetSubsystem<ControllerInput>()->LoadConfig();
+    }
+}
+
 void BaseApplication::RegisterConsoleCommands()
 {
     VariantMap& data = GetEventDataMap();
@@ -322,6 +403,7 @@ void BaseApplication::SubscribeToEvents()
 {
     SubscribeToEvent(E_ADD_CONFIG, URHO3D_HANDLER(BaseApplication, HandleAddConfig));
     SubscribeToEvent(E_LOAD_CONFIG, URHO3D_HANDLER(BaseApplication, HandleLoadConfig));
+    SubscribeToEvent(E_CONFIG_CHANGED, URHO3D_HANDLER(BaseApplication, HandleConfigChanged));
 
     SubscribeToEvent(E_MAPPED_CONTROL_RELEASED, [&](StringHash eventType, VariantMap& eventData) {
         using namespace MappedControlReleased;
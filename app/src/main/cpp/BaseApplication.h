@@ -71,6 +71,11 @@ private:
      */
     void HandleLoadConfig(StringHash eventType, VariantMap& eventData);
 
+    /**
+     * Reapply single setting which was changed in the config file while running
+     */
+    void HandleConfigChanged(StringHash eventType, VariantMap& eventData);
+
     /**
      * Add global config
      */
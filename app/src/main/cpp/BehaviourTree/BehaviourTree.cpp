@@ -1,21 +1,16 @@
 #include <Urho3D/IO/Log.h>
-#include <Urho3D/Resource/JSONFile.h>
-#include <Urho3D/Resource/ResourceCache.h>
 #include "BehaviourTree.h"
-#include "../Console/ConsoleHandlerEvents.h"
-#include "../Input/ControlDefines.h"
 
 using namespace Urho3D;
-using namespace ConsoleHandlerEvents;
 
 BehaviourTree::BehaviourTree(Context* context):
-    LogicComponent(context)
+    Component(context)
 {
-    SetUpdateEventMask(USE_FIXEDUPDATE);
 }
 
 BehaviourTree::~BehaviourTree()
 {
+    Release();
 }
 
 void BehaviourTree::RegisterFactory(Context* context)
@@ -25,51 +20,44 @@ void BehaviourTree::RegisterFactory(Context* context)
 
 void BehaviourTree::Init(const String& config)
 {
-    LoadConfig(config);
-    SubscribeToEvents();
+    Release();
+    system_ = GetSubsystem<BehaviourTreeSystem>();
+    if (system_) {
+        group_ = system_->AddAgent(this, config, agent_);
+    }
+    if (!group_) {
+        URHO3D_LOGERROR("Behaviour tree agent not created for " + config);
+    }
 }
 
-void BehaviourTree::LoadConfig(const String& config)
+void BehaviourTree::Release()
 {
-//    URHO3D_LOGINFOF("Loading behaviour tree: %s", config.CString());
-    auto json = GetSubsystem<ResourceCache>()->GetResource<JSONFile>(config);
-    JSONValue& content = json->GetRoot();
-    if (content.IsObject()) {
-        for (auto it = content.Begin(); it != content.End(); ++it) {
-//            URHO3D_LOGWARNINGF("JSON: %s", (*it).first_.CString());
-            auto field  = (*it).first_;
-            auto value = (*it).second_;
-            if (field == "type") {
-                if (value.IsString()) {
-                    if (value.GetString() == "Sequence") {
-                        rootNode_.nodeType = SEQUENCE;
-                    } else if (value.GetString() == "Selector") {
-                        rootNode_.nodeType = SELECTOR;
-                    }
-                }
-            }
-        }
+    if (group_ && system_) {
+        system_->RemoveAgent(group_, agent_);
     }
+    group_ = nullptr;
 }
 
 const Controls& BehaviourTree::GetControls()
 {
+    if (group_ && system_) {
+        controls_.buttons_ = group_->GetButtons(agent_);
+        controls_.yaw_ = group_->GetYaw(agent_);
+    }
     return controls_;
 }
 
-void BehaviourTree::FixedUpdate(float timeStep)
+float BehaviourTree::GetValue(const String& key) const
 {
-    controls_.yaw_ += timeStep * 50;
+    if (!group_ || !system_) {
+        return 0.0f;
+    }
+    return group_->GetValue(agent_, group_->GetAsset()->FindKey(key));
 }
 
-void BehaviourTree::SubscribeToEvents()
+void BehaviourTree::SetValue(const String& key, float value)
 {
-    controls_.Set(CTRL_FORWARD, true);
-    SendEvent(E_CONSOLE_COMMAND_ADD,
-            ConsoleCommandAdd::P_NAME, "behaviour_debug",
-            ConsoleCommandAdd::P_EVENT, "#behaviour_debug",
-            ConsoleCommandAdd::P_DESCRIPTION, "Change behaviour tree state");
-    SubscribeToEvent("#behaviour_debug", [&](StringHash eventType, VariantMap& eventData) {
-        controls_.Set(CTRL_FORWARD, true);
-    });
+    if (group_ && system_) {
+        group_->SetValue(agent_, group_->GetAsset()->FindKey(key), value);
+    }
 }
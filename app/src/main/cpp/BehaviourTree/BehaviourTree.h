@@ -1,33 +1,20 @@
 #pragma once
 
 #include <Urho3D/Container/Str.h>
-#include <Urho3D/Scene/LogicComponent.h>
+#include <Urho3D/Scene/Component.h>
 #include <Urho3D/Core/Context.h>
 #include <Urho3D/Input/Controls.h>
 
-#include "BehaviourTreeDefs.h"
+#include "BehaviourTreeSystem.h"
 
 using namespace Urho3D;
 
-struct BTService {
-    String name;
-};
-
-struct BTDecorator {
-    String name;
-};
-
-struct BTNode {
-    BTNodeType nodeType;
-    String name;
-    Vector<BTService> services;
-    Vector<BTNode> childNodes;
-    Vector<BTDecorator> decorators;
-};
-
-class BehaviourTree : public LogicComponent
+/**
+ * AI agent, the tree itself is ticked by BehaviourTreeSystem and the component only exposes its output
+ */
+class BehaviourTree : public Component
 {
-    URHO3D_OBJECT(BehaviourTree, LogicComponent);
+    URHO3D_OBJECT(BehaviourTree, Component);
 
 public:
     explicit BehaviourTree(Context* context);
@@ -40,14 +27,23 @@ public:
 
     const Controls& GetControls();
 
-    void FixedUpdate(float timeStep) override;
+    float GetValue(const String& key) const;
 
-private:
-    void SubscribeToEvents();
+    void SetValue(const String& key, float value);
+
+    /**
+     * Called by the agent group when this agent is moved to another slot
+     */
+    void SetAgent(unsigned agent) { agent_ = agent; }
 
-    void LoadConfig(const String& config);
+private:
+    void Release();
 
     Controls controls_;
 
-    BTNode rootNode_;
+    WeakPtr<BehaviourTreeSystem> system_;
+
+    BTAgentGroup* group_{nullptr};
+
+    unsigned agent_{0};
 };
@@ -0,0 +1,147 @@
+#include <Urho3D/IO/Log.h>
+#include "BehaviourTreeAsset.h"
+
+bool BehaviourTreeAsset::Load(const String& name, const JSONValue& root)
+{
+    name_ = name;
+    nodes_.Clear();
+    services_.Clear();
+    decorators_.Clear();
+    compositeCount_ = 0;
+    timerCount_ = 0;
+    keys_.Clear();
+    keyNames_.Clear();
+
+    if (!root.IsObject()) {
+        URHO3D_LOGERROR("Behaviour tree " + name + " must contain root node object");
+        return false;
+    }
+
+    CompileNode(root);
+    URHO3D_LOGINFOF("Behaviour tree %s compiled: %u nodes, %u blackboard keys", name.CString(), nodes_.Size(), keyNames_.Size());
+    return true;
+}
+
+unsigned BehaviourTreeAsset::FindKey(const String& name) const
+{
+    auto it = keys_.Find(name);
+    if (it != keys_.End()) {
+        return (*it).second_;
+    }
+    return BT_NONE;
+}
+
+unsigned BehaviourTreeAsset::CompileNode(const JSONValue& value)
+{
+    unsigned index = nodes_.Size();
+    BTNode node;
+    node.nodeType_ = CONDITION;
+    String type = value.Get("type").IsString() ? value.Get("type").GetString() : String::EMPTY;
+    String name = value.Get("name").IsString() ? value.Get("name").GetString() : String::EMPTY;
+    node.name_ = name;
+    node.value_ = value.Get("value").IsNumber() ? value.Get("value").GetFloat() : 0.0f;
+    node.duration_ = value.Get("duration").IsNumber() ? value.Get("duration").GetFloat() : 0.0f;
+
+    if (type == "Selector" || type == "Sequence") {
+        node.nodeType_ = type == "Selector" ? SELECTOR : SEQUENCE;
+        node.state_ = compositeCount_++;
+    } else if (type == "Action") {
+        node.nodeType_ = ACTION;
+        if (name == "MoveForward") {
+            node.action_ = ACTION_MOVE_FORWARD;
+        } else if (name == "MoveBack") {
+            node.action_ = ACTION_MOVE_BACK;
+        } else if (name == "Turn") {
+            node.action_ = ACTION_TURN;
+        } else if (name == "Jump") {
+            node.action_ = ACTION_JUMP;
+        } else if (name == "SetValue") {
+            node.action_ = ACTION_SET_VALUE;
+            node.key_ = GetKey(value);
+        } else if (name != "Wait") {
+            URHO3D_LOGWARNINGF("Behaviour tree %s: unknown action %s, waiting instead", name_.CString(), name.CString());
+        }
+        if (node.duration_ > 0.0f) {
+            node.state_ = timerCount_++;
+        }
+    } else if (type == "Condition") {
+        node.key_ = GetKey(value);
+    } else {
+        // Condition without a key always fails
+        URHO3D_LOGERRORF("Behaviour tree %s: unknown node type %s", name_.CString(), type.CString());
+    }
+
+    const JSONValue& services = value.Get("services");
+    node.firstService_ = services_.Size();
+    for (unsigned i = 0; services.IsArray() && i < services.Size(); i++) {
+        String serviceName = services[i].Get("name").GetString();
+        BTService service;
+        if (serviceName == "Random") {
+            service.type_ = SERVICE_RANDOM;
+        } else if (serviceName == "Timer") {
+            service.type_ = SERVICE_TIMER;
+        } else {
+            URHO3D_LOGWARNINGF("Behaviour tree %s: unknown service %s", name_.CString(), serviceName.CString());
+            continue;
+        }
+        service.key_ = GetKey(services[i]);
+        service.value_ = services[i].Get("value").IsNumber() ? services[i].Get("value").GetFloat() : 1.0f;
+        if (service.key_ != BT_NONE) {
+            services_.Push(service);
+        }
+    }
+    node.serviceCount_ = services_.Size() - node.firstService_;
+
+    const JSONValue& decorators = value.Get("decorators");
+    node.firstDecorator_ = decorators_.Size();
+    for (unsigned i = 0; decorators.IsArray() && i < decorators.Size(); i++) {
+        String decoratorName = decorators[i].Get("name").GetString();
+        BTDecorator decorator;
+        decorator.key_ = BT_NONE;
+        decorator.value_ = decorators[i].Get("value").IsNumber() ? decorators[i].Get("value").GetFloat() : 0.0f;
+        if (decoratorName == "Inverter") {
+            decorator.type_ = DECORATOR_INVERTER;
+        } else if (decoratorName == "Blackboard") {
+            decorator.type_ = DECORATOR_BLACKBOARD;
+            decorator.key_ = GetKey(decorators[i]);
+        } else {
+            URHO3D_LOGWARNINGF("Behaviour tree %s: unknown decorator %s", name_.CString(), decoratorName.CString());
+            continue;
+        }
+        decorators_.Push(decorator);
+    }
+    node.decoratorCount_ = decorators_.Size() - node.firstDecorator_;
+
+    nodes_.Push(node);
+
+    // Leaves ignore their children
+    const JSONValue& children = value.Get("childNodes");
+    if (node.nodeType_ == SELECTOR || node.nodeType_ == SEQUENCE) {
+        for (unsigned i = 0; children.IsArray() && i < children.Size(); i++) {
+            if (children[i].IsObject()) {
+                CompileNode(children[i]);
+                nodes_[index].childCount_++;
+            }
+        }
+    }
+    nodes_[index].next_ = nodes_.Size();
+    return index;
+}
+
+unsigned BehaviourTreeAsset::GetKey(const JSONValue& value)
+{
+    if (!value.Get("key").IsString() || value.Get("key").GetString().Empty()) {
+        URHO3D_LOGWARNINGF("Behaviour tree %s: blackboard key missing", name_.CString());
+        return BT_NONE;
+    }
+
+    const String& key = value.Get("key").GetString();
+    auto it = keys_.Find(key);
+    if (it != keys_.End()) {
+        return (*it).second_;
+    }
+    unsigned slot = keyNames_.Size();
+    keys_[key] = slot;
+    keyNames_.Push(key);
+    return slot;
+}
@@ -0,0 +1,81 @@
+#pragma once
+
+#include <Urho3D/Container/Str.h>
+#include <Urho3D/Container/HashMap.h>
+#include <Urho3D/Container/RefCounted.h>
+#include <Urho3D/Math/StringHash.h>
+#include <Urho3D/Resource/JSONValue.h>
+
+#include "BehaviourTreeDefs.h"
+
+using namespace Urho3D;
+
+struct BTService {
+    BTServiceType type_;
+    unsigned key_;
+    float value_;
+};
+
+struct BTDecorator {
+    BTDecoratorType type_;
+    unsigned key_;
+    float value_;
+};
+
+/**
+ * Node of the compiled tree, nodes are stored depth first so the children of a node
+ * start right after it and end where the node's subtree ends
+ */
+struct BTNode {
+    BTNodeType nodeType_;
+    StringHash name_;
+    BTAction action_{ACTION_WAIT};
+    // Index after the last node of this subtree, also the next sibling
+    unsigned next_{0};
+    unsigned childCount_{0};
+    // Per agent state column, running child of composites or timer of leaves with duration
+    unsigned state_{BT_NONE};
+    // Blackboard slot of conditions and SetValue actions
+    unsigned key_{BT_NONE};
+    float value_{0.0f};
+    float duration_{0.0f};
+    unsigned firstService_{0};
+    unsigned serviceCount_{0};
+    unsigned firstDecorator_{0};
+    unsigned decoratorCount_{0};
+};
+
+/**
+ * Immutable behaviour tree compiled from JSON, shared by all agents which use the same config
+ */
+class BehaviourTreeAsset : public RefCounted
+{
+public:
+    bool Load(const String& name, const JSONValue& root);
+
+    const String& GetName() const { return name_; }
+    const PODVector<BTNode>& GetNodes() const { return nodes_; }
+    const PODVector<BTService>& GetServices() const { return services_; }
+    const PODVector<BTDecorator>& GetDecorators() const { return decorators_; }
+    unsigned GetCompositeCount() const { return compositeCount_; }
+    unsigned GetTimerCount() const { return timerCount_; }
+    unsigned GetKeyCount() const { return keyNames_.Size(); }
+    const String& GetKeyName(unsigned key) const { return keyNames_[key]; }
+    /**
+     * Blackboard slot of the key or BT_NONE if no node uses it
+     */
+    unsigned FindKey(const String& name) const;
+
+private:
+    unsigned CompileNode(const JSONValue& value);
+    unsigned GetKey(const JSONValue& value);
+
+    String name_;
+    PODVector<BTNode> nodes_;
+    PODVector<BTService> services_;
+    PODVector<BTDecorator> decorators_;
+    unsigned compositeCount_{0};
+    unsigned timerCount_{0};
+    HashMap<StringHash, unsigned> keys_;
+    Vector<String> keyNames_;
+};
@@ -2,10 +2,35 @@
 
 enum BTState {
     SUCCESS,
-    FAILED
+    FAILED,
+    RUNNING
 };
 
 enum BTNodeType {
     SELECTOR,
-    SEQUENCE
+    SEQUENCE,
+    ACTION,
+    CONDITION
 };
+
+enum BTAction {
+    ACTION_WAIT,
+    ACTION_MOVE_FORWARD,
+    ACTION_MOVE_BACK,
+    ACTION_TURN,
+    ACTION_JUMP,
+    ACTION_SET_VALUE
+};
+
+enum BTDecoratorType {
+    DECORATOR_INVERTER,
+    DECORATOR_BLACKBOARD
+};
+
+enum BTServiceType {
+    SERVICE_RANDOM,
+    SERVICE_TIMER
+};
+
+// Node doesn't use any per agent state or blackboard key
+static const unsigned BT_NONE = 0xffffffff;
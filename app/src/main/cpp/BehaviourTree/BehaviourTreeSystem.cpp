@@ -0,0 +1,512 @@
+#include <Urho3D/Core/Context.h>
+#include <Urho3D/Core/CoreEvents.h>
+#include <Urho3D/Core/Timer.h>
+#include <Urho3D/IO/Log.h>
+#include <Urho3D/Resource/JSONFile.h>
+#include <Urho3D/Resource/ResourceCache.h>
+#include <Urho3D/Engine/DebugHud.h>
+
+#include "BehaviourTreeSystem.h"
+#include "BehaviourTree.h"
+#include "../Config/ConfigManager.h"
+#include "../Console/ConsoleHandlerEvents.h"
+#include "../Input/ControlDefines.h"
+#include "../CustomEvents.h"
+
+using namespace Urho3D;
+using namespace ConsoleHandlerEvents;
+using namespace CustomEvents;
+
+template <class T> static void EraseSwap(PODVector<T>& column, unsigned index)
+{
+    column[index] = column.Back();
+    column.Resize(column.Size() - 1);
+}
+
+BTAgentGroup::BTAgentGroup(BehaviourTreeAsset* asset):
+    asset_(asset)
+{
+    running_.Resize(asset->GetCompositeCount());
+    timers_.Resize(asset->GetTimerCount());
+    blackboard_.Resize(asset->GetKeyCount());
+}
+
+unsigned BTAgentGroup::AddAgent(BehaviourTree* owner, unsigned seed, double time)
+{
+    owners_.Push(owner);
+    lastTick_.Push(time);
+    yaw_.Push(0.0f);
+    buttons_.Push(0);
+    seed_.Push(seed ? seed : 1);
+    for (unsigned i = 0; i < running_.Size(); i++) {
+        running_[i].Push(0);
+    }
+    for (unsigned i = 0; i < timers_.Size(); i++) {
+        timers_[i].Push(0.0f);
+    }
+    for (unsigned i = 0; i < blackboard_.Size(); i++) {
+        blackboard_[i].Push(0.0f);
+    }
+    return owners_.Size() - 1;
+}
+
+void BTAgentGroup::RemoveAgent(unsigned agent)
+{
+    if (agent >= owners_.Size()) {
+        return;
+    }
+
+    EraseSwap(owners_, agent);
+    EraseSwap(lastTick_, agent);
+    EraseSwap(yaw_, agent);
+    EraseSwap(buttons_, agent);
+    EraseSwap(seed_, agent);
+    for (unsigned i = 0; i < running_.Size(); i++) {
+        EraseSwap(running_[i], agent);
+    }
+    for (unsigned i = 0; i < timers_.Size(); i++) {
+        EraseSwap(timers_[i], agent);
+    }
+    for (unsigned i = 0; i < blackboard_.Size(); i++) {
+        EraseSwap(blackboard_[i], agent);
+    }
+
+    if (agent < owners_.Size() && owners_[agent]) {
+        owners_[agent]->SetAgent(agent);
+    }
+}
+
+float BTAgentGroup::GetValue(unsigned agent, unsigned key) const
+{
+    if (key >= blackboard_.Size() || agent >= owners_.Size()) {
+        return 0.0f;
+    }
+    return blackboard_[key][agent];
+}
+
+void BTAgentGroup::SetValue(unsigned agent, unsigned key, float value)
+{
+    if (key < blackboard_.Size() && agent < owners_.Size()) {
+        blackboard_[key][agent] = value;
+    }
+}
+
+void BTAgentGroup::Tick(unsigned begin, unsigned end, double time)
+{
+    if (asset_->GetNodes().Empty()) {
+        return;
+    }
+
+    end = Min(end, owners_.Size());
+    for (unsigned agent = begin; agent < end; agent++) {
+        float timeStep = static_cast<float>(time - lastTick_[agent]);
+        lastTick_[agent] = time;
+        // Actions which are still running set their buttons again
+        buttons_[agent] = 0;
+        TickNode(agent, 0, timeStep);
+    }
+}
+
+BTState BTAgentGroup::TickNode(unsigned agent, unsigned index, float timeStep)
+{
+    const BTNode* nodes = asset_->GetNodes().Buffer();
+    const BTNode& node = nodes[index];
+
+    if (node.serviceCount_) {
+        const BTService* services = asset_->GetServices().Buffer() + node.firstService_;
+        for (unsigned i = 0; i < node.serviceCount_; i++) {
+            float& value = blackboard_[services[i].key_][agent];
+            if (services[i].type_ == SERVICE_RANDOM) {
+                value = NextRandom(agent) * services[i].value_;
+            } else {
+                value += timeStep * services[i].value_;
+            }
+        }
+    }
+
+    bool invert = false;
+    if (node.decoratorCount_) {
+        const BTDecorator* decorators = asset_->GetDecorators().Buffer() + node.firstDecorator_;
+        for (unsigned i = 0; i < node.decoratorCount_; i++) {
+            if (decorators[i].type_ == DECORATOR_INVERTER) {
+                invert = !invert;
+            } else if (decorators[i].key_ == BT_NONE || blackboard_[decorators[i].key_][agent] < decorators[i].value_) {
+                // Aborted subtree starts from the beginning next time
+                ResetSubtree(agent, index);
+                return FAILED;
+            }
+        }
+    }
+
+    BTState state = FAILED;
+    switch (node.nodeType_) {
+        case SELECTOR:
+        case SEQUENCE: {
+            unsigned& running = running_[node.state_][agent];
+            // Sequence stops at the first failed child, selector at the first successful one
+            BTState stop = node.nodeType_ == SEQUENCE ? FAILED : SUCCESS;
+            state = node.nodeType_ == SEQUENCE ? SUCCESS : FAILED;
+            unsigned child = running ? running : index + 1;
+            running = 0;
+            for (; child < node.next_; child = nodes[child].next_) {
+                BTState childState = TickNode(agent, child, timeStep);
+                if (childState == RUNNING) {
+                    running = child;
+                    state = RUNNING;
+                    break;
+                }
+                if (childState == stop) {
+                    state = stop;
+                    break;
+                }
+            }
+            break;
+        }
+        case ACTION:
+            switch (node.action_) {
+                case ACTION_MOVE_FORWARD:
+                    buttons_[agent] |= CTRL_FORWARD;
+                    break;
+                case ACTION_MOVE_BACK:
+                    buttons_[agent] |= CTRL_BACK;
+                    break;
+                case ACTION_TURN:
+                    yaw_[agent] += node.value_ * timeStep;
+                    break;
+                case ACTION_JUMP:
+                    buttons_[agent] |= CTRL_JUMP;
+                    break;
+                case ACTION_SET_VALUE:
+                    if (node.key_ != BT_NONE) {
+                        blackboard_[node.key_][agent] = node.value_;
+                    }
+                    break;
+                default:
+                    break;
+            }
+            state = SUCCESS;
+            if (node.state_ != BT_NONE) {
+                float& timer = timers_[node.state_][agent];
+                timer += timeStep;
+                if (timer < node.duration_) {
+                    state = RUNNING;
+                } else {
+                    timer = 0.0f;
+                }
+            }
+            break;
+        case CONDITION:
+            if (node.key_ != BT_NONE && blackboard_[node.key_][agent] >= node.value_) {
+                state = SUCCESS;
+            }
+            break;
+    }
+
+    if (invert && state != RUNNING) {
+        state = state == SUCCESS ? FAILED : SUCCESS;
+    }
+    return state;
+}
+
+void BTAgentGroup::ResetSubtree(unsigned agent, unsigned index)
+{
+    const BTNode* nodes = asset_->GetNodes().Buffer();
+    for (unsigned i = index; i < nodes[index].next_; i++) {
+        if (nodes[i].state_ == BT_NONE) {
+            continue;
+        }
+        if (nodes[i].nodeType_ == ACTION) {
+            timers_[nodes[i].state_][agent] = 0.0f;
+        } else {
+            running_[nodes[i].state_][agent] = 0;
+        }
+    }
+}
+
+float BTAgentGroup::NextRandom(unsigned agent)
+{
+    // Xorshift per agent, the global random generator is not thread safe
+    unsigned& seed = seed_[agent];
+    seed ^= seed << 13;
+    seed ^= seed >> 17;
+    seed ^= seed << 5;
+    return (seed & 0xffffff) / 16777216.0f;
+}
+
+BehaviourTreeSystem::BehaviourTreeSystem(Context* context):
+    Object(context)
+{
+    LoadConfig();
+    SubscribeToEvents();
+    RegisterConsoleCommands();
+}
+
+BehaviourTreeSystem::~BehaviourTreeSystem()
+{
+}
+
+void BehaviourTreeSystem::RegisterObject(Context* context)
+{
+    context->RegisterFactory<BehaviourTreeSystem>();
+}
+
+void BehaviourTreeSystem::LoadConfig()
+{
+    budgetMs_ = Max(GetSubsystem<ConfigManager>()->GetFloat("game", "AIBudgetMs", 2.0f), 0.1f);
+    batchSize_ = Max(GetSubsystem<ConfigManager>()->GetInt("game", "AIBatchSize", 64), 1);
+}
+
+void BehaviourTreeSystem::SubscribeToEvents()
+{
+    SubscribeToEvent(E_UPDATE, URHO3D_HANDLER(BehaviourTreeSystem, HandleUpdate));
+    SubscribeToEvent(E_CONFIG_CHANGED, URHO3D_HANDLER(BehaviourTreeSystem, HandleConfigChanged));
+}
+
+void BehaviourTreeSystem::RegisterConsoleCommands()
+{
+    SendEvent(E_CONSOLE_COMMAND_ADD, ConsoleCommandAdd::P_NAME, "behaviour_debug", ConsoleCommandAdd::P_EVENT, "#behaviour_debug",
+              ConsoleCommandAdd::P_DESCRIPTION, "Show AI agents or set blackboard value of all agents [key] [value]", ConsoleCommandAdd::P_OVERWRITE, true);
+    SubscribeToEvent("#behaviour_debug", [&](StringHash eventType, VariantMap& eventData) {
+        StringVector params = eventData["Parameters"].GetStringVector();
+        if (params.Size() > 2) {
+            for (auto it = groups_.Begin(); it != groups_.End(); ++it) {
+                BTAgentGroup* group = (*it).second_;
+                unsigned key = group->GetAsset()->FindKey(params[1]);
+                for (unsigned agent = 0; key != BT_NONE && agent < group->GetSize(); agent++) {
+                    group->SetValue(agent, key, ToFloat(params[2]));
+                }
+            }
+            return;
+        }
+
+        for (auto it = groups_.Begin(); it != groups_.End(); ++it) {
+            BehaviourTreeAsset* tree = (*it).second_->GetAsset();
+            URHO3D_LOGINFOF("Behaviour tree %s: %u agents, %u nodes, %u blackboard keys", tree->GetName().CString(),
+                            (*it).second_->GetSize(), tree->GetNodes().Size(), tree->GetKeyCount());
+        }
+        URHO3D_LOGINFOF("AI budget %.2f ms, agent tick %.3f us", budgetMs_, agentCost_);
+    });
+
+    SendEvent(E_CONSOLE_COMMAND_ADD, ConsoleCommandAdd::P_NAME, "behaviour_benchmark", ConsoleCommandAdd::P_EVENT, "#behaviour_benchmark",
+              ConsoleCommandAdd::P_DESCRIPTION, "Measure behaviour tree ticking [agents] [frames]", ConsoleCommandAdd::P_OVERWRITE, true);
+    SubscribeToEvent("#behaviour_benchmark", [&](StringHash eventType, VariantMap& eventData) {
+        StringVector params = eventData["Parameters"].GetStringVector();
+        unsigned agentCount = params.Size() > 1 ? ToUInt(params[1]) : 1000;
+        unsigned frames = params.Size() > 2 ? ToUInt(params[2]) : 100;
+        RunBenchmark(Max(agentCount, 1U), Max(frames, 1U));
+    });
+}
+
+BehaviourTreeAsset* BehaviourTreeSystem::GetTree(const String& config)
+{
+    auto it = trees_.Find(config);
+    if (it != trees_.End()) {
+        return (*it).second_;
+    }
+
+    auto json = GetSubsystem<ResourceCache>()->GetResource<JSONFile>(config);
+    if (!json) {
+        URHO3D_LOGERROR("Failed to load behaviour tree " + config);
+        return nullptr;
+    }
+
+    SharedPtr<BehaviourTreeAsset> tree(new BehaviourTreeAsset());
+    if (!tree->Load(config, json->GetRoot())) {
+        return nullptr;
+    }
+    trees_[config] = tree;
+    return tree;
+}
+
+BTAgentGroup* BehaviourTreeSystem::AddAgent(BehaviourTree* owner, const String& config, unsigned& agent)
+{
+    BehaviourTreeAsset* tree = GetTree(config);
+    if (!tree) {
+        return nullptr;
+    }
+
+    SharedPtr<BTAgentGroup>& group = groups_[config];
+    if (!group) {
+        group = new BTAgentGroup(tree);
+    }
+    nextSeed_ += 0x9e3779b9;
+    agent = group->AddAgent(owner, nextSeed_, time_);
+    return group;
+}
+
+void BehaviourTreeSystem::RemoveAgent(BTAgentGroup* group, unsigned agent)
+{
+    if (group) {
+        group->RemoveAgent(agent);
+    }
+}
+
+unsigned BehaviourTreeSystem::GetAgentCount() const
+{
+    unsigned count = 0;
+    for (auto it = groups_.Begin(); it != groups_.End(); ++it) {
+        count += (*it).second_->GetSize();
+    }
+    return count;
+}
+
+void BehaviourTreeSystem::HandleUpdate(StringHash eventType, VariantMap& eventData)
+{
+    using namespace Update;
+    time_ += eventData[P_TIMESTEP].GetFloat();
+
+    unsigned total = GetAgentCount();
+    if (total == 0) {
+        return;
+    }
+
+    // Estimate how many agents fit into the budget from the cost of the previous frames
+    unsigned count = total;
+    if (agentCost_ > 0.0f) {
+        count = Clamp(static_cast<unsigned>(budgetMs_ * 1000.0f / agentCost_), Min(batchSize_, total), total);
+    }
+    cursor_ %= total;
+
+    // Ticked range [cursor_, end) can wrap around to the first agents
+    batches_.Clear();
+    unsigned end = cursor_ + count;
+    unsigned base = 0;
+    for (auto it = groups_.Begin(); it != groups_.End(); ++it) {
+        BTAgentGroup* group = (*it).second_;
+        unsigned size = group->GetSize();
+        unsigned first = Max(cursor_, base);
+        unsigned last = Min(end, base + size);
+        if (first < last) {
+            AddBatches(group, first - base, last - first, time_);
+        }
+        if (end > total) {
+            last = Min(end - total, base + size);
+            if (base < last) {
+                AddBatches(group, 0, last - base, time_);
+            }
+        }
+        base += size;
+    }
+    cursor_ = end % total;
+
+    HiresTimer timer;
+    RunBatches();
+    float cost = timer.GetUSec(false) / static_cast<float>(count);
+    agentCost_ = agentCost_ > 0.0f ? Lerp(agentCost_, cost, 0.1f) : cost;
+
+    if (GetSubsystem<DebugHud>()) {
+        GetSubsystem<DebugHud>()->SetAppStats("AI agents", total);
+        GetSubsystem<DebugHud>()->SetAppStats("AI agents ticked", count);
+        GetSubsystem<DebugHud>()->SetAppStats("AI tick ms", cost * count / 1000.0f);
+    }
+}
+
+void BehaviourTreeSystem::HandleConfigChanged(StringHash eventType, VariantMap& eventData)
+{
+    using namespace ConfigChanged;
+    if (eventData[P_SECTION].GetString().ToLower() == "game" && eventData[P_PARAMETER].GetString().StartsWith("AI")) {
+        LoadConfig();
+    }
+}
+
+void BehaviourTreeSystem::AddBatches(BTAgentGroup* group, unsigned begin, unsigned count, double time)
+{
+    for (unsigned i = begin; i < begin + count; i += batchSize_) {
+        BTBatch batch;
+        batch.group_ = group;
+        batch.begin_ = i;
+        batch.end_ = Min(i + batchSize_, begin + count);
+        batch.time_ = time;
+        batches_.Push(batch);
+    }
+}
+
+void BehaviourTreeSystem::RunBatches()
+{
+    auto workQueue = GetSubsystem<WorkQueue>();
+    if (batches_.Size() < 2 || workQueue->GetNumThreads() == 0) {
+        for (unsigned i = 0; i < batches_.Size(); i++) {
+            batches_[i].group_->Tick(batches_[i].begin_, batches_[i].end_, batches_[i].time_);
+        }
+        return;
+    }
+
+    // Batches only touch their own agent slots, so they can run in any order.
+    // Helpers and the main thread claim them one by one, so only this system's work is waited for
+    nextBatch_ = 0;
+    unsigned helperCount = Min(workQueue->GetNumThreads(), batches_.Size() - 1);
+    pendingHelpers_ = helperCount;
+    for (unsigned i = 0; i < helperCount; i++) {
+        SharedPtr<WorkItem> item = workQueue->GetFreeItem();
+        item->workFunction_ = TickBatchWork;
+        item->aux_ = this;
+        item->priority_ = M_MAX_UNSIGNED;
+        item->sendEvent_ = false;
+        workQueue->AddWorkItem(item);
+        helperItems_.Push(item);
+    }
+
+    TickBatches();
+
+    // Helpers which haven't started have nothing left to claim
+    for (auto it = helperItems_.Begin(); it != helperItems_.End(); ++it) {
+        if (workQueue->RemoveWorkItem(*it)) {
+            pendingHelpers_--;
+        }
+    }
+    helperItems_.Clear();
+    // Started helpers finish the batch they claimed last
+    while (pendingHelpers_ > 0) {
+        Time::Sleep(0);
+    }
+}
+
+void BehaviourTreeSystem::TickBatches()
+{
+    for (unsigned i = nextBatch_++; i < batches_.Size(); i = nextBatch_++) {
+        batches_[i].group_->Tick(batches_[i].begin_, batches_[i].end_, batches_[i].time_);
+    }
+}
+
+void BehaviourTreeSystem::TickBatchWork(const WorkItem* item, unsigned threadIndex)
+{
+    auto system = static_cast<BehaviourTreeSystem*>(item->aux_);
+    system->TickBatches();
+    system->pendingHelpers_--;
+}
+
+void BehaviourTreeSystem::RunBenchmark(unsigned agentCount, unsigned frames)
+{
+    BehaviourTreeAsset* tree = GetTree("Config/Behaviour.json");
+    if (!tree) {
+        return;
+    }
+
+    const double FRAME_TIME = 1.0 / 60.0;
+    SharedPtr<BTAgentGroup> serialGroup(new BTAgentGroup(tree));
+    SharedPtr<BTAgentGroup> batchedGroup(new BTAgentGroup(tree));
+    for (unsigned i = 0; i < agentCount; i++) {
+        serialGroup->AddAgent(nullptr, i + 1, 0.0);
+        batchedGroup->AddAgent(nullptr, i + 1, 0.0);
+    }
+
+    HiresTimer timer;
+    for (unsigned frame = 1; frame <= frames; frame++) {
+        serialGroup->Tick(0, agentCount, frame * FRAME_TIME);
+    }
+    long long serialTime = timer.GetUSec(true);
+
+    for (unsigned frame = 1; frame <= frames; frame++) {
+        batches_.Clear();
+        AddBatches(batchedGroup, 0, agentCount, frame * FRAME_TIME);
+        RunBatches();
+    }
+    long long batchedTime = timer.GetUSec(false);
+    batches_.Clear();
+
+    float serialMs = serialTime / 1000.0f / frames;
+    float batchedMs = batchedTime / 1000.0f / frames;
+    unsigned budgetAgents = batchedMs > 0.0f ? static_cast<unsigned>(budgetMs_ / batchedMs * agentCount) : agentCount;
+    URHO3D_LOGINFOF("Behaviour tree benchmark, %u agents, %u frames: serial %.3f ms/frame, batched %.3f ms/frame on %u threads, %u agents fit into %.2f ms budget",
+                    agentCount, frames, serialMs, batchedMs, GetSubsystem<WorkQueue>()->GetNumThreads() + 1, budgetAgents, budgetMs_);
+}
@@ -0,0 +1,135 @@
+#pragma once
+
+#include <Urho3D/Core/Object.h>
+#include <Urho3D/Core/WorkQueue.h>
+#include <Urho3D/Container/HashMap.h>
+#include <atomic>
+
+#include "BehaviourTreeAsset.h"
+
+using namespace Urho3D;
+
+class BehaviourTree;
+
+/**
+ * Runtime state of all agents which run the same tree, each value is stored
+ * in its own column indexed by the agent slot
+ */
+class BTAgentGroup : public RefCounted
+{
+public:
+    explicit BTAgentGroup(BehaviourTreeAsset* asset);
+
+    unsigned AddAgent(BehaviourTree* owner, unsigned seed, double time);
+    /**
+     * Last agent is moved into the removed slot and its owner is notified about the new slot
+     */
+    void RemoveAgent(unsigned agent);
+    /**
+     * Tick agents [begin, end), each agent advances by the time passed since its previous tick
+     */
+    void Tick(unsigned begin, unsigned end, double time);
+
+    unsigned GetSize() const { return owners_.Size(); }
+    BehaviourTreeAsset* GetAsset() const { return asset_; }
+    float GetValue(unsigned agent, unsigned key) const;
+    void SetValue(unsigned agent, unsigned key, float value);
+    float GetYaw(unsigned agent) const { return yaw_[agent]; }
+    unsigned GetButtons(unsigned agent) const { return buttons_[agent]; }
+
+private:
+    BTState TickNode(unsigned agent, unsigned index, float timeStep);
+    void ResetSubtree(unsigned agent, unsigned index);
+    float NextRandom(unsigned agent);
+
+    SharedPtr<BehaviourTreeAsset> asset_;
+    PODVector<BehaviourTree*> owners_;
+    PODVector<double> lastTick_;
+    PODVector<float> yaw_;
+    PODVector<unsigned> buttons_;
+    PODVector<unsigned> seed_;
+    // Running child node index of each composite, 0 when the composite starts from its first child
+    Vector<PODVector<unsigned>> running_;
+    // Elapsed time of each leaf with duration
+    Vector<PODVector<float>> timers_;
+    Vector<PODVector<float>> blackboard_;
+};
+
+struct BTBatch {
+    BTAgentGroup* group_;
+    unsigned begin_;
+    unsigned end_;
+    double time_;
+};
+
+/**
+ * Owns compiled behaviour trees and ticks all agents within the per frame AI budget.
+ * Agents are ticked round robin in batches on the worker threads and the main thread, agents which
+ * don't fit into the budget continue in the next frame with a larger time step
+ */
+class BehaviourTreeSystem : public Object
+{
+    URHO3D_OBJECT(BehaviourTreeSystem, Object);
+
+public:
+    explicit BehaviourTreeSystem(Context* context);
+
+    virtual ~BehaviourTreeSystem();
+
+    static void RegisterObject(Context* context);
+
+    /**
+     * Compiled tree of the config file, each file is compiled only once
+     */
+    BehaviourTreeAsset* GetTree(const String& config);
+
+    BTAgentGroup* AddAgent(BehaviourTree* owner, const String& config, unsigned& agent);
+
+    void RemoveAgent(BTAgentGroup* group, unsigned agent);
+
+    unsigned GetAgentCount() const;
+
+private:
+    void SubscribeToEvents();
+
+    void RegisterConsoleCommands();
+
+    void LoadConfig();
+
+    void HandleUpdate(StringHash eventType, VariantMap& eventData);
+
+    void HandleConfigChanged(StringHash eventType, VariantMap& eventData);
+
+    /**
+     * Split agents [begin, begin + count) of the group into batches
+     */
+    void AddBatches(BTAgentGroup* group, unsigned begin, unsigned count, double time);
+
+    void RunBatches();
+
+    /**
+     * Claim and tick batches until none are left, runs on the main thread and the helper work items
+     */
+    void TickBatches();
+
+    static void TickBatchWork(const WorkItem* item, unsigned threadIndex);
+
+    void RunBenchmark(unsigned agentCount, unsigned frames);
+
+    HashMap<StringHash, SharedPtr<BehaviourTreeAsset>> trees_;
+    HashMap<StringHash, SharedPtr<BTAgentGroup>> groups_;
+    PODVector<BTBatch> batches_;
+    // Next unclaimed batch of the running frame
+    std::atomic<unsigned> nextBatch_{0};
+    // Helper work items which haven't finished yet, the frame can't continue before they are done
+    std::atomic<unsigned> pendingHelpers_{0};
+    Vector<SharedPtr<WorkItem>> helperItems_;
+    double time_{0.0};
+    // Round robin position over all agents
+    unsigned cursor_{0};
+    unsigned nextSeed_{0};
+    float budgetMs_{2.0f};
+    unsigned batchSize_{64};
+    // Smoothed wall time of a single agent tick in microseconds
+    float agentCost_{0.0f};
+};
@@ -50,23 +50,81 @@ bool ConfigFile::BeginLoad(Deserializer& source) {
         return false;
     }
 
+    configMap_.Clear();
     configMap_.Push(ConfigSection());
     ConfigSection* configSection(&configMap_.Back());
     while (!source.IsEof()) {
         String line(source.ReadLine());
 
-        // Parse headers.
+        // Parse headers, only the name is kept so that smart save can write it back.
         if (line.StartsWith("[") && line.EndsWith("]")) {
             configMap_.Push(ConfigSection());
             configSection = &configMap_.Back();
+            line = ParseHeader(line);
         }
 
         configSection->Push(line);
     }
 
+    BuildIndex();
+
     return true;
 }
 
+void ConfigFile::BuildIndex() {
+    sections_.Clear();
+    index_.Clear();
+
+    for (unsigned i = 0; i < configMap_.Size(); i++) {
+        if (configMap_[i].Empty()) {
+            continue;
+        }
+        sections_[GetKey(i == 0 ? String::EMPTY : configMap_[i].Front(), String::EMPTY)] = i;
+    }
+
+    for (HashMap<StringHash, unsigned>::ConstIterator itr(sections_.Begin()); itr != sections_.End(); ++itr) {
+        IndexSection(itr->second_);
+    }
+}
+
+void ConfigFile::IndexSection(unsigned sectionIndex) {
+    const ConfigSection& configSection(configMap_[sectionIndex]);
+    const String header(sectionIndex == 0 ? String::EMPTY : configSection.Front());
+
+    for (unsigned i = sectionIndex == 0 ? 0 : 1; i < configSection.Size(); i++) {
+        String property;
+        String value;
+        ParseProperty(configSection[i], property, value);
+
+        if (property == String::EMPTY || value == String::EMPTY) {
+            continue;
+        }
+
+        // First occurrence of the property wins.
+        StringHash key(GetKey(header, property));
+        if (!index_.Contains(key)) {
+            ConfigEntry& entry(index_[key]);
+            entry.section_ = sectionIndex;
+            entry.line_ = i;
+            entry.value_ = value;
+        }
+    }
+}
+
+StringHash ConfigFile::GetKey(const String& section, const String& parameter) const {
+    const String key(section + "/" + parameter);
+    return StringHash(caseSensitive_ ? key : key.ToLower());
+}
+
+ConfigEntry* ConfigFile::FindEntry(const String& section, const String& parameter) {
+    HashMap<StringHash, ConfigEntry>::Iterator itr(index_.Find(GetKey(section, parameter)));
+    if (itr == index_.End()) {
+        return nullptr;
+    }
+
+    return &itr->second_;
+}
+
 bool ConfigFile::Save(Serializer& dest) const {
     dest.WriteLine("# AUTO-GENERATED");
 
@@ -165,270 +223,171 @@ bool ConfigFile::FromString(const String& source) {
 }
 
 bool ConfigFile::Has(const String& section, const String& parameter) {
-    return GetString(section, parameter) != String::EMPTY;
+    return FindEntry(section, parameter) != nullptr;
 }
 
 const String ConfigFile::GetString(const String& section, const String& parameter, const String& defaultValue) {
-    // Find the correct section.
-    ConfigSection* configSection(nullptr);
-    for (Vector<ConfigSection>::Iterator itr(configMap_.Begin()); itr != configMap_.End(); ++itr) {
-        if (itr->Begin() == itr->End()) {
-            continue;
-        }
-
-        String& header(*(itr->Begin()));
-        header = ParseHeader(header);
-
-        if (caseSensitive_) {
-            if (section == header) {
-                configSection = &(*itr);
-            }
-        } else {
-            if (section.ToLower() == header.ToLower()) {
-                configSection = &(*itr);
-            }
-        }
-    }
+    const ConfigEntry* entry(FindEntry(section, parameter));
 
-    // Section doesn't exist.
-    if (!configSection) {
+    // Section or parameter doesn't exist.
+    if (!entry) {
         return defaultValue;
     }
 
-    for (Vector<String>::ConstIterator itr(configSection->Begin()); itr != configSection->End(); ++itr) {
-        String property;
-        String value;
-        ParseProperty(*itr, property, value);
-
-        if (property == String::EMPTY || value == String::EMPTY) {
-            continue;
-        }
-
-        if (caseSensitive_) {
-            if (parameter == property) {
-                return value;
-            }
-        } else {
-            if (parameter.ToLower() == property.ToLower()) {
-                return value;
-            }
-        }
-    }
-
-    return defaultValue;
+    return entry->value_;
 }
 
 const int ConfigFile::GetInt(const String& section, const String& parameter, const int defaultValue) {
-    String property(GetString(section, parameter));
-
-    if (property == String::EMPTY) {
-        return defaultValue;
-    }
-
-    return ToInt(property);
+    return GetValue<int>(section, parameter, defaultValue, [](const String& value) { return ToInt(value); });
 }
 
 const bool ConfigFile::GetBool(const String& section, const String& parameter, const bool defaultValue) {
-    String property(GetString(section, parameter));
-
-    if (property == String::EMPTY) {
-        return defaultValue;
-    }
-
-    return ToBool(property);
+    return GetValue<bool>(section, parameter, defaultValue, [](const String& value) { return ToBool(value); });
 }
 
 const float ConfigFile::GetFloat(const String& section, const String& parameter, const float defaultValue) {
-    String property(GetString(section, parameter));
-
-    if (property == String::EMPTY) {
-        return defaultValue;
-    }
-
-    return ToFloat(property);
+    return GetValue<float>(section, parameter, defaultValue, [](const String& value) { return ToFloat(value); });
 }
 
 const Vector2 ConfigFile::GetVector2(const String& section, const String& parameter, const Vector2& defaultValue) {
-    String property(GetString(section, parameter));
-
-    if (property == String::EMPTY) {
-        return defaultValue;
-    }
-
-    return ToVector2(property);
+    return GetValue<Vector2>(section, parameter, defaultValue, [](const String& value) { return ToVector2(value); });
 }
 
 const Vector3 ConfigFile::GetVector3(const String& section, const String& parameter, const Vector3& defaultValue) {
-    String property(GetString(section, parameter));
-
-    if (property == String::EMPTY) {
-        return defaultValue;
-    }
-
-    return ToVector3(property);
+    return GetValue<Vector3>(section, parameter, defaultValue, [](const String& value) { return ToVector3(value); });
 }
 
 const Vector4 ConfigFile::GetVector4(const String& section, const String& parameter, const Vector4& defaultValue) {
-    String property(GetString(section, parameter));
-
-    if (property == String::EMPTY) {
-        return defaultValue;
-    }
-
-    return ToVector4(property);
+    return GetValue<Vector4>(section, parameter, defaultValue, [](const String& value) { return ToVector4(value); });
 }
 
 const Quaternion ConfigFile::GetQuaternion(const String& section, const String& parameter, const Quaternion& defaultValue) {
-    String property(GetString(section, parameter));
-
-    if (property == String::EMPTY) {
-        return defaultValue;
-    }
-
-    return ToQuaternion(property);
+    return GetValue<Quaternion>(section, parameter, defaultValue, [](const String& value) { return ToQuaternion(value); });
 }
 
 const Color ConfigFile::GetColor(const String& section, const String& parameter, const Color& defaultValue) {
-    String property(GetString(section, parameter));
-
-    if (property == String::EMPTY) {
-        return defaultValue;
-    }
-
-    return ToColor(property);
+    return GetValue<Color>(section, parameter, defaultValue, [](const String& value) { return ToColor(value); });
 }
 
 const IntRect ConfigFile::GetIntRect(const String& section, const String& parameter, const IntRect& defaultValue) {
-    String property(GetString(section, parameter));
-
-    if (property == String::EMPTY) {
-        return defaultValue;
-    }
-
-    return ToIntRect(property);
+    return GetValue<IntRect>(section, parameter, defaultValue, [](const String& value) { return ToIntRect(value); });
 }
 
 const IntVector2 ConfigFile::GetIntVector2(const String& section, const String& parameter, const IntVector2& defaultValue) {
-    String property(GetString(section, parameter));
-
-    if (property == String::EMPTY) {
-        return defaultValue;
-    }
-
-    return ToIntVector2(property);
+    return GetValue<IntVector2>(section, parameter, defaultValue, [](const String& value) { return ToIntVector2(value); });
 }
 
 const Matrix3 ConfigFile::GetMatrix3(const String& section, const String& parameter, const Matrix3& defaultValue) {
-    String property(GetString(section, parameter));
-
-    if (property == String::EMPTY) {
-        return defaultValue;
-    }
-
-    return ToMatrix3(property);
+    return GetValue<Matrix3>(section, parameter, defaultValue, [](const String& value) { return ToMatrix3(value); });
 }
 
 const Matrix3x4 ConfigFile::GetMatrix3x4(const String& section, const String& parameter, const Matrix3x4& defaultValue) {
-    String property(GetString(section, parameter));
-
-    if (property == String::EMPTY) {
-        return defaultValue;
-    }
-
-    return ToMatrix3x4(property);
+    return GetValue<Matrix3x4>(section, parameter, defaultValue, [](const String& value) { return ToMatrix3x4(value); });
 }
 
 const Matrix4 ConfigFile::GetMatrix4(const String& section, const String& parameter, const Matrix4& defaultValue) {
-    String property(GetString(section, parameter));
-
-    if (property == String::EMPTY) {
-        return defaultValue;
-    }
-
-    return ToMatrix4(property);
+    return GetValue<Matrix4>(section, parameter, defaultValue, [](const String& value) { return ToMatrix4(value); });
 }
 
 void ConfigFile::Set(const String& section, const String& parameter, const String& value) {
-    // Find the correct section.
-    ConfigSection* configSection(nullptr);
-    for (Vector<ConfigSection>::Iterator itr(configMap_.Begin()); itr != configMap_.End(); ++itr) {
-        if (itr->Begin() == itr->End()) {
-            continue;
+    const StringHash key(GetKey(section, parameter));
+
+    // Known property, its line is replaced directly.
+    HashMap<StringHash, ConfigEntry>::Iterator entry(index_.Find(key));
+    if (entry != index_.End()) {
+        SetLineValue(configMap_[entry->second_.section_][entry->second_.line_], parameter, value);
+        if (value == String::EMPTY) {
+            index_.Erase(entry);
+        } else {
+            entry->second_.value_ = value;
+            entry->second_.typed_ = Variant::EMPTY;
         }
+        return;
+    }
 
-        String& header(*(itr->Begin()));
-        header = ParseHeader(header);
+    // Find the correct section.
+    unsigned sectionIndex(0);
+    if (section != String::EMPTY) {
+        const StringHash sectionKey(GetKey(section, String::EMPTY));
+        HashMap<StringHash, unsigned>::ConstIterator itr(sections_.Find(sectionKey));
 
-        if (caseSensitive_) {
-            if (section == header) {
-                configSection = &(*itr);
-            }
+        if (itr != sections_.End()) {
+            sectionIndex = itr->second_;
         } else {
-            if (section.ToLower() == header.ToLower()) {
-                configSection = &(*itr);
-            }
+            // Section doesn't exist, create it with header and blank line.
+            configMap_.Push(ConfigSection());
+            configMap_.Back().Push(ParseHeader(section));
+            configMap_.Back().Push("");
+            sectionIndex = configMap_.Size() - 1;
+            sections_[sectionKey] = sectionIndex;
         }
     }
+    ConfigSection* configSection(&configMap_[sectionIndex]);
 
-    if (section == String::EMPTY) {
-        configSection = &(*configMap_.Begin());
+    // Property may exist without a value, which is not indexed.
+    int index(-1);
+    for (unsigned i = sectionIndex == 0 ? 0 : 1; i < configSection->Size(); i++) {
+        if (SetLineValue((*configSection)[i], parameter, value)) {
+            index = i;
+            break;
+        }
     }
 
-    // Section doesn't exist.
-    if (!configSection) {
-        String sectionName(section);
-
-        // Format header.
-        if (ConfigFile::ParseHeader(sectionName) == sectionName) {
-            sectionName = "[" + sectionName + "]";
+    if (index < 0) {
+        // Parameter doesn't exist yet.
+        // Find a good place to insert the parameter, avoiding lines which are entirely comments or whitespacing.
+        index = configSection->Size() - 1;
+        for (int i(index); i >= 0; i--) {
+            if (ParseComments((*configSection)[i]) != String::EMPTY) {
+                index = i + 1;
+                break;
+            }
         }
+        index = Max(index, 0);
+        configSection->Insert(index, parameter + "=" + value);
 
-        // Create section.
-        configMap_.Push(ConfigSection());
-        configSection = &configMap_.Back();
+        // Following lines of the section moved down by one.
+        for (HashMap<StringHash, ConfigEntry>::Iterator itr(index_.Begin()); itr != index_.End(); ++itr) {
+            if (itr->second_.section_ == sectionIndex && itr->second_.line_ >= (unsigned) index) {
+                itr->second_.line_++;
+            }
+        }
+    }
 
-        // Add header and blank line.
-        configSection->Push(sectionName);
-        configSection->Push("");
+    if (value != String::EMPTY) {
+        ConfigEntry& newEntry(index_[key]);
+        newEntry.section_ = sectionIndex;
+        newEntry.line_ = index;
+        newEntry.value_ = value;
+        newEntry.typed_ = Variant::EMPTY;
     }
+}
 
-    String* line(nullptr);
-    unsigned separatorPos(0);
-    for (Vector<String>::Iterator itr(configSection->Begin()); itr != configSection->End(); ++itr) {
-        // Find property separator.
-        separatorPos = itr->Find("=");
-        if (separatorPos == String::NPOS) {
-            separatorPos = itr->Find(":");
-        }
+bool ConfigFile::SetLineValue(String& line, const String& parameter, const String& value) const {
+    // Find property separator.
+    unsigned separatorPos(line.Find("="));
+    if (separatorPos == String::NPOS) {
+        separatorPos = line.Find(":");
+    }
 
-        // Not a property.
-        if (separatorPos == String::NPOS) {
-            continue;
-        }
+    // Not a property.
+    if (separatorPos == String::NPOS) {
+        return false;
+    }
 
-        String workingLine = ParseComments(*itr);
+    String workingLine = ParseComments(line);
 
-        String oldParameter(workingLine.Substring(0, separatorPos).Trimmed());
-        String oldValue(workingLine.Substring(separatorPos + 1).Trimmed());
+    String oldParameter(workingLine.Substring(0, separatorPos).Trimmed());
+    String oldValue(workingLine.Substring(separatorPos + 1).Trimmed());
 
-        // Not the correct parameter.
-        if (caseSensitive_ ? (oldParameter == parameter) : (oldParameter.ToLower() == parameter.ToLower())) {
-            // Replace the value.
-            itr->Replace(itr->Find(oldValue, separatorPos), oldValue.Length(), value);
-            return;
-        }
+    // Not the correct parameter.
+    if (caseSensitive_ ? (oldParameter != parameter) : (oldParameter.ToLower() != parameter.ToLower())) {
+        return false;
     }
 
-    // Parameter doesn't exist yet.
-    // Find a good place to insert the parameter, avoiding lines which are entirely comments or whitespacing.
-    int index(configSection->Size() - 1);
-    for (int i(index); i >= 0; i--) {
-        if (ParseComments((*configSection)[i]) != String::EMPTY) {
-            index = i + 1;
-            break;
-        }
-    }
-    configSection->Insert(index, parameter + "=" + value);
+    // Replace the value.
+    line.Replace(line.Find(oldValue, separatorPos), oldValue.Length(), value);
+    return true;
 }
 
 // Returns header name without bracket.
@@ -27,10 +27,20 @@ SOFTWARE.
 #include <Urho3D/Resource/Resource.h>
 #include <Urho3D/Core/Object.h>
 #include <Urho3D/Core/StringUtils.h>
+#include <Urho3D/Core/Variant.h>
 
 typedef Urho3D::Vector<Urho3D::String> ConfigSection;
 typedef Urho3D::Vector<ConfigSection> ConfigMap;
 
+// Parsed property, points back to its line so that the original file layout is kept.
+struct ConfigEntry {
+    unsigned section_;
+    unsigned line_;
+    Urho3D::String value_;
+    // Value converted by the last typed getter, reused until the type or value changes.
+    Urho3D::Variant typed_;
+};
+
 class ConfigFile : public Urho3D::Resource {
 public:
 URHO3D_OBJECT(ConfigFile, Urho3D::Object);
@@ -86,7 +96,30 @@ public:
     static const Urho3D::String ParseComments(Urho3D::String line);
 
 protected:
+    // Rebuild section and property lookup tables from the raw lines.
+    void BuildIndex();
+    void IndexSection(unsigned sectionIndex);
+    Urho3D::StringHash GetKey(const Urho3D::String& section, const Urho3D::String& parameter) const;
+    ConfigEntry* FindEntry(const Urho3D::String& section, const Urho3D::String& parameter);
+    // Replace the value if the line holds the parameter.
+    bool SetLineValue(Urho3D::String& line, const Urho3D::String& parameter, const Urho3D::String& value) const;
+
+    template <class T> T GetValue(const Urho3D::String& section, const Urho3D::String& parameter, const T& defaultValue, T (*parse)(const Urho3D::String&)) {
+        ConfigEntry* entry(FindEntry(section, parameter));
+        if (!entry) {
+            return defaultValue;
+        }
+
+        if (entry->typed_.GetType() != Urho3D::GetVariantType<T>()) {
+            entry->typed_ = parse(entry->value_);
+        }
+        return entry->typed_.Get<T>();
+    }
 
     bool caseSensitive_;
     ConfigMap configMap_;
+    // Section key to index in configMap_, the last section with the same name wins.
+    Urho3D::HashMap<Urho3D::StringHash, unsigned> sections_;
+    // Section and parameter key to the first non-empty property of the section.
+    Urho3D::HashMap<Urho3D::StringHash, ConfigEntry> index_;
 };
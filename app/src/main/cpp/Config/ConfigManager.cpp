@@ -24,13 +24,20 @@ SOFTWARE.
 
 #include "ConfigManager.h"
 #include "ConfigFile.h"
+#include "../CustomEvents.h"
 
 #include <Urho3D/Core/Context.h>
+#include <Urho3D/Core/CoreEvents.h>
+#include <Urho3D/IO/Log.h>
 #include <Urho3D/IO/File.h>
 #include <Urho3D/IO/FileSystem.h>
 #include <Urho3D/Resource/ResourceCache.h>
 
 using namespace Urho3D;
+using namespace CustomEvents;
+
+// How often watched directories are checked for changes, in MS
+static const unsigned CONFIG_WATCH_INTERVAL = 500;
 
 ConfigManager::ConfigManager(Context* context, const String& defaultFileName, bool caseSensitive, bool saveDefaultParameters) :
         Object(context)
@@ -54,7 +61,12 @@ bool ConfigManager::Has(const String& section, const String& parameter) {
 void ConfigManager::Set(const String& section, const String& parameter, const Variant& value) {
     SettingsMap* sectionMap(GetSection(section, true));
 
-    sectionMap->operator[](parameter) = value;
+    Variant& current(sectionMap->operator[](parameter));
+    if (current.GetType() == VAR_VOIDPTR) {
+        // Sub-section replaced by a value.
+        sectionCache_.Clear();
+    }
+    current = value;
     SetGlobalVar(parameter, value);
 }
 
@@ -375,6 +387,7 @@ const Matrix4 ConfigManager::GetMatrix4(const String& section, const String& par
 // Clears all settings.
 void ConfigManager::Clear() {
     map_.Clear();
+    sectionCache_.Clear();
 }
 
 // Load settings from file.
@@ -391,9 +404,135 @@ bool ConfigManager::Load(const String& fileName, bool overwriteExisting) {
     File file(context_, fileName, FILE_READ);
     configFile.BeginLoad(file);
 
+    if (fileName == defaultFileName_) {
+        loadedValues_ = GetFileValues(configFile);
+    }
+
     return Load(configFile, overwriteExisting);
 }
 
+ConfigFileValues ConfigManager::GetFileValues(ConfigFile& configFile) {
+    ConfigFileValues values;
+    const ConfigMap* map(configFile.GetMap());
+
+    for (Vector<ConfigSection>::ConstIterator itr(map->Begin()); itr != map->End(); ++itr) {
+        if (itr->Begin() == itr->End()) {
+            continue;
+        }
+
+        String header(itr != map->Begin() ? ConfigFile::ParseHeader(itr->Front()) : String::EMPTY);
+        HashMap<String, String>& section(values[header]);
+
+        for (Vector<String>::ConstIterator section_itr = ++itr->Begin(); section_itr != itr->End(); ++section_itr) {
+            String parameter;
+            String value;
+            ConfigFile::ParseProperty(*section_itr, parameter, value);
+
+            if (parameter != String::EMPTY && value != String::EMPTY) {
+                section[parameter] = value;
+            }
+        }
+    }
+
+    return values;
+}
+
+void ConfigManager::StartWatching() {
+    watchedDefaultFile_ = AddWatcher(defaultFileName_);
+    SubscribeToEvent(E_BEGINFRAME, URHO3D_HANDLER(ConfigManager, HandleBeginFrame));
+}
+
+void ConfigManager::WatchFile(const String& path, const String& filename, const String& prefix) {
+    VariantMap& data(watchedFiles_[AddWatcher(path)]);
+    data[LoadConfig::P_FILEPATH] = filename;
+    data[LoadConfig::P_PREFIX] = prefix;
+    SubscribeToEvent(E_BEGINFRAME, URHO3D_HANDLER(ConfigManager, HandleBeginFrame));
+}
+
+String ConfigManager::AddWatcher(const String& path) {
+    String directory(AddTrailingSlash(GetInternalPath(GetPath(path))));
+
+    if (!watchers_.Contains(directory)) {
+        SharedPtr<FileWatcher> watcher(new FileWatcher(context_));
+        if (watcher->StartWatching(directory, false)) {
+            URHO3D_LOGINFO("Watching config directory " + directory);
+        }
+        watchers_[directory] = watcher;
+    }
+
+    return directory + GetFileNameAndExtension(path);
+}
+
+void ConfigManager::HandleBeginFrame(StringHash eventType, VariantMap& eventData) {
+    if (watchTimer_.GetMSec(false) < CONFIG_WATCH_INTERVAL) {
+        return;
+    }
+    watchTimer_.Reset();
+
+    for (HashMap<String, SharedPtr<FileWatcher>>::ConstIterator itr(watchers_.Begin()); itr != watchers_.End(); ++itr) {
+        String change;
+        while (itr->second_->GetNextChange(change)) {
+            const String file(itr->first_ + GetInternalPath(change));
+
+            if (file == watchedDefaultFile_) {
+                Reload();
+                continue;
+            }
+
+            HashMap<String, VariantMap>::Iterator watched(watchedFiles_.Find(file));
+            if (watched != watchedFiles_.End()) {
+                URHO3D_LOGINFO("Config file changed " + file);
+                SendEvent(E_LOAD_CONFIG, watched->second_);
+            }
+        }
+    }
+}
+
+void ConfigManager::Reload() {
+    File file(context_, defaultFileName_, FILE_READ);
+    if (!file.IsOpen()) {
+        return;
+    }
+
+    ConfigFile configFile(context_);
+    configFile.BeginLoad(file);
+    ConfigFileValues values(GetFileValues(configFile));
+
+    unsigned changes(0);
+    for (ConfigFileValues::ConstIterator section(values.Begin()); section != values.End(); ++section) {
+        ConfigFileValues::ConstIterator oldSection(loadedValues_.Find(section->first_));
+
+        for (HashMap<String, String>::ConstIterator itr(section->second_.Begin()); itr != section->second_.End(); ++itr) {
+            // Unchanged in the file.
+            if (oldSection != loadedValues_.End()) {
+                HashMap<String, String>::ConstIterator oldValue(oldSection->second_.Find(itr->first_));
+                if (oldValue != oldSection->second_.End() && oldValue->second_ == itr->second_) {
+                    continue;
+                }
+            }
+
+            // Already in use, e.g. the file was written by Save.
+            const Variant current(Get(section->first_, itr->first_));
+            if (current != Variant::EMPTY && current.ToString() == itr->second_) {
+                continue;
+            }
+
+            Set(section->first_, itr->first_, itr->second_);
+            changes++;
+
+            using namespace ConfigChanged;
+            VariantMap& data = GetEventDataMap();
+            data[P_SECTION] = section->first_;
+            data[P_PARAMETER] = itr->first_;
+            data[P_VALUE] = itr->second_;
+            SendEvent(E_CONFIG_CHANGED, data);
+        }
+    }
+
+    loadedValues_ = values;
+    URHO3D_LOGINFOF("Config file %s reloaded, %u parameters changed", defaultFileName_.CString(), changes);
+}
+
 bool ConfigManager::Load(ConfigFile& configFile, bool overwriteExisting) {
     const ConfigMap* map(configFile.GetMap());
 
@@ -568,6 +707,12 @@ SettingsMap* ConfigManager::GetSection(const String& section, bool create) {
         return &map_;
     }
 
+    // Already resolved section.
+    HashMap<String, SettingsMap*>::ConstIterator cached(sectionCache_.Find(section));
+    if (cached != sectionCache_.End()) {
+        return cached->second_;
+    }
+
     // Split sections by '.' or '/'.
     // Comments will ignore splits behind them.
     while (splitPos != String::NPOS) {
@@ -604,17 +749,13 @@ SettingsMap* ConfigManager::GetSection(const String& section, bool create) {
 
         // Find section.
         SettingsMap* newMap(nullptr);
-        for (SettingsMap::ConstIterator map_itr(currentMap->Begin()); map_itr != currentMap->End(); ++map_itr) {
-            if (map_itr->first_ == section) {
-                newMap = static_cast<SettingsMap*>(map_itr->second_.GetVoidPtr());
-
-                // Key exists, but is not a SettingsMap.
-                if (!newMap) {
-                    return nullptr;
-                }
+        SettingsMap::ConstIterator map_itr(currentMap->Find(section));
+        if (map_itr != currentMap->End()) {
+            newMap = static_cast<SettingsMap*>(map_itr->second_.GetVoidPtr());
 
-                // Key exists.
-                break;
+            // Key exists, but is not a SettingsMap.
+            if (!newMap) {
+                return nullptr;
             }
         }
 
@@ -628,8 +769,12 @@ SettingsMap* ConfigManager::GetSection(const String& section, bool create) {
 
         if (newMap) {
             currentMap = newMap;
+        } else {
+            // Section doesn't exist, don't cache the parent.
+            return currentMap;
         }
     }
 
+    sectionCache_[section] = currentMap;
     return currentMap;
 }
@@ -29,8 +29,12 @@ SOFTWARE.
 #include <Urho3D/Core/Object.h>
 #include <Urho3D/Core/Variant.h>
 #include <Urho3D/Resource/Resource.h>
+#include <Urho3D/IO/FileWatcher.h>
+#include <Urho3D/Core/Timer.h>
 
 typedef Urho3D::HashMap<Urho3D::String, Urho3D::Variant> SettingsMap;
+// Section to parameter to raw value, as written in the config file
+typedef Urho3D::HashMap<Urho3D::String, Urho3D::HashMap<Urho3D::String, Urho3D::String>> ConfigFileValues;
 
 class State;
 
@@ -92,10 +96,22 @@ public:
     bool Save(ConfigFile& configFile);
     void SaveSettingsMap(Urho3D::String section, SettingsMap& map, ConfigFile& configFile);
 
+    // Reload the config file when it changes on disk
+    void StartWatching();
+    // Watch custom config file, E_LOAD_CONFIG is sent again when it changes
+    void WatchFile(const Urho3D::String& path, const Urho3D::String& filename, const Urho3D::String& prefix);
+
 protected:
 
     SettingsMap* GetSection(const Urho3D::String& section, bool create = false);
 
+    // Start watcher for the directory of the file and return the file key
+    Urho3D::String AddWatcher(const Urho3D::String& path);
+    // Apply parameters which differ from the previous file load, E_CONFIG_CHANGED is sent for each of them
+    void Reload();
+    void HandleBeginFrame(Urho3D::StringHash eventType, Urho3D::VariantMap& eventData);
+    static ConfigFileValues GetFileValues(ConfigFile& configFile);
+
 protected:
 
     bool saveDefaultParameters_;
@@ -104,4 +120,16 @@ protected:
     Urho3D::String defaultFileName_;
 
     SettingsMap map_;
+
+    // Resolved section paths, sub-section maps are never moved once created.
+    Urho3D::HashMap<Urho3D::String, SettingsMap*> sectionCache_;
+
+    // Values of the last loaded default file, reloads are compared against them
+    ConfigFileValues loadedValues_;
+    // Watched directory to its watcher
+    Urho3D::HashMap<Urho3D::String, Urho3D::SharedPtr<Urho3D::FileWatcher>> watchers_;
+    // Watched custom config file to its E_LOAD_CONFIG event data
+    Urho3D::HashMap<Urho3D::String, Urho3D::VariantMap> watchedFiles_;
+    Urho3D::String watchedDefaultFile_;
+    Urho3D::Timer watchTimer_;
 };
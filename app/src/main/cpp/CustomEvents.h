@@ -16,6 +16,14 @@ namespace CustomEvents
         URHO3D_PARAM(P_PREFIX, Prefix); // string - prefix, which will be added to loaded configuration variables, can be empty
     }
 
+    // Config file changed on disk, sent once for every changed parameter
+    URHO3D_EVENT(E_CONFIG_CHANGED, ConfigChanged)
+    {
+        URHO3D_PARAM(P_SECTION, Section); // string - config section, or the prefix of the reloaded custom config file
+        URHO3D_PARAM(P_PARAMETER, Parameter); // string - parameter name
+        URHO3D_PARAM(P_VALUE, Value); // variant - new value
+    }
+
     // Video settings changed event
     URHO3D_EVENT(E_VIDEO_SETTINGS_CHANGED, VideoSettingsChanged)
     {
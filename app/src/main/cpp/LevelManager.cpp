@@ -220,7 +220,7 @@ void LevelManager::HandleUpdate(StringHash eventType, VariantMap& eventData)
         // Remove the task
         level_queue_.PopFront();
 
-        // Release all unused resources
+        // Release all unused resources, SceneManager keeps preloaded and shared map resources alive
         GetSubsystem<ResourceCache>()->ReleaseAllResources(false);
 
         if (level_queue_.Size()) {
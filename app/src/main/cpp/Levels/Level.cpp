@@ -47,6 +47,7 @@
 #include "Voxel/VoxelEvents.h"
 #include "Voxel/ChunkGenerator.h"
 #include "Voxel/TreeGenerator.h"
+#include "Voxel/VoxelProfiler.h"
 using namespace VoxelEvents;
 #endif
 
@@ -76,6 +77,8 @@ Level::~Level()
         context_->RemoveSubsystem<ChunkGenerator>();
         context_->RemoveSubsystem<LightManager>();
         context_->RemoveSubsystem<TreeGenerator>();
+        context_->RemoveSubsystem<VoxelProfiler>();
+        context_->RemoveSubsystem<BlockRegistry>();
     }
 #endif
 }
@@ -88,9 +91,13 @@ void Level::RegisterObject(Context* context)
 #ifdef VOXEL_SUPPORT
     VoxelWorld::RegisterObject(context);
     Chunk::RegisterObject(context);
+    BlockRegistry::RegisterObject(context);
+    ChunkRegion::RegisterObject(context);
     ChunkGenerator::RegisterObject(context);
     LightManager::RegisterObject(context);
     TreeGenerator::RegisterObject(context);
+    VoxelProfiler::RegisterObject(context);
+    WorldSnapshot::RegisterObject(context);
 #endif
 }
 
@@ -187,6 +194,12 @@ void Level::Init()
 #ifdef VOXEL_SUPPORT
 void Level::CreateVoxelWorld()
 {
+    if (!GetSubsystem<VoxelProfiler>()) {
+        context_->RegisterSubsystem(new VoxelProfiler(context_));
+    }
+    if (!GetSubsystem<BlockRegistry>()) {
+        context_->RegisterSubsystem(new BlockRegistry(context_));
+    }
     if (!GetSubsystem<VoxelWorld>()) {
         context_->RegisterSubsystem(new VoxelWorld(context_));
     }
@@ -568,6 +581,12 @@ void Level::HandleClientConnected(StringHash eventType, VariantMap& eventData)
     remotePlayers_[newConnection]->SetClientConnection(newConnection);
     REMOTE_PLAYER_ID++;
 
+#if defined(VOXEL_SUPPORT) && !defined(__EMSCRIPTEN__)
+    if (GetSubsystem<VoxelWorld>()) {
+        GetSubsystem<VoxelWorld>()->AddStreamingClient(newConnection, remotePlayers_[newConnection]->GetNode());
+    }
+#endif
+
     using namespace RemoteClientId;
     VariantMap data;
     data[P_NODE_ID] = remotePlayers_[newConnection]->GetNode()->GetID();
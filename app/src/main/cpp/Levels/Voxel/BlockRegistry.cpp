@@ -0,0 +1,171 @@
+#ifdef VOXEL_SUPPORT
+#include <Urho3D/Core/Context.h>
+#include <Urho3D/IO/Log.h>
+#include <Urho3D/IO/FileSystem.h>
+#include <Urho3D/Resource/ResourceCache.h>
+#include <Urho3D/Resource/JSONFile.h>
+#include <Urho3D/Engine/DebugHud.h>
+#include "BlockRegistry.h"
+
+BlockRegistry::BlockRegistry(Context* context):
+    Object(context)
+{
+    // Unknown IDs behave like air
+    memset(opacity_, 0, sizeof(opacity_));
+    memset(light_, 0, sizeof(light_));
+    memset(solid_, 0, sizeof(solid_));
+    memset(layer_, BL_NONE, sizeof(layer_));
+    memset(tiles_, 0, sizeof(tiles_));
+    for (int i = 0; i < MAX_BLOCK_TYPES; i++) {
+        for (int side = 0; side < BLOCK_FACES; side++) {
+            tileOffset_[i][side] = Vector2::ZERO;
+        }
+    }
+    Load();
+}
+
+BlockRegistry::~BlockRegistry()
+{
+}
+
+void BlockRegistry::RegisterObject(Context* context)
+{
+    context->RegisterFactory<BlockRegistry>();
+}
+
+void BlockRegistry::Load()
+{
+    LoadFile("Config/Blocks.json");
+
+    // Mods can add their own blocks without touching the base list
+    Vector<String> result;
+    GetSubsystem<FileSystem>()->ScanDir(result, GetSubsystem<FileSystem>()->GetProgramDir() + String("Data/Config/Blocks"), String("*.json"), SCAN_FILES, false);
+    for (auto it = result.Begin(); it != result.End(); ++it) {
+        LoadFile("Config/Blocks/" + (*it));
+    }
+    UpdateTileOffsets();
+
+    URHO3D_LOGINFOF("Block types loaded: %u", GetBlockCount());
+    if (GetSubsystem<DebugHud>()) {
+        GetSubsystem<DebugHud>()->SetAppStats("Block types", GetBlockCount());
+    }
+}
+
+void BlockRegistry::LoadFile(const String& filename)
+{
+    auto configFile = GetSubsystem<ResourceCache>()->GetResource<JSONFile>(filename);
+    if (!configFile) {
+        URHO3D_LOGERROR("Failed to load block config " + filename);
+        return;
+    }
+
+    const JSONValue& root = configFile->GetRoot();
+    int columns = root.Get("AtlasColumns").IsNumber() ? Max(root.Get("AtlasColumns").GetInt(), 1) : atlasColumns_;
+    int rows = root.Get("AtlasRows").IsNumber() ? Max(root.Get("AtlasRows").GetInt(), 1) : atlasRows_;
+    if (atlasDefined_ && (columns != atlasColumns_ || rows != atlasRows_)) {
+        // All blocks share one texture, tile indices from a different grid would point to wrong tiles
+        URHO3D_LOGERRORF("%s uses %dx%d atlas instead of %dx%d, file ignored", filename.CString(), columns, rows, atlasColumns_, atlasRows_);
+        return;
+    }
+    if (root.Contains("AtlasColumns") || root.Contains("AtlasRows")) {
+        atlasDefined_ = true;
+    }
+    atlasColumns_ = columns;
+    atlasRows_ = rows;
+
+    const JSONValue& blocks = root.Get("Blocks");
+    if (!blocks.IsArray()) {
+        URHO3D_LOGERROR(filename + " must contain Blocks array");
+        return;
+    }
+    for (unsigned i = 0; i < blocks.Size(); i++) {
+        AddBlock(blocks[i]);
+    }
+}
+
+void BlockRegistry::AddBlock(const JSONValue& value)
+{
+    if (!value.Contains("Name") || !value.Get("Name").IsString()) {
+        URHO3D_LOGERROR("Block definition must have a Name");
+        return;
+    }
+    String name = value.Get("Name").GetString();
+
+    int id;
+    if (value.Contains("Id") && value.Get("Id").IsNumber()) {
+        id = value.Get("Id").GetInt();
+    } else if (ids_.Contains(name)) {
+        // Redefinition of existing block keeps its ID
+        id = ids_[name];
+    } else {
+        // First free ID
+        id = 0;
+        while (id < static_cast<int>(names_.Size()) && !names_[id].Empty()) {
+            id++;
+        }
+    }
+    if (id < 0 || id >= MAX_BLOCK_TYPES) {
+        URHO3D_LOGERRORF("Block %s has invalid ID %d", name.CString(), id);
+        return;
+    }
+
+    if (static_cast<int>(names_.Size()) <= id) {
+        names_.Resize(id + 1);
+    }
+    names_[id] = name;
+    ids_[name] = static_cast<BlockType>(id);
+
+    opacity_[id] = static_cast<unsigned char>(Clamp(value.Get("Opacity").IsNumber() ? value.Get("Opacity").GetInt() : MAX_OPACITY, 0, (int)MAX_OPACITY));
+    light_[id] = static_cast<unsigned char>(Clamp(value.Get("Light").IsNumber() ? value.Get("Light").GetInt() : 0, 0, 15));
+    solid_[id] = value.Get("Solid").IsBool() ? value.Get("Solid").GetBool() : 1;
+
+    String layer = value.Get("Layer").IsString() ? value.Get("Layer").GetString() : "Ground";
+    if (layer == "None") {
+        layer_[id] = BL_NONE;
+    } else if (layer == "Water") {
+        layer_[id] = BL_WATER;
+    } else {
+        layer_[id] = BL_GROUND;
+    }
+
+    // Whole atlas row with one column per face, single faces can be overridden with Tiles
+    int row = value.Get("Row").IsNumber() ? value.Get("Row").GetInt() : id - 1;
+    for (int side = 0; side < BLOCK_FACES; side++) {
+        tiles_[id][side] = row * atlasColumns_ + side;
+    }
+    const JSONValue& tiles = value.Get("Tiles");
+    if (tiles.IsArray()) {
+        for (unsigned side = 0; side < tiles.Size() && side < BLOCK_FACES; side++) {
+            tiles_[id][side] = tiles[side].GetInt();
+        }
+    }
+}
+
+void BlockRegistry::UpdateTileOffsets()
+{
+    tileSize_ = Vector2(1.0f / atlasColumns_, 1.0f / atlasRows_);
+    for (int id = 0; id < MAX_BLOCK_TYPES; id++) {
+        for (int side = 0; side < BLOCK_FACES; side++) {
+            int tile = tiles_[id][side];
+            tileOffset_[id][side] = Vector2((tile % atlasColumns_) * tileSize_.x_, (tile / atlasColumns_) * tileSize_.y_);
+        }
+    }
+}
+
+const String& BlockRegistry::GetName(BlockType type) const
+{
+    if (type < names_.Size() && !names_[type].Empty()) {
+        return names_[type];
+    }
+    return String::EMPTY;
+}
+
+BlockType BlockRegistry::GetType(const String& name) const
+{
+    auto it = ids_.Find(name);
+    if (it != ids_.End()) {
+        return (*it).second_;
+    }
+    return BT_AIR;
+}
+#endif
@@ -0,0 +1,87 @@
+#ifdef VOXEL_SUPPORT
+#pragma once
+#include <Urho3D/Core/Object.h>
+#include <Urho3D/Resource/JSONValue.h>
+#include "VoxelDefs.h"
+
+using namespace Urho3D;
+
+// Block ID is stored in a single byte
+const int MAX_BLOCK_TYPES = 256;
+const int BLOCK_FACES = 6;
+const unsigned char MAX_OPACITY = 15;
+
+enum BlockLayer : unsigned char {
+    BL_NONE,
+    BL_GROUND,
+    BL_WATER
+};
+
+/**
+ * Block properties loaded from Config/Blocks.json and Config/Blocks/*.json,
+ * compiled into flat tables indexed by block ID for the meshing and lighting loops
+ */
+class BlockRegistry : public Object {
+    URHO3D_OBJECT(BlockRegistry, Object);
+    BlockRegistry(Context* context);
+    virtual ~BlockRegistry();
+
+    static void RegisterObject(Context* context);
+public:
+    /**
+     * Load base block list and all block files added by mods
+     */
+    void Load();
+
+    // How much light is lost when passing through the block, MAX_OPACITY stops it
+    unsigned char GetOpacity(BlockType type) const { return opacity_[type]; }
+    // Torchlight level emitted by the block
+    unsigned char GetLight(BlockType type) const { return light_[type]; }
+    // Solid blocks hide the faces of their neighbors
+    bool IsSolid(BlockType type) const { return solid_[type] != 0; }
+    BlockLayer GetLayer(BlockType type) const { return layer_[type]; }
+    /**
+     * Texture coordinate inside the block face tile, position is in 0..1 range
+     */
+    Vector2 GetTextureCoord(BlockType type, BlockSide side, const Vector2& position) const
+    {
+        return tileOffset_[type][side] + tileSize_ * position;
+    }
+
+    const String& GetName(BlockType type) const;
+    BlockType GetType(const String& name) const;
+    /**
+     * Highest block ID + 1, unused IDs between defined blocks are included
+     */
+    unsigned GetIdRange() const { return names_.Size(); }
+    /**
+     * Number of defined block types
+     */
+    unsigned GetBlockCount() const { return ids_.Size(); }
+
+private:
+    void LoadFile(const String& filename);
+    void AddBlock(const JSONValue& value);
+    /**
+     * Convert tile indices to texture offsets, done once all block files use the same atlas grid
+     */
+    void UpdateTileOffsets();
+
+    // Hot tables first, each one spans whole cache lines
+    alignas(64) unsigned char opacity_[MAX_BLOCK_TYPES];
+    alignas(64) unsigned char light_[MAX_BLOCK_TYPES];
+    alignas(64) unsigned char solid_[MAX_BLOCK_TYPES];
+    alignas(64) BlockLayer layer_[MAX_BLOCK_TYPES];
+    alignas(64) Vector2 tileOffset_[MAX_BLOCK_TYPES][BLOCK_FACES];
+    Vector2 tileSize_{Vector2::ONE};
+    // Atlas tile index of each block face
+    int tiles_[MAX_BLOCK_TYPES][BLOCK_FACES];
+    // Atlas grid is set by the first file which defines it, all other files must match it
+    bool atlasDefined_{false};
+    int atlasColumns_{1};
+    int atlasRows_{1};
+
+    Vector<String> names_;
+    HashMap<String, BlockType> ids_;
+};
+#endif
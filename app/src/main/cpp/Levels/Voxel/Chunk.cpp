@@ -24,6 +24,7 @@
 #include <Urho3D/Container/Vector.h>
 #include <Urho3D/Core/Profiler.h>
 #include <Urho3D/Engine/DebugHud.h>
+#include <Urho3D/Engine/Engine.h>
 #include <Urho3D/Audio/AudioDefs.h>
 
 #if !defined(__EMSCRIPTEN__)
@@ -37,6 +38,8 @@
 #include "../../Console/ConsoleHandlerEvents.h"
 #include "LightManager.h"
 #include "TreeGenerator.h"
+#include "VoxelProfiler.h"
+#include "WorldSnapshot.h"
 #include "../../Audio/AudioManagerDefs.h"
 #include "../../Audio/AudioEvents.h"
 #include "../../Globals/ViewLayers.h"
@@ -46,10 +49,65 @@
 using namespace VoxelEvents;
 using namespace ConsoleHandlerEvents;
 
+struct ChunkFace {
+    Vector3 corners_[4];
+    Vector2 uv_[4];
+    Vector3 normal_;
+    short indices_[6];
+};
+
+// Quad corners, texture coordinates and triangle order for each BlockSide of a unit block
+static const ChunkFace CHUNK_FACES[6] = {
+    // TOP
+    {
+        {Vector3(0, 1, 0), Vector3(0, 1, 1), Vector3(1, 1, 0), Vector3(1, 1, 1)},
+        {Vector2(0, 0), Vector2(0, 1), Vector2(1, 0), Vector2(1, 1)},
+        Vector3(0, 1, 0),
+        {0, 1, 2, 1, 3, 2}
+    },
+    // BOTTOM
+    {
+        {Vector3(0, 0, 1), Vector3(0, 0, 0), Vector3(1, 0, 0), Vector3(1, 0, 1)},
+        {Vector2(0, 1), Vector2(0, 0), Vector2(1, 0), Vector2(1, 1)},
+        Vector3(0, -1, 0),
+        {0, 1, 2, 3, 0, 2}
+    },
+    // LEFT
+    {
+        {Vector3(0, 0, 1), Vector3(0, 1, 1), Vector3(0, 0, 0), Vector3(0, 1, 0)},
+        {Vector2(0, 1), Vector2(0, 0), Vector2(1, 1), Vector2(1, 0)},
+        Vector3(-1, 0, 0),
+        {0, 1, 2, 1, 3, 2}
+    },
+    // RIGHT
+    {
+        {Vector3(1, 0, 0), Vector3(1, 1, 0), Vector3(1, 0, 1), Vector3(1, 1, 1)},
+        {Vector2(0, 1), Vector2(0, 0), Vector2(1, 1), Vector2(1, 0)},
+        Vector3(1, 0, 0),
+        {0, 1, 2, 1, 3, 2}
+    },
+    // FRONT
+    {
+        {Vector3(0, 0, 0), Vector3(0, 1, 0), Vector3(1, 0, 0), Vector3(1, 1, 0)},
+        {Vector2(0, 1), Vector2(0, 0), Vector2(1, 1), Vector2(1, 0)},
+        Vector3(0, 0, -1),
+        {0, 1, 2, 1, 3, 2}
+    },
+    // BACK
+    {
+        {Vector3(1, 0, 1), Vector3(1, 1, 1), Vector3(0, 0, 1), Vector3(0, 1, 1)},
+        {Vector2(0, 1), Vector2(0, 0), Vector2(1, 1), Vector2(1, 0)},
+        Vector3(0, 0, 1),
+        {0, 1, 2, 1, 3, 2}
+    }
+};
+
 Chunk::Chunk(Context* context):
 Object(context),
 chunkMesh_(context),
-chunkWaterMesh_(context)
+chunkWaterMesh_(context),
+publishedMesh_(context),
+publishedWaterMesh_(context)
 {
     for (int x = 0; x < SIZE_X; x++) {
         for (int y = 0; y < SIZE_Y; y++) {
@@ -59,10 +117,15 @@ chunkWaterMesh_(context)
         }
     }
     memset(lightMap_, 0, sizeof(lightMap_));
+    memset(connectivity_, ALL_FACES_CONNECTED, sizeof(connectivity_));
+    memset(publishedConnectivity_, ALL_FACES_CONNECTED, sizeof(publishedConnectivity_));
 }
 
 Chunk::~Chunk()
 {
+    if (region_) {
+        region_->RemoveChunk(this);
+    }
     RemoveNode();
 }
 
@@ -74,36 +137,77 @@ void Chunk::RegisterObject(Context* context)
 void Chunk::Init(Scene* scene, const Vector3& position)
 {
     scene_ = scene;
+    blocks_ = GetSubsystem<BlockRegistry>();
     position_ = position;
+    headless_ = GetSubsystem<Engine>()->IsHeadless();
 
     CreateNode();
+}
 
-    SendEvent(
-            E_CONSOLE_COMMAND_ADD,
-            ConsoleCommandAdd::P_NAME, "chunk_rerender",
-            ConsoleCommandAdd::P_EVENT, "#chunk_rerender",
-            ConsoleCommandAdd::P_DESCRIPTION, "Rerender all chunks",
-            ConsoleCommandAdd::P_OVERWRITE, true
-    );
-    SubscribeToEvent("#chunk_rerender", [&](StringHash eventType, VariantMap& eventData) {
-        StringVector params = eventData["Parameters"].GetStringVector();
-        if (params.Size() != 1) {
-            URHO3D_LOGERROR("Thi command doesn't have any arguments!");
-            return;
-        }
-        MarkForGeometryCalculation();
-    });
+void Chunk::Release()
+{
+    MutexLock lock(mutex_);
+    loaded_ = false;
+    requestedFromServer_ = false;
+    shouldRender_ = false;
+    notified_ = false;
+    shouldSave_ = false;
+    far_ = false;
+    farData_ = false;
+    morph_ = 1.0f;
+    if (region_) {
+        region_->RemoveChunk(this);
+        region_.Reset();
+    }
+    if (node_) {
+        node_->SetDeepEnabled(false);
+    }
+}
+
+void Chunk::Reuse(const Vector3& position)
+{
+    MutexLock lock(mutex_);
+    position_ = position;
+    shouldDelete_ = false;
+    distance_ = 0;
+    priority_ = 0.0f;
+    renderCount_ = 0;
+    // BT_AIR is 0
+    memset(data_, 0, sizeof(data_));
+    memset(lightMap_, 0, sizeof(lightMap_));
+    chunkMesh_.Clear();
+    chunkWaterMesh_.Clear();
+    {
+        MutexLock meshLock(meshMutex_);
+        publishedMesh_.Clear();
+        publishedWaterMesh_.Clear();
+        memset(publishedConnectivity_, ALL_FACES_CONNECTED, sizeof(publishedConnectivity_));
+    }
+    memset(connectivity_, ALL_FACES_CONNECTED, sizeof(connectivity_));
+    occlusionVisible_ = true;
+    MarkForGeometryCalculation();
+
+    node_->SetName("Chunk" + position_.ToString());
+    groundNode_->SetName("ChunkGround" + position_.ToString());
+    waterNode_->SetName("ChunkWater" + position_.ToString());
+    node_->SetWorldPosition(position_);
+    // Previous terrain must not collide until the new geometry is rendered
+    groundNode_->GetComponent<CollisionShape>()->ReleaseShape();
+    waterNode_->GetComponent<CollisionShape>()->ReleaseShape();
 }
 
 void Chunk::Load()
 {
     Timer loadTime;
     MutexLock lock(mutex_);
+    VoxelProfileScope profile(GetSubsystem<VoxelProfiler>(), VS_GENERATION);
 
     JSONFile file(context_);
     JSONValue& root = file.GetRoot();
     Vector3 position = Vector3(position_.x_ / SIZE_X, position_.y_ / SIZE_Y, position_.z_ / SIZE_Z);
     String filename = "World/chunk_" + String(position.x_) + "_" + String(position.y_) + "_" + String(position.z_) + ".json";
+    bool lightLoaded = false;
+    bool generated = false;
     if(GetSubsystem<FileSystem>() && GetSubsystem<FileSystem>()->FileExists(filename)) {
         file.LoadFile(filename);
         for (int x = 0; x < SIZE_X; ++x) {
@@ -116,7 +220,11 @@ void Chunk::Load()
                 }
             }
         }
-    } else {
+        lightLoaded = LoadLight(root);
+    } else if (!LoadSnapshot(lightLoaded)) {
+        // Far chunks are only seen from the distance, caves and trees are added when they come into full range
+        bool farData = far_;
+        generated = true;
 
         auto chunkGenerator = GetSubsystem<ChunkGenerator>();
         // Terrain
@@ -148,7 +256,7 @@ void Chunk::Load()
         }
 
         // Caves
-        for (int x = 0; x < SIZE_X; ++x) {
+        for (int x = 0; x < SIZE_X && !farData; ++x) {
             for (int y = 0; y < SIZE_Y; y++) {
                 for (int z = 0; z < SIZE_Z; z++) {
                     Vector3 blockPosition = position_ + Vector3(x, y, z);
@@ -158,40 +266,150 @@ void Chunk::Load()
             }
         }
 
-        // Trees
-        for (int x = 0; x < SIZE_X; ++x) {
-            for (int z = 0; z < SIZE_Z; z++) {
-                Vector3 blockPosition = position_ + Vector3(x, 0, z);
-                int surfaceHeight = chunkGenerator->GetTerrainHeight(blockPosition);
-
-                for (int y = SIZE_Y - 1; y >= 0; y--) {
-                    blockPosition.y_ = position_.y_ + y;
-                    BlockType type = data_[x][y][z].type;
-                    if (surfaceHeight >= blockPosition.y_ && type == BT_DIRT) {
-                        if (GetSubsystem<ChunkGenerator>()->HaveTree(blockPosition)) {
-//                            GetSubsystem<TreeGenerator>()->AddTreeNode(x, y, z, 0, 0, this);
-                            SetVoxel(x, y, z, BT_WOOD);
-                            break;
-                        }
-                    }
-                }
-            }
+        // Trees, including the parts of neighbor column trees which reach into this chunk
+        if (!farData) {
+            GetSubsystem<TreeGenerator>()->PlaceTrees(this);
         }
     }
-    CalculateLight();
     MarkForGeometryCalculation();
-    for (int i = 0; i < 6; i++) {
-        BlockSide side = static_cast<BlockSide>(i);
-        auto neighbor = GetNeighbor(side);
-        if (neighbor) {
-            neighbor->CalculateLight();
-            neighbor->MarkForGeometryCalculation();
+    farData_ = far_;
+    if (farData_) {
+        // No light propagation for far chunks, neighbors only hide the faces towards this chunk
+        for (int i = 0; i < 6; i++) {
+            auto neighbor = GetNeighbor(static_cast<BlockSide>(i));
+            if (neighbor) {
+                neighbor->MarkForGeometryCalculation();
+            }
         }
+    } else {
+        UpdateNeighbors(lightLoaded);
     }
 //    URHO3D_LOGINFO("Chunk " + String(position_) + " loaded in " + String(loadTime.GetMSec(false)) + "ms");
 //    Save();
     loaded_ = true;
-    shouldSave_ = true;
+    // Chunks from the snapshot or their own file are already on the disk, only edits will mark them dirty again
+    shouldSave_ = generated && !farData_;
+}
+
+void Chunk::SetFar(bool far)
+{
+    if (far_ == far) {
+        return;
+    }
+    far_ = far;
+    if (!far_ && farData_) {
+        // Reduced data is replaced by the full chunk on the next chunk update
+        loaded_ = false;
+    }
+}
+
+void Chunk::UpdateNeighbors(bool lightLoaded)
+{
+    if (lightLoaded) {
+        // Saved light is only trusted while it matches the light on the other side of the border,
+        // torches placed in neighbors generated later or removed since the save have to be propagated again
+        bool relight = false;
+        for (int i = 0; i < 6; i++) {
+            BlockSide side = static_cast<BlockSide>(i);
+            auto neighbor = GetNeighbor(side);
+            if (!neighbor) {
+                continue;
+            }
+            if (IsBorderLightDifferent(side, neighbor)) {
+                relight = true;
+                neighbor->CalculateLight();
+                neighbor->MarkForGeometryCalculation();
+            } else if (IsBorderOpen(side)) {
+                // Neighbor only has to show the faces which were hidden while this chunk was missing
+                neighbor->MarkForGeometryCalculation();
+            }
+        }
+        if (relight) {
+            CalculateLight();
+        }
+    } else {
+        CalculateLight();
+        for (int i = 0; i < 6; i++) {
+            BlockSide side = static_cast<BlockSide>(i);
+            auto neighbor = GetNeighbor(side);
+            if (neighbor) {
+                neighbor->CalculateLight();
+                neighbor->MarkForGeometryCalculation();
+            }
+        }
+    }
+}
+
+void Chunk::Compress(PODVector<unsigned char>& buffer)
+{
+    static_assert(sizeof(VoxelBlock) == 1, "Block data is compressed as bytes");
+    MutexLock lock(mutex_);
+    buffer.Clear();
+    // Block types followed by the light map, both as value and run length byte pairs
+    const int count = SIZE_X * SIZE_Y * SIZE_Z;
+    const unsigned char* layers[2] = {reinterpret_cast<const unsigned char*>(&data_[0][0][0]), &lightMap_[0][0][0]};
+    for (int layer = 0; layer < 2; layer++) {
+        const unsigned char* values = layers[layer];
+        int start = 0;
+        for (int i = 1; i <= count; i++) {
+            if (i == count || values[i] != values[start] || i - start == 255) {
+                buffer.Push(values[start]);
+                buffer.Push(static_cast<unsigned char>(i - start));
+                start = i;
+            }
+        }
+    }
+}
+
+bool Chunk::Decompress(const unsigned char* buffer, unsigned size)
+{
+    const int count = SIZE_X * SIZE_Y * SIZE_Z;
+    unsigned char* layers[2] = {reinterpret_cast<unsigned char*>(&data_[0][0][0]), &lightMap_[0][0][0]};
+    unsigned position = 0;
+    for (int layer = 0; layer < 2; layer++) {
+        int offset = 0;
+        while (offset < count) {
+            if (position + 1 >= size || buffer[position + 1] == 0 || offset + buffer[position + 1] > count) {
+                URHO3D_LOGERROR("Corrupted compressed chunk " + position_.ToString());
+                memset(data_, 0, sizeof(data_));
+                memset(lightMap_, 0, sizeof(lightMap_));
+                return false;
+            }
+            memset(layers[layer] + offset, buffer[position], buffer[position + 1]);
+            offset += buffer[position + 1];
+            position += 2;
+        }
+    }
+    return true;
+}
+
+bool Chunk::LoadSnapshot(bool& lightLoaded)
+{
+    WorldSnapshot* snapshot = GetSubsystem<VoxelWorld>()->GetSnapshot();
+    if (!snapshot) {
+        return false;
+    }
+    unsigned size = 0;
+    const unsigned char* blob = snapshot->Find(position_, size);
+    if (!blob || !Decompress(blob, size)) {
+        return false;
+    }
+    lightLoaded = snapshot->HasLight() && !headless_;
+    return true;
+}
+
+bool Chunk::LoadCompressed(const PODVector<unsigned char>& buffer)
+{
+    MutexLock lock(mutex_);
+    if (!Decompress(buffer.Buffer(), buffer.Size())) {
+        return false;
+    }
+
+    MarkForGeometryCalculation();
+    UpdateNeighbors(true);
+    loaded_ = true;
+    shouldSave_ = false;
+    return true;
 }
 
 bool Chunk::Render()
@@ -200,320 +418,348 @@ bool Chunk::Render()
         return false;
     }
     renderCount_++;
-    MutexLock lock(mutex_);
+    int previousLod = meshLod_;
+    bool hadMesh = region_ != nullptr;
+    bool connectivityChanged;
     {
-        groundNode_->RemoveComponent<StaticModel>();
-        SharedPtr<Model> chunkModel(new Model(context_));
-        SharedPtr<Geometry> geometry = chunkMesh_.GetGeometry();
-
-        chunkModel->SetNumGeometries(1);
-        chunkModel->SetGeometry(0, 0, geometry);
-        chunkModel->SetBoundingBox(BoundingBox(Vector3(0, 0, 0), Vector3(SIZE_X, SIZE_Y, SIZE_Z)));
-
-        StaticModel *chunkObject = groundNode_->CreateComponent<StaticModel>(LOCAL);
-        chunkObject->SetModel(chunkModel);
-        chunkObject->SetViewMask(VIEW_MASK_CHUNK);
-        chunkObject->SetOccluder(true);
-        chunkObject->SetOccludee(true);
-        Material *material = SharedPtr<Material>(
-                GetSubsystem<ResourceCache>()->GetResource<Material>("Materials/Voxel.xml"));
-        chunkObject->SetMaterial(material);
-
-        if (node_->GetScene()->GetComponent<PhysicsWorld>() && geometry->GetVertexCount() > 0) {
-            node_->GetScene()->GetComponent<PhysicsWorld>()->RemoveCachedGeometry(chunkObject->GetModel());
-            groundNode_->GetComponent<CollisionShape>()->SetTriangleMesh(chunkObject->GetModel());
-        }
+        // Only the swap is done under the lock, uploading the front mesh never waits for the worker
+        MutexLock lock(meshMutex_);
+        chunkMesh_.Swap(publishedMesh_);
+        chunkWaterMesh_.Swap(publishedWaterMesh_);
+        meshLod_ = publishedLod_;
+        connectivityChanged = memcmp(connectivity_, publishedConnectivity_, sizeof(connectivity_)) != 0;
+        memcpy(connectivity_, publishedConnectivity_, sizeof(connectivity_));
+        shouldRender_ = false;
+    }
+    if (connectivityChanged) {
+        GetSubsystem<VoxelWorld>()->MarkOcclusionDirty();
+    }
+    if (hadMesh && meshLod_ < previousLod) {
+        // Finer mesh grows out of the coarse cells instead of popping in
+        morphStep_ = static_cast<float>(1 << previousLod);
+        morph_ = 0.0f;
+        GetSubsystem<VoxelWorld>()->AddMorphingChunk(this);
+    } else if (meshLod_ > previousLod) {
+        // Coarser mesh can't be morphed from the finer one, it's switched right away
+        morph_ = 1.0f;
+    }
+    if (!node_->IsEnabled()) {
+        // Chunk was taken from the pool
+        node_->SetDeepEnabled(true);
+    }
+    // Drawing is done by the region, chunk node only keeps the collision shapes
+    ChunkRegion* region = nullptr;
+    if (!headless_ && (chunkMesh_.GetVertexCount() > 0 || chunkWaterMesh_.GetVertexCount() > 0)) {
+        region = GetSubsystem<VoxelWorld>()->GetRegion(position_);
+    }
+    if (region_ && region_ != region) {
+        region_->RemoveChunk(this);
+    }
+    region_ = region;
+    if (region_) {
+        VoxelProfileScope profile(GetSubsystem<VoxelProfiler>(), VS_UPLOAD);
+        region_->UpdateChunk(this, chunkMesh_, chunkWaterMesh_, morphStep_, morph_);
+        region_->SetChunkVisible(this, chunkMesh_, chunkWaterMesh_, occlusionVisible_);
     }
 
     {
-        waterNode_->RemoveComponent<StaticModel>();
-        SharedPtr<Model> chunkModel(new Model(context_));
-        SharedPtr<Geometry> geometry = chunkWaterMesh_.GetGeometry();
-
-        chunkModel->SetNumGeometries(1);
-        chunkModel->SetGeometry(0, 0, geometry);
-        chunkModel->SetBoundingBox(BoundingBox(Vector3(0, 0, 0), Vector3(SIZE_X, SIZE_Y, SIZE_Z)));
-
-        StaticModel *chunkObject = waterNode_->CreateComponent<StaticModel>(LOCAL);
-        chunkObject->SetModel(chunkModel);
-        chunkObject->SetViewMask(VIEW_MASK_CHUNK);
-        chunkObject->SetOccluder(false);
-        chunkObject->SetOccludee(true);
-        Material *material = SharedPtr<Material>(
-                GetSubsystem<ResourceCache>()->GetResource<Material>("Materials/VoxelWater.xml"));
-        chunkObject->SetMaterial(material);
-
-        if (node_->GetScene()->GetComponent<PhysicsWorld>() && geometry->GetVertexCount() > 0) {
-            node_->GetScene()->GetComponent<PhysicsWorld>()->RemoveCachedGeometry(chunkObject->GetModel());
-            waterNode_->GetComponent<CollisionShape>()->SetTriangleMesh(chunkObject->GetModel());
-        }
+        VoxelProfileScope profile(GetSubsystem<VoxelProfiler>(), VS_PHYSICS);
+        UpdateCollisionShape(groundNode_, groundModel_, chunkMesh_);
+        UpdateCollisionShape(waterNode_, waterModel_, chunkWaterMesh_);
     }
 
-    shouldRender_ = false;
     return true;
 }
 
+void Chunk::UpdateCollisionShape(Node* node, SharedPtr<Model>& model, ChunkMesh& mesh)
+{
+    auto physicsWorld = node_->GetScene()->GetComponent<PhysicsWorld>();
+    if (meshLod_ > 0 || !physicsWorld || mesh.GetVertexCount() == 0) {
+        // Reduced detail chunks are too far away to collide with anything
+        node->GetComponent<CollisionShape>()->ReleaseShape();
+        return;
+    }
+
+    if (!model) {
+        model = new Model(context_);
+        model->SetNumGeometries(1);
+        model->SetBoundingBox(BoundingBox(Vector3(0, 0, 0), Vector3(SIZE_X, SIZE_Y, SIZE_Z)));
+    }
+    model->SetGeometry(0, 0, mesh.GetGeometry());
+    physicsWorld->RemoveCachedGeometry(model);
+    node->GetComponent<CollisionShape>()->SetTriangleMesh(model);
+}
+
 void Chunk::CalculateGeometry()
 {
     int currentIndex = calculateIndex_;
     Timer loadTime;
     MutexLock lock(mutex_);
-    SetSunlight(15);
+    VoxelProfileScope profile(GetSubsystem<VoxelProfiler>(), VS_MESHING);
+    if (!headless_) {
+        SetSunlight(15);
+    }
 
-    chunkMesh_.Clear();
-    chunkWaterMesh_.Clear();
+    // Built into private meshes, Render keeps using the previous mesh until this one is published
+    ChunkMesh groundMesh(context_);
+    ChunkMesh waterMesh(context_);
 
-    for (int x = 0; x < SIZE_X; x++) {
-        for (int y = 0; y < SIZE_Y; y++) {
-            for (int z = 0; z < SIZE_Z; z++) {
-                BlockType type = data_[x][y][z].type;
-                if (type == BlockType::BT_AIR) {
+    // Headless server only needs the full detail collision mesh
+    int lod = headless_ ? 0 : lod_;
+    if (lod > 0) {
+        CalculateLodGeometry(lod, groundMesh, waterMesh);
+    } else {
+        for (int x = 0; x < SIZE_X; x++) {
+            for (int y = 0; y < SIZE_Y; y++) {
+                for (int z = 0; z < SIZE_Z; z++) {
+                    BlockType type = data_[x][y][z].type;
+                    BlockLayer layer = blocks_->GetLayer(type);
+                    if (layer == BL_NONE) {
+                        continue;
+                    }
+
+                    if (!shouldDelete_) {
+                        Vector3 position(x, y, z);
+                        ChunkMesh* mesh = &groundMesh;
+                        if (layer == BL_WATER) {
+                            mesh = &waterMesh;
+                        }
+
+                        for (int i = 0; i < 6; i++) {
+                            BlockSide side = static_cast<BlockSide>(i);
+                            if (!BlockHaveNeighbor(side, x, y, z)) {
+                                Color color = headless_ ? Color::WHITE : LightToColor(NeighborLightValue(side, x, y, z));
+                                AddFace(mesh, side, position, 1.0f, type, color);
+                            }
+                        }
+                    }
+                }
+            }
+        }
+    }
+    unsigned char connectivity[6];
+    if (headless_) {
+        // Nothing is drawn, so there is nothing to cull
+        memset(connectivity, ALL_FACES_CONNECTED, sizeof(connectivity));
+    } else {
+        CalculateConnectivity(connectivity);
+    }
+
+    PublishGeometry(groundMesh, waterMesh, connectivity, lod, currentIndex);
+}
+
+void Chunk::CalculateConnectivity(unsigned char* connectivity)
+{
+    memset(connectivity, 0, 6);
+
+    const int blockCount = SIZE_X * SIZE_Y * SIZE_Z;
+    bool visited[blockCount];
+    int stack[blockCount];
+    memset(visited, 0, sizeof(visited));
+
+    for (int start = 0; start < blockCount; start++) {
+        if (visited[start] || blocks_->IsSolid(data_[start / (SIZE_Y * SIZE_Z)][(start / SIZE_Z) % SIZE_Y][start % SIZE_Z].type)) {
+            continue;
+        }
+
+        // Collect all faces touched by this air pocket
+        unsigned char faces = 0;
+        int stackSize = 0;
+        stack[stackSize++] = start;
+        visited[start] = true;
+        while (stackSize > 0) {
+            int index = stack[--stackSize];
+            int x = index / (SIZE_Y * SIZE_Z);
+            int y = (index / SIZE_Z) % SIZE_Y;
+            int z = index % SIZE_Z;
+            if (x == 0) faces |= 1 << BlockSide::LEFT;
+            if (x == SIZE_X - 1) faces |= 1 << BlockSide::RIGHT;
+            if (y == 0) faces |= 1 << BlockSide::BOTTOM;
+            if (y == SIZE_Y - 1) faces |= 1 << BlockSide::TOP;
+            if (z == 0) faces |= 1 << BlockSide::FRONT;
+            if (z == SIZE_Z - 1) faces |= 1 << BlockSide::BACK;
+
+            const int neighbors[6][3] = {{-1, 0, 0}, {1, 0, 0}, {0, -1, 0}, {0, 1, 0}, {0, 0, -1}, {0, 0, 1}};
+            for (int i = 0; i < 6; i++) {
+                int nX = x + neighbors[i][0];
+                int nY = y + neighbors[i][1];
+                int nZ = z + neighbors[i][2];
+                if (nX < 0 || nX >= SIZE_X || nY < 0 || nY >= SIZE_Y || nZ < 0 || nZ >= SIZE_Z) {
                     continue;
                 }
+                int neighbor = (nX * SIZE_Y + nY) * SIZE_Z + nZ;
+                if (!visited[neighbor] && !blocks_->IsSolid(data_[nX][nY][nZ].type)) {
+                    visited[neighbor] = true;
+                    stack[stackSize++] = neighbor;
+                }
+            }
+        }
 
-                if (!shouldDelete_) {
-                    Vector3 position(x, y, z);
-                    ChunkMesh* mesh = &chunkMesh_;
-                    if (type == BT_WATER) {
-                        mesh = &chunkWaterMesh_;
-                    }
+        for (int side = 0; side < 6; side++) {
+            if (faces & (1 << side)) {
+                connectivity[side] |= faces;
+            }
+        }
+    }
+}
 
-                    if (!BlockHaveNeighbor(BlockSide::TOP, x, y, z)) {
-                        short vertexCount = mesh->GetVertexCount();
-                        unsigned char light = NeighborLightValue(BlockSide::TOP, x, y, z);
-                        Color color;
-                        color.r_ = static_cast<int>(light & 0xF) / 15.0f;
-                        color.g_ = static_cast<int>((light >> 4) & 0xF) / 15.0f;
-                        mesh->AddVertex(MeshVertex{
-                                position + Vector3(0.0f, 1.0, 0.0f),
-                                Vector3::UP,
-                                color,
-                                GetTextureCoord(BlockSide::TOP, static_cast<BlockType>(type), Vector2(0.0, 0.0))
-                        });
-                        mesh->AddVertex(MeshVertex{
-                                position + Vector3(0.0f, 1.0, 1.0),
-                                Vector3::UP,
-                                color,
-                                GetTextureCoord(BlockSide::TOP, static_cast<BlockType>(type), Vector2(0.0, 1.0))
-                        });
-                        mesh->AddVertex(MeshVertex{
-                                position + Vector3(1.0, 1.0, 0.0f),
-                                Vector3::UP,
-                                color,
-                                GetTextureCoord(BlockSide::TOP, static_cast<BlockType>(type), Vector2(1.0, 0.0))
-                        });
-                        mesh->AddVertex(MeshVertex{
-                                position + Vector3(1.0, 1.0, 1.0f),
-                                Vector3::UP,
-                                color,
-                                GetTextureCoord(BlockSide::TOP, static_cast<BlockType>(type), Vector2(1.0, 1.0))
-                        });
-                        mesh->AddIndice(vertexCount);
-                        mesh->AddIndice(vertexCount + 1);
-                        mesh->AddIndice(vertexCount + 2);
-
-                        mesh->AddIndice(vertexCount + 1);
-                        mesh->AddIndice(vertexCount + 3);
-                        mesh->AddIndice(vertexCount + 2);
-                    }
-                    if (!BlockHaveNeighbor(BlockSide::BOTTOM, x, y, z)) {
-                        short vertexCount = mesh->GetVertexCount();
-                        unsigned char light = NeighborLightValue(BlockSide::BOTTOM, x, y, z);
-                        Color color;
-                        color.r_ = static_cast<int>(light & 0xF) / 15.0f;
-                        color.g_ = static_cast<int>((light >> 4) & 0xF) / 15.0f;
-                        mesh->AddVertex(MeshVertex{
-                                position + Vector3(0.0f, 0.0f, 1.0),
-                                Vector3::DOWN,
-                                color,
-                                GetTextureCoord(BlockSide::BOTTOM, static_cast<BlockType>(type), Vector2(0.0, 1.0))
-                        });
-                        mesh->AddVertex(MeshVertex{
-                                position + Vector3(0.0f, 0.0f, 0.0f),
-                                Vector3::DOWN,
-                                color,
-                                GetTextureCoord(BlockSide::BOTTOM, static_cast<BlockType>(type), Vector2(0.0, 0.0))
-                        });
-                        mesh->AddVertex(MeshVertex{
-                                position + Vector3(1.0, 0.0f, 0.0f),
-                                Vector3::DOWN,
-                                color,
-                                GetTextureCoord(BlockSide::BOTTOM, static_cast<BlockType>(type), Vector2(1.0, 0.0))
-                        });
-                        mesh->AddVertex(MeshVertex{
-                                position + Vector3(1.0, 0.0f, 1.0),
-                                Vector3::DOWN,
-                                color,
-                                GetTextureCoord(BlockSide::BOTTOM, static_cast<BlockType>(type), Vector2(1.0, 1.0))
-                        });
-                        mesh->AddIndice(vertexCount);
-                        mesh->AddIndice(vertexCount + 1);
-                        mesh->AddIndice(vertexCount + 2);
-
-                        mesh->AddIndice(vertexCount + 3);
-                        mesh->AddIndice(vertexCount);
-                        mesh->AddIndice(vertexCount + 2);
-                    }
-                    if (!BlockHaveNeighbor(BlockSide::LEFT, x, y, z)) {
-                        short vertexCount = mesh->GetVertexCount();
-                        unsigned char light = NeighborLightValue(BlockSide::LEFT, x, y, z);
-                        Color color;
-                        color.r_ = static_cast<int>(light & 0xF) / 15.0f;
-                        color.g_ = static_cast<int>((light >> 4) & 0xF) / 15.0f;
-                        mesh->AddVertex(MeshVertex{
-                                position + Vector3(0.0f, 0.0f, 1.0),
-                                Vector3::LEFT,
-                                color,
-                                GetTextureCoord(BlockSide::LEFT, static_cast<BlockType>(type), Vector2(0.0, 1.0))
-                        });
-                        mesh->AddVertex(MeshVertex{
-                                position + Vector3(0.0f, 1.0, 1.0),
-                                Vector3::LEFT,
-                                color,
-                                GetTextureCoord(BlockSide::LEFT, static_cast<BlockType>(type), Vector2(0.0, 0.0))
-                        });
-                        mesh->AddVertex(MeshVertex{
-                                position + Vector3(0.0f, 0.0f, 0.0f),
-                                Vector3::LEFT,
-                                color,
-                                GetTextureCoord(BlockSide::LEFT, static_cast<BlockType>(type), Vector2(1.0, 1.0))
-                        });
-                        mesh->AddVertex(MeshVertex{
-                                position + Vector3(0.0f, 1.0, 0.0f),
-                                Vector3::LEFT,
-                                color,
-                                GetTextureCoord(BlockSide::LEFT, static_cast<BlockType>(type), Vector2(1.0, 0.0))
-                        });
-                        mesh->AddIndice(vertexCount);
-                        mesh->AddIndice(vertexCount + 1);
-                        mesh->AddIndice(vertexCount + 2);
-
-                        mesh->AddIndice(vertexCount + 1);
-                        mesh->AddIndice(vertexCount + 3);
-                        mesh->AddIndice(vertexCount + 2);
-                    }
-                    if (!BlockHaveNeighbor(BlockSide::RIGHT, x, y, z)) {
-                        short vertexCount = mesh->GetVertexCount();
-                        unsigned char light = NeighborLightValue(BlockSide::RIGHT, x, y, z);
-                        Color color;
-                        color.r_ = static_cast<int>(light & 0xF) / 15.0f;
-                        color.g_ = static_cast<int>((light >> 4) & 0xF) / 15.0f;
-                        mesh->AddVertex(MeshVertex{
-                                position + Vector3(1.0, 0.0f, 0.0f),
-                                Vector3::LEFT,
-                                color,
-                                GetTextureCoord(BlockSide::RIGHT, static_cast<BlockType>(type), Vector2(0.0, 1.0))
-                        });
-                        mesh->AddVertex(MeshVertex{
-                                position + Vector3(1.0, 1.0, 0.0f),
-                                Vector3::LEFT,
-                                color,
-                                GetTextureCoord(BlockSide::RIGHT, static_cast<BlockType>(type), Vector2(0.0, 0.0))
-                        });
-                        mesh->AddVertex(MeshVertex{
-                                position + Vector3(1.0, 0.0f, 1.0),
-                                Vector3::LEFT,
-                                color,
-                                GetTextureCoord(BlockSide::RIGHT, static_cast<BlockType>(type), Vector2(1.0, 1.0))
-                        });
-                        mesh->AddVertex(MeshVertex{
-                                position + Vector3(1.0, 1.0, 1.0),
-                                Vector3::LEFT,
-                                color,
-                                GetTextureCoord(BlockSide::RIGHT, static_cast<BlockType>(type), Vector2(1.0, 0.0))
-                        });
-                        mesh->AddIndice(vertexCount);
-                        mesh->AddIndice(vertexCount + 1);
-                        mesh->AddIndice(vertexCount + 2);
-
-                        mesh->AddIndice(vertexCount + 1);
-                        mesh->AddIndice(vertexCount + 3);
-                        mesh->AddIndice(vertexCount + 2);
+void Chunk::SetOcclusionVisible(bool visible)
+{
+    if (occlusionVisible_ == visible) {
+        return;
+    }
+    occlusionVisible_ = visible;
+    if (region_) {
+        region_->SetChunkVisible(this, chunkMesh_, chunkWaterMesh_, visible);
+    }
+}
+
+void Chunk::PublishGeometry(ChunkMesh& groundMesh, ChunkMesh& waterMesh, const unsigned char* connectivity, int lod, int index)
+{
+    MutexLock lock(meshMutex_);
+    if (index < publishedIndex_) {
+        // Mesh for newer chunk data was published while this one was being built
+        return;
+    }
+    publishedMesh_.Swap(groundMesh);
+    publishedWaterMesh_.Swap(waterMesh);
+    publishedLod_ = lod;
+    memcpy(publishedConnectivity_, connectivity, sizeof(publishedConnectivity_));
+    publishedIndex_ = index;
+    shouldRender_ = true;
+    renderIndex_ = 0;
+    lastCalculatateIndex_ = index;
+}
+
+void Chunk::CalculateLodGeometry(int lod, ChunkMesh& groundMesh, ChunkMesh& waterMesh)
+{
+    const int step = 1 << lod;
+    const int cellsX = SIZE_X / step;
+    const int cellsY = SIZE_Y / step;
+    const int cellsZ = SIZE_Z / step;
+
+    // Each cell takes the type of its top-most block, so the surface layer keeps its look and
+    // the reduced mesh never has holes where the full detail mesh has blocks
+    BlockType cells[SIZE_X][SIZE_Y][SIZE_Z];
+    unsigned char cellLight[SIZE_X][SIZE_Y][SIZE_Z];
+    for (int cx = 0; cx < cellsX; cx++) {
+        for (int cy = 0; cy < cellsY; cy++) {
+            for (int cz = 0; cz < cellsZ; cz++) {
+                BlockType type = BT_AIR;
+                int torchlight = 0;
+                int sunlight = 0;
+                for (int y = cy * step + step - 1; y >= cy * step; y--) {
+                    for (int x = cx * step; x < cx * step + step; x++) {
+                        for (int z = cz * step; z < cz * step + step; z++) {
+                            if (blocks_->GetLayer(type) == BL_NONE) {
+                                type = data_[x][y][z].type;
+                            }
+                            torchlight = Max(torchlight, GetTorchlight(x, y, z));
+                            sunlight = Max(sunlight, GetSunlight(x, y, z));
+                        }
                     }
-                    if (!BlockHaveNeighbor(BlockSide::FRONT, x, y, z)) {
-                        short vertexCount = mesh->GetVertexCount();
-                        unsigned char light = NeighborLightValue(BlockSide::FRONT, x, y, z);
-                        Color color;
-                        color.r_ = static_cast<int>(light & 0xF) / 15.0f;
-                        color.g_ = static_cast<int>((light >> 4) & 0xF) / 15.0f;
-                        mesh->AddVertex(MeshVertex{
-                                position + Vector3(0.0f, 0.0f, 0.0f),
-                                Vector3::LEFT,
-                                color,
-                                GetTextureCoord(BlockSide::FRONT, static_cast<BlockType>(type), Vector2(0.0, 1.0))
-                        });
-                        mesh->AddVertex(MeshVertex{
-                                position + Vector3(0.0f, 1.0, 0.0f),
-                                Vector3::LEFT,
-                                color,
-                                GetTextureCoord(BlockSide::FRONT, static_cast<BlockType>(type), Vector2(0.0, 0.0))
-                        });
-                        mesh->AddVertex(MeshVertex{
-                                position + Vector3(1.0, 0.0f, 0.0f),
-                                Vector3::LEFT,
-                                color,
-                                GetTextureCoord(BlockSide::FRONT, static_cast<BlockType>(type), Vector2(1.0, 1.0))
-                        });
-                        mesh->AddVertex(MeshVertex{
-                                position + Vector3(1.0, 1.0, 0.0f),
-                                Vector3::LEFT,
-                                color,
-                                GetTextureCoord(BlockSide::FRONT, static_cast<BlockType>(type), Vector2(1.0, 0.0))
-                        });
-                        mesh->AddIndice(vertexCount);
-                        mesh->AddIndice(vertexCount + 1);
-                        mesh->AddIndice(vertexCount + 2);
-
-                        mesh->AddIndice(vertexCount + 1);
-                        mesh->AddIndice(vertexCount + 3);
-                        mesh->AddIndice(vertexCount + 2);
+                }
+                cells[cx][cy][cz] = type;
+                cellLight[cx][cy][cz] = static_cast<unsigned char>(torchlight | (sunlight << 4));
+            }
+        }
+    }
 
+    for (int cx = 0; cx < cellsX; cx++) {
+        for (int cy = 0; cy < cellsY; cy++) {
+            for (int cz = 0; cz < cellsZ; cz++) {
+                BlockType type = cells[cx][cy][cz];
+                BlockLayer layer = blocks_->GetLayer(type);
+                if (layer == BL_NONE) {
+                    continue;
+                }
+                ChunkMesh* mesh = layer == BL_WATER ? &waterMesh : &groundMesh;
+                Vector3 position(cx * step, cy * step, cz * step);
+                Color color = LightToColor(cellLight[cx][cy][cz]);
+                for (int i = 0; i < 6; i++) {
+                    BlockSide side = static_cast<BlockSide>(i);
+                    int nX = cx;
+                    int nY = cy;
+                    int nZ = cz;
+                    switch (side) {
+                        case BlockSide::LEFT:   nX--; break;
+                        case BlockSide::RIGHT:  nX++; break;
+                        case BlockSide::BOTTOM: nY--; break;
+                        case BlockSide::TOP:    nY++; break;
+                        case BlockSide::FRONT:  nZ--; break;
+                        case BlockSide::BACK:   nZ++; break;
                     }
-                    if (!BlockHaveNeighbor(BlockSide::BACK, x, y, z)) {
-                        short vertexCount = mesh->GetVertexCount();
-                        unsigned char light = NeighborLightValue(BlockSide::BACK, x, y, z);
-                        Color color;
-                        color.r_ = static_cast<int>(light & 0xF) / 15.0f;
-                        color.g_ = static_cast<int>((light >> 4) & 0xF) / 15.0f;
-                        mesh->AddVertex(MeshVertex{
-                                position + Vector3(1.0, 0.0f, 1.0),
-                                Vector3::LEFT,
-                                color,
-                                GetTextureCoord(BlockSide::BACK, static_cast<BlockType>(type), Vector2(0.0, 1.0))
-                        });
-                        mesh->AddVertex(MeshVertex{
-                                position + Vector3(1.0, 1.0, 1.0),
-                                Vector3::LEFT,
-                                color,
-                                GetTextureCoord(BlockSide::BACK, static_cast<BlockType>(type), Vector2(0.0, 0.0))
-                        });
-                        mesh->AddVertex(MeshVertex{
-                                position + Vector3(0.0f, 0.0f, 1.0),
-                                Vector3::LEFT,
-                                color,
-                                GetTextureCoord(BlockSide::BACK, static_cast<BlockType>(type), Vector2(1.0, 1.0))
-                        });
-                        mesh->AddVertex(MeshVertex{
-                                position + Vector3(0.0f, 1.0, 1.0),
-                                Vector3::LEFT,
-                                color,
-                                GetTextureCoord(BlockSide::BACK, static_cast<BlockType>(type), Vector2(1.0, 0.0))
-                        });
-                        mesh->AddIndice(vertexCount);
-                        mesh->AddIndice(vertexCount + 1);
-                        mesh->AddIndice(vertexCount + 2);
-
-                        mesh->AddIndice(vertexCount + 1);
-                        mesh->AddIndice(vertexCount + 3);
-                        mesh->AddIndice(vertexCount + 2);
+                    // Faces on the chunk border are always added, they act as skirts which hide
+                    // the cracks between chunks with different detail levels
+                    if (nX >= 0 && nX < cellsX && nY >= 0 && nY < cellsY && nZ >= 0 && nZ < cellsZ) {
+                        BlockType neighborType = cells[nX][nY][nZ];
+                        if (neighborType == type || blocks_->IsSolid(neighborType)) {
+                            continue;
+                        }
                     }
+                    AddFace(mesh, side, position, static_cast<float>(step), type, color);
                 }
             }
         }
     }
-    shouldRender_ = true;
-    renderIndex_ = 0;
-    lastCalculatateIndex_ = currentIndex;
+}
+
+void Chunk::AddFace(ChunkMesh* mesh, BlockSide side, const Vector3& position, float size, BlockType type, const Color& color)
+{
+    const ChunkFace& face = CHUNK_FACES[side];
+    short vertexCount = mesh->GetVertexCount();
+    for (int i = 0; i < 4; i++) {
+        mesh->AddVertex(MeshVertex{
+                position + face.corners_[i] * size,
+                face.normal_,
+                color,
+                blocks_->GetTextureCoord(type, side, face.uv_[i])
+        });
+    }
+    for (int i = 0; i < 6; i++) {
+        mesh->AddIndice(vertexCount + face.indices_[i]);
+    }
+}
+
+Color Chunk::LightToColor(unsigned char light)
+{
+    Color color;
+    color.r_ = static_cast<int>(light & 0xF) / 15.0f;
+    color.g_ = static_cast<int>((light >> 4) & 0xF) / 15.0f;
+    return color;
+}
+
+void Chunk::SetLod(int lod)
+{
+    if (lod_ != lod) {
+        lod_ = lod;
+        MarkForGeometryCalculation();
+    }
+}
+
+int Chunk::GetLod() const
+{
+    return lod_;
+}
+
+bool Chunk::UpdateMorph(float timeStep)
+{
+    if (morph_ >= 1.0f || !region_) {
+        morph_ = 1.0f;
+        return false;
+    }
+
+    morph_ = Min(morph_ + timeStep / LOD_MORPH_TIME, 1.0f);
+    VoxelProfileScope profile(GetSubsystem<VoxelProfiler>(), VS_UPLOAD);
+    region_->MorphChunk(this, chunkMesh_, chunkWaterMesh_, morphStep_, morph_);
+    return morph_ < 1.0f;
+}
+
+unsigned Chunk::GetMemoryUsage()
+{
+    unsigned usage = sizeof(Chunk) + chunkMesh_.GetMemoryUsage() + chunkWaterMesh_.GetMemoryUsage();
+    MutexLock lock(meshMutex_);
+    return usage + publishedMesh_.GetMemoryUsage() + publishedWaterMesh_.GetMemoryUsage();
 }
 
 //void Chunk::CalculateGeometry2()
@@ -1014,7 +1260,7 @@ void Chunk::CalculateGeometry()
 ////    URHO3D_LOGINFO("Chunk " + String(position_) + " geometry calculated in " + String(loadTime.GetMSec(false)) + "ms");
 //}
 
-void Chunk::HandleUpdate(StringHash eventType, VariantMap& eventData)
+bool Chunk::NotifyGenerated()
 {
     if (IsLoaded() && !notified_) {
         using namespace ChunkGenerated;
@@ -1023,18 +1269,7 @@ void Chunk::HandleUpdate(StringHash eventType, VariantMap& eventData)
         SendEvent(E_CHUNK_GENERATED, data);
         notified_ = true;
     }
-//    scene_->GetComponent<PhysicsWorld>()->DrawDebugGeometry(true);
-//    scene_->GetComponent<PhysicsWorld>()->SetDebugRenderer(scene_->GetComponent<DebugRenderer>());
-//    node_->GetComponent<StaticModel>()->DrawDebugGeometry(node_->GetScene()->GetComponent<DebugRenderer>(), true);
-//    if (saveTimer_.GetMSec(false) > 30000) {
-//        saveTimer_.Reset();
-//        Save();
-//    }
-
-    if (requestedFromServer_ && !loaded_ && remoteLoadTimer_.GetMSec(false) > 5000) {
-        // Server didn't send us the chunk in time, request it again
-        LoadFromServer();
-    }
+    return notified_;
 }
 
 IntVector3 Chunk::GetChunkBlock(Vector3 position)
@@ -1108,10 +1343,10 @@ void Chunk::SetBlockData(const IntVector3& blockPosition, BlockType type)
     SetVoxel(blockPosition.x_, blockPosition.y_, blockPosition.z_, type);
     SetTorchlight(blockPosition.x_, blockPosition.y_, blockPosition.z_, 0);
 
-    if (type == BT_TORCH) {
-        SetTorchlight(blockPosition.x_, blockPosition.y_, blockPosition.z_, 15);
+    if (blocks_->GetLight(type) > 0) {
+        SetTorchlight(blockPosition.x_, blockPosition.y_, blockPosition.z_, blocks_->GetLight(type));
         GetSubsystem<LightManager>()->AddLightNode(blockPosition.x_, blockPosition.y_, blockPosition.z_, this);
-    } else if (type != BT_AIR || currentType == BT_TORCH) {
+    } else if (type != BT_AIR || blocks_->GetLight(currentType) > 0) {
         SetTorchlight(blockPosition.x_, blockPosition.y_, blockPosition.z_, 0);
         GetSubsystem<LightManager>()->AddLightRemovalNode(blockPosition.x_, blockPosition.y_, blockPosition.z_, lightLevel, this);
     }
@@ -1201,36 +1436,9 @@ const Vector3& Chunk::GetPosition()
     return position_;
 }
 
-Vector2 Chunk::GetTextureCoord(BlockSide side, BlockType blockType, Vector2 position)
-{
-    int textureCount = static_cast<int>(BlockType::BT_NONE) - 1;
-    Vector2 quadSize(1.0f / 6, 1.0f / textureCount);
-    float typeOffset = (static_cast<int>(blockType) - 1) * quadSize.y_;
-    switch (side) {
-        case BlockSide::TOP: {
-            return Vector2(quadSize.x_ * 0.0f + quadSize.x_ * position.x_, quadSize.y_ * position.y_ + typeOffset);
-        }
-        case BlockSide::BOTTOM: {
-            return Vector2(quadSize.x_ * 1.0f + quadSize.x_ * position.x_, quadSize.y_ * position.y_ + typeOffset);
-        }
-        case BlockSide::LEFT: {
-            return Vector2(quadSize.x_ * 2.0f + quadSize.x_ * position.x_, quadSize.y_ * position.y_ + typeOffset);
-        }
-        case BlockSide::RIGHT: {
-            return Vector2(quadSize.x_ * 3.0f + quadSize.x_ * position.x_, quadSize.y_ * position.y_ + typeOffset);
-        }
-        case BlockSide::FRONT: {
-            return Vector2(quadSize.x_ * 4.0f + quadSize.x_ * position.x_, quadSize.y_ * position.y_ + typeOffset);
-        }
-        case BlockSide::BACK: {
-            return Vector2(quadSize.x_ * 5.0f + quadSize.x_ * position.x_, quadSize.y_ * position.y_ + typeOffset);
-        }
-    }
-    return position;
-}
-
 void Chunk::Save()
 {
+    VoxelProfileScope profile(GetSubsystem<VoxelProfiler>(), VS_SAVE);
     JSONFile file(context_);
     JSONValue& root = file.GetRoot();
     for (int x = 0; x < SIZE_X; ++x) {
@@ -1240,6 +1448,7 @@ void Chunk::Save()
             }
         }
     }
+    SaveLight(root);
     if(!GetSubsystem<FileSystem>()->DirExists("World")) {
         GetSubsystem<FileSystem>()->CreateDir("World");
     }
@@ -1249,6 +1458,137 @@ void Chunk::Save()
     shouldSave_ = false;
 }
 
+void Chunk::SaveLight(JSONValue& root)
+{
+    if (headless_) {
+        // Light is not calculated in headless mode, chunk will calculate it when loaded by a client
+        return;
+    }
+    // Light is mostly uniform, so it is stored as value and run length pairs
+    const unsigned char* light = &lightMap_[0][0][0];
+    const int count = SIZE_X * SIZE_Y * SIZE_Z;
+    JSONArray runs;
+    int start = 0;
+    for (int i = 1; i <= count; i++) {
+        if (i == count || light[i] != light[start]) {
+            runs.Push(static_cast<int>(light[start]));
+            runs.Push(i - start);
+            start = i;
+        }
+    }
+    root.Set("LightVersion", LIGHT_VERSION);
+    root.Set("Light", runs);
+}
+
+bool Chunk::LoadLight(const JSONValue& root)
+{
+    if (!root.Get("LightVersion").IsNumber() || root.Get("LightVersion").GetInt() != LIGHT_VERSION) {
+        return false;
+    }
+    const JSONValue& runs = root.Get("Light");
+    if (!runs.IsArray() || runs.Size() % 2 != 0) {
+        return false;
+    }
+
+    unsigned char light[SIZE_X * SIZE_Y * SIZE_Z];
+    const int count = SIZE_X * SIZE_Y * SIZE_Z;
+    int offset = 0;
+    for (unsigned i = 0; i < runs.Size(); i += 2) {
+        int value = runs[i].GetInt();
+        int length = runs[i + 1].GetInt();
+        if (length <= 0 || offset + length > count) {
+            return false;
+        }
+        memset(light + offset, value, length);
+        offset += length;
+    }
+    if (offset != count) {
+        return false;
+    }
+
+    memcpy(lightMap_, light, sizeof(lightMap_));
+    return true;
+}
+
+bool Chunk::IsBorderOpen(BlockSide side)
+{
+    for (int a = 0; a < SIZE_X; a++) {
+        for (int b = 0; b < SIZE_Y; b++) {
+            BlockType type;
+            switch (side) {
+                case BlockSide::TOP:
+                    type = data_[a][SIZE_Y - 1][b].type;
+                    break;
+                case BlockSide::BOTTOM:
+                    type = data_[a][0][b].type;
+                    break;
+                case BlockSide::LEFT:
+                    type = data_[0][a][b].type;
+                    break;
+                case BlockSide::RIGHT:
+                    type = data_[SIZE_X - 1][a][b].type;
+                    break;
+                case BlockSide::FRONT:
+                    type = data_[a][b][0].type;
+                    break;
+                default:
+                    type = data_[a][b][SIZE_Z - 1].type;
+                    break;
+            }
+            if (!blocks_->IsSolid(type)) {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+bool Chunk::IsBorderLightDifferent(BlockSide side, Chunk* neighbor)
+{
+    for (int a = 0; a < SIZE_X; a++) {
+        for (int b = 0; b < SIZE_Y; b++) {
+            IntVector3 own;
+            IntVector3 other;
+            switch (side) {
+                case BlockSide::TOP:
+                    own = IntVector3(a, SIZE_Y - 1, b);
+                    other = IntVector3(a, 0, b);
+                    break;
+                case BlockSide::BOTTOM:
+                    own = IntVector3(a, 0, b);
+                    other = IntVector3(a, SIZE_Y - 1, b);
+                    break;
+                case BlockSide::LEFT:
+                    own = IntVector3(0, a, b);
+                    other = IntVector3(SIZE_X - 1, a, b);
+                    break;
+                case BlockSide::RIGHT:
+                    own = IntVector3(SIZE_X - 1, a, b);
+                    other = IntVector3(0, a, b);
+                    break;
+                case BlockSide::FRONT:
+                    own = IntVector3(a, b, 0);
+                    other = IntVector3(a, b, SIZE_Z - 1);
+                    break;
+                default:
+                    own = IntVector3(a, b, SIZE_Z - 1);
+                    other = IntVector3(a, b, 0);
+                    break;
+            }
+            int ownLight = GetTorchlight(own.x_, own.y_, own.z_);
+            int otherLight = neighbor->GetTorchlight(other.x_, other.y_, other.z_);
+            // Same test as the light propagation, the brighter side would still spread into the darker one
+            if (blocks_->GetOpacity(neighbor->data_[other.x_][other.y_][other.z_].type) < MAX_OPACITY && otherLight + 2 <= ownLight) {
+                return true;
+            }
+            if (blocks_->GetOpacity(data_[own.x_][own.y_][own.z_].type) < MAX_OPACITY && ownLight + 2 <= otherLight) {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
 void Chunk::CreateNode()
 {
     auto cache = GetSubsystem<ResourceCache>();
@@ -1272,8 +1612,6 @@ void Chunk::CreateNode()
     node_->SetScale(1.0f);
     node_->SetWorldPosition(position_);
 
-    SubscribeToEvent(E_UPDATE, URHO3D_HANDLER(Chunk, HandleUpdate));
-
 //    for (int i = 0; i <= PART_COUNT; i++) {
 //        SharedPtr<Node> part(node_->CreateChild("Part", LOCAL));
 //        part->CreateComponent<CustomGeometry>();
@@ -1515,14 +1853,14 @@ bool Chunk::BlockHaveNeighbor(BlockSide side, int x, int y, int z)
 
     if (insideChunk) {
         BlockType neighborType = data_[dX][dY][dZ].type;
-        if (neighborType != type && (neighborType == BT_AIR || neighborType == BT_WATER)) {
+        if (neighborType != type && !blocks_->IsSolid(neighborType)) {
             return false;
         }
     } else {
         auto neighbor = GetNeighbor(side);
         if (neighbor) {
             BlockType neighborType = neighbor->GetBlockValue(dX, dY, dZ);
-            if (neighborType != type && (neighborType == BT_AIR || neighborType == BT_WATER)) {
+            if (neighborType != type && !blocks_->IsSolid(neighborType)) {
                 return false;
             }
         }
@@ -1630,6 +1968,8 @@ void Chunk::SetTorchlight(int x, int y, int z, int value)
 {
     if (GetTorchlight(x, y, z) != value) {
         MarkForGeometryCalculation();
+        // Keep the saved light up to date with the light coming from the neighbors
+        shouldSave_ = true;
     }
     lightMap_[x][y][z] = (lightMap_[x][y][z] & 0xF0) | value;
 }
@@ -1660,11 +2000,16 @@ void Chunk::SetSunlight(int value)
 
 void Chunk::CalculateLight()
 {
+    if (headless_) {
+        // Light is only used for the mesh colors, clients calculate it on their own
+        return;
+    }
     for (int x = 0; x < SIZE_X; x++) {
         for (int y = 0; y < SIZE_Y; y++) {
             for (int z = 0; z < SIZE_Z; z++) {
-                if (data_[x][y][z].type == BT_TORCH) {
-                    SetTorchlight(x, y, z);
+                unsigned char light = blocks_->GetLight(data_[x][y][z].type);
+                if (light > 0) {
+                    SetTorchlight(x, y, z, light);
                     GetSubsystem<LightManager>()->AddLightNode(x, y, z, this);
                 }
             }
@@ -1746,10 +2091,20 @@ const int Chunk::GetDistance() const
     return distance_;
 }
 
+void Chunk::SetPriority(float priority)
+{
+    priority_ = priority;
+}
+
+float Chunk::GetPriority() const
+{
+    return priority_;
+}
+
 void Chunk::LoadFromServer()
 {
-    remoteLoadTimer_.Reset();
     requestedFromServer_ = true;
+    requestTimer_.Reset();
 #if !defined(__EMSCRIPTEN__)
     auto* network = GetSubsystem<Network>();
     Connection* serverConnection = network->GetServerConnection();
@@ -1766,7 +2121,7 @@ void Chunk::ProcessServerResponse(MemoryBuffer& buffer)
     for (int x = 0; x < SIZE_X; x++) {
         for (int y = 0; y < SIZE_Y; y++) {
             for (int z = 0; z < SIZE_Z; z++) {
-                SetVoxel(x, y, z, static_cast<BlockType>(buffer.ReadInt()));
+                SetVoxel(x, y, z, static_cast<BlockType>(buffer.ReadUByte()));
             }
         }
     }
@@ -1,6 +1,7 @@
 #ifdef VOXEL_SUPPORT
 #pragma once
 #include <queue>
+#include <atomic>
 #include <Urho3D/Graphics/CustomGeometry.h>
 #include <Urho3D/Graphics/Geometry.h>
 #include <Urho3D/Scene/Scene.h>
@@ -11,13 +12,24 @@
 #include <Urho3D/Graphics/IndexBuffer.h>
 #include <Urho3D/Graphics/Model.h>
 #include <Urho3D/IO/MemoryBuffer.h>
+#include <Urho3D/Resource/JSONValue.h>
 #include "VoxelDefs.h"
 #include "ChunkMesh.h"
+#include "ChunkRegion.h"
+#include "BlockRegistry.h"
 
 const int SIZE_X = 16;
 const int SIZE_Y = 16;
 const int SIZE_Z = 16;
 const int PART_COUNT = 3;
+// Highest level of detail reduction, chunk is meshed from (1 << MAX_LOD) sized cells
+const int MAX_LOD = 3;
+// Seconds it takes for a chunk to morph from the coarser mesh into the finer one
+const float LOD_MORPH_TIME = 0.5f;
+// Connectivity mask when every chunk face can see every other face
+const unsigned char ALL_FACES_CONNECTED = 0x3F;
+// Increase when light propagation changes, chunks saved with a different version calculate their light again
+const int LIGHT_VERSION = 1;
 
 using namespace Urho3D;
 
@@ -29,7 +41,23 @@ class Chunk : public Object {
     static void RegisterObject(Context* context);
 public:
     void Init(Scene* scene, const Vector3& position);
+    /**
+     * Reset the chunk state and hide its node so it can be kept in the chunk pool
+     */
+    void Release();
+    /**
+     * Move pooled chunk to a new position, keeps the existing node, components and mesh buffers
+     */
+    void Reuse(const Vector3& position);
     void Load();
+    /**
+     * Store block types and light map in run length encoded form for the dormant chunk cache
+     */
+    void Compress(PODVector<unsigned char>& buffer);
+    /**
+     * Restore chunk from Compress output instead of loading it from disk or generating it
+     */
+    bool LoadCompressed(const PODVector<unsigned char>& buffer);
     const Vector3& GetPosition();
     Node* GetNode() { return node_; }
     void Save();
@@ -61,18 +89,104 @@ public:
     IntVector3 GetChunkBlock(Vector3 position);
     void SetDistance(int distance);
     const int GetDistance() const;
+    void SetPriority(float priority);
+    float GetPriority() const;
+    /**
+     * Set level of detail, 0 is full detail, each next level doubles the mesh cell size and disables physics
+     */
+    void SetLod(int lod);
+    int GetLod() const;
+    /**
+     * Advance the morph which started when a finer mesh replaced a coarser one, returns false once it's done
+     */
+    bool UpdateMorph(float timeStep);
+    /**
+     * Chunk outside of the full load range, it's generated without caves, trees and light and never saved
+     */
+    void SetFar(bool far);
+    /**
+     * Chunk contains reduced far data which must not be saved or cached
+     */
+    bool IsFarData() const { return farData_; }
+    /**
+     * Bytes used by the block data, light map and meshes, called from the main thread
+     */
+    unsigned GetMemoryUsage();
+    /**
+     * Whether the face can be seen from the other face through non solid blocks
+     */
+    bool IsFaceConnected(BlockSide from, BlockSide to) const { return (connectivity_[from] & (1 << to)) != 0; }
+    /**
+     * Hide chunk which can't be seen from any camera, its geometry stays in the region buffers
+     */
+    void SetOcclusionVisible(bool visible);
+    bool IsOcclusionVisible() const { return occlusionVisible_; }
     bool IsRequestedFromServer();
     void LoadFromServer();
     void ProcessServerResponse(MemoryBuffer& buffer);
     void SetBlockData(const IntVector3& blockPosition, BlockType type);
     bool ShouldSave();
+    /**
+     * Send E_CHUNK_GENERATED once the chunk is loaded, returns true when the chunk was already announced
+     */
+    bool NotifyGenerated();
+    /**
+     * Milliseconds since the chunk data was requested from the server
+     */
+    unsigned GetServerRequestAge() { return requestTimer_.GetMSec(false); }
+    /**
+     * Server didn't respond, let the next chunk update send the request again
+     */
+    void RetryServerRequest() { requestedFromServer_ = false; }
+    /**
+     * Dedicated server mode, chunk only keeps block data and collision shapes
+     */
+    bool IsHeadless() const { return headless_; }
 
 private:
-    void HandleUpdate(StringHash eventType, VariantMap& eventData);
     void HandleHit(StringHash eventType, VariantMap& eventData);
     void HandleAdd(StringHash eventType, VariantMap& eventData);
-    Vector2 GetTextureCoord(BlockSide side, BlockType blockType, Vector2 position);
+    void CalculateLodGeometry(int lod, ChunkMesh& groundMesh, ChunkMesh& waterMesh);
+    /**
+     * Hand finished meshes over to the main thread, builds older than the published one are dropped
+     */
+    void PublishGeometry(ChunkMesh& groundMesh, ChunkMesh& waterMesh, const unsigned char* connectivity, int lod, int index);
+    /**
+     * Flood fill the non solid blocks and record which chunk faces are connected to each other
+     */
+    void CalculateConnectivity(unsigned char* connectivity);
+    void AddFace(ChunkMesh* mesh, BlockSide side, const Vector3& position, float size, BlockType type, const Color& color);
+    Color LightToColor(unsigned char light);
+    /**
+     * Physics only model, rendering is done by the ChunkRegion
+     */
+    void UpdateCollisionShape(Node* node, SharedPtr<Model>& model, ChunkMesh& mesh);
     bool IsBlockInsideChunk(IntVector3 position);
+    /**
+     * Decode Compress output into the block data and light map
+     */
+    bool Decompress(const unsigned char* buffer, unsigned size);
+    /**
+     * Take the chunk from the prebuilt world snapshot, if there is one
+     */
+    bool LoadSnapshot(bool& lightLoaded);
+    void SaveLight(JSONValue& root);
+    /**
+     * Restore the light map stored with the chunk, fails when the data was saved with different light version
+     */
+    bool LoadLight(const JSONValue& root);
+    /**
+     * Whether any block on the chunk side lets the neighbor faces behind it be seen
+     */
+    bool IsBorderOpen(BlockSide side);
+    /**
+     * Whether the torchlight on both sides of the border could still spread, so the saved light is out of date
+     */
+    bool IsBorderLightDifferent(BlockSide side, Chunk* neighbor);
+    /**
+     * Let the neighbors know about the loaded chunk, light is propagated again unless it was loaded with the chunk
+     */
+    void UpdateNeighbors(bool lightLoaded);
     void CreateNode();
     void RemoveNode();
     bool BlockHaveNeighbor(BlockSide side, int x, int y, int z);
@@ -88,6 +202,7 @@ private:
     SharedPtr<Node> groundNode_;
     SharedPtr<Node> label_;
     Scene* scene_;
+    BlockRegistry* blocks_{nullptr};
     Vector3 position_;
     VoxelBlock data_[SIZE_X][SIZE_Y][SIZE_Z];
     unsigned char lightMap_[SIZE_X][SIZE_Y][SIZE_Z];
@@ -97,17 +212,43 @@ private:
 
     bool loaded_{false};
     bool requestedFromServer_{false};
-    Timer remoteLoadTimer_;
-    bool shouldRender_{false};
+    Timer requestTimer_;
+    std::atomic<bool> shouldRender_{false};
     bool notified_{false};
+    bool headless_{false};
     int renderIndex_{0};
     Timer saveTimer_;
     int renderCounter_{0};
     int distance_{0};
+    // Lower value means that chunk should be loaded and meshed sooner, written by the chunk worker
+    // while the main thread sorts the render queue
+    std::atomic<float> priority_{0.0f};
+    int lod_{0};
+    bool far_{false};
+    bool farData_{false};
+    // Level of detail which was used for the current mesh
+    int meshLod_{0};
+    // Heights of the current mesh are blended from the cell grid of the previous coarser mesh, main thread only
+    float morphStep_{1.0f};
+    float morph_{1.0f};
+    // Front meshes, only used by the main thread
     ChunkMesh chunkMesh_;
     ChunkMesh chunkWaterMesh_;
-    int calculateIndex_{0};
-    int lastCalculatateIndex_{0};
+    // Last completed build waiting for Render, guarded by meshMutex_
+    ChunkMesh publishedMesh_;
+    ChunkMesh publishedWaterMesh_;
+    int publishedLod_{0};
+    unsigned char publishedConnectivity_[6];
+    // Bit mask of connected faces for each BlockSide, used by the main thread
+    unsigned char connectivity_[6];
+    bool occlusionVisible_{true};
+    int publishedIndex_{-1};
+    Mutex meshMutex_;
+    SharedPtr<Model> groundModel_;
+    SharedPtr<Model> waterModel_;
+    WeakPtr<ChunkRegion> region_;
+    std::atomic<int> calculateIndex_{0};
+    std::atomic<int> lastCalculatateIndex_{0};
     bool shouldSave_{false};
     int renderCount_{0};
 };
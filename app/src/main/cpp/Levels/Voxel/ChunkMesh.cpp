@@ -34,9 +34,7 @@
 ChunkMesh::ChunkMesh(Context* context):
         Object(context)
 {
-    vb_ = new VertexBuffer(context);
-    ib_ = new IndexBuffer(context);
-    geometry_ = new Geometry(context_);
+    // GPU objects are created on first upload, meshes built on worker threads never touch them
 }
 
 ChunkMesh::~ChunkMesh()
@@ -50,48 +48,17 @@ void ChunkMesh::RegisterObject(Context* context)
 
 void ChunkMesh::WriteToVertexBuffer()
 {
-    unsigned elementMask = MASK_POSITION | MASK_NORMAL | MASK_COLOR | MASK_TEXCOORD1;
-    vb_->SetSize(vertices_.Size(), elementMask, false);
+    if (!vb_) {
+        vb_ = new VertexBuffer(context_);
+    }
+    vb_->SetSize(vertices_.Size(), ELEMENT_MASK, false);
     vb_->SetShadowed(true);
 
     if (!vertices_.Empty()) {
         unsigned char *dest = (unsigned char *) vb_->Lock(0, vertices_.Size(), true);
 
         if (dest) {
-            for (auto i = 0; i < vertices_.Size(); ++i) {
-                if (elementMask & MASK_POSITION) {
-                    *((Vector3 *) dest) = vertices_[i].position_;
-                    dest += sizeof(Vector3);
-                }
-                if (elementMask & MASK_NORMAL) {
-                    *((Vector3 *) dest) = vertices_[i].normal_;
-                    dest += sizeof(Vector3);
-                }
-                if (elementMask & MASK_COLOR) {
-                    *((unsigned *) dest) = vertices_[i].color_.ToUInt();
-                    dest += sizeof(unsigned);
-                }
-                if (elementMask & MASK_TEXCOORD1) {
-                    *((Vector2 *) dest) = vertices_[i].uv_;
-                    dest += sizeof(Vector2);
-                }
-//            if (elementMask & MASK_TEXCOORD2) {
-//                *((Vector2*)dest) = vertices_[i].texCoord2_;
-//                dest += sizeof(Vector2);
-//            }
-//            if (elementMask & MASK_CUBETEXCOORD1) {
-//                *((Vector3*)dest) = vertices_[i].cubeTexCoord1_;
-//                dest += sizeof(Vector3);
-//            }
-//            if (elementMask & MASK_CUBETEXCOORD2) {
-//                *((Vector3*)dest) = vertices_[i].cubeTexCoord2_;
-//                dest += sizeof(Vector3);
-//            }
-//            if (elementMask & MASK_TANGENT) {
-//                *((Vector4*)dest) = vertices_[i].tangent_;
-//                dest += sizeof(Vector4);
-//            }
-            }
+            WriteVertices(dest, Vector3::ZERO);
         } else {
             URHO3D_LOGERROR("Failed to lock vertex buffer");
         }
@@ -99,6 +66,27 @@ void ChunkMesh::WriteToVertexBuffer()
     }
 }
 
+void ChunkMesh::WriteVertices(unsigned char* dest, const Vector3& offset, float morphStep, float morph)
+{
+    for (auto i = 0; i < vertices_.Size(); ++i) {
+        Vector3 position = vertices_[i].position_;
+        if (morph < 1.0f) {
+            // Coarse cells are filled up to their top, so the surface starts at the top of the cell.
+            // Snapping keeps the height order of the vertices, faces never overlap while they move
+            float coarseHeight = Ceil(position.y_ / morphStep) * morphStep;
+            position.y_ = Lerp(coarseHeight, position.y_, morph);
+        }
+        *((Vector3 *) dest) = position + offset;
+        dest += sizeof(Vector3);
+        *((Vector3 *) dest) = vertices_[i].normal_;
+        dest += sizeof(Vector3);
+        *((unsigned *) dest) = vertices_[i].color_.ToUInt();
+        dest += sizeof(unsigned);
+        *((Vector2 *) dest) = vertices_[i].uv_;
+        dest += sizeof(Vector2);
+    }
+}
+
 void ChunkMesh::AddVertex(const MeshVertex& vertexData)
 {
     vertices_.Push(vertexData);
@@ -111,6 +99,9 @@ void ChunkMesh::AddIndice(short index)
 
 void ChunkMesh::WriteToIndexBuffer()
 {
+    if (!ib_) {
+        ib_ = new IndexBuffer(context_);
+    }
     ib_->SetShadowed(true);
     ib_->SetSize(indices_.Size(), false);
     if (!indices_.Empty()) {
@@ -134,16 +125,35 @@ unsigned ChunkMesh::GetVertexCount()
     return vertices_.Size();
 }
 
+unsigned ChunkMesh::GetIndexCount()
+{
+    return indices_.Size();
+}
+
+unsigned ChunkMesh::GetMemoryUsage() const
+{
+    return vertices_.Capacity() * sizeof(MeshVertex) + indices_.Capacity() * sizeof(short);
+}
+
 void ChunkMesh::Clear()
 {
     indices_.Clear();
     vertices_.Clear();
 }
 
+void ChunkMesh::Swap(ChunkMesh& other)
+{
+    vertices_.Swap(other.vertices_);
+    indices_.Swap(other.indices_);
+}
+
 SharedPtr<Geometry> ChunkMesh::GetGeometry()
 {
     WriteToVertexBuffer();
     WriteToIndexBuffer();
+    if (!geometry_) {
+        geometry_ = new Geometry(context_);
+    }
     geometry_->SetVertexBuffer(0, vb_);
     geometry_->SetIndexBuffer(ib_);
     geometry_->SetDrawRange(TRIANGLE_LIST, 0, indices_.Size(), 0, vertices_.Size());
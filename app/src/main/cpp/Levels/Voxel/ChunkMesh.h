@@ -39,13 +39,30 @@ public:
     void AddIndice(short index);
 
     unsigned GetVertexCount();
+    unsigned GetIndexCount();
+    /**
+     * Bytes allocated for the vertex and index data, cleared meshes keep their capacity
+     */
+    unsigned GetMemoryUsage() const;
+    const Vector<short>& GetIndices() const { return indices_; }
+
+    /**
+     * Write vertices in the VertexBuffer layout used by the chunk meshes, moved by offset.
+     * While morph is below 1 the heights are blended from the morphStep sized cell grid of a coarser mesh
+     */
+    void WriteVertices(unsigned char* dest, const Vector3& offset, float morphStep = 1.0f, float morph = 1.0f);
 
     void Clear();
+    /**
+     * Exchange vertex and index data with other mesh, GPU buffers are not touched
+     */
+    void Swap(ChunkMesh& other);
 
     void WriteToVertexBuffer();
     void WriteToIndexBuffer();
 
     SharedPtr<Geometry> GetGeometry();
+    static const unsigned ELEMENT_MASK = MASK_POSITION | MASK_NORMAL | MASK_COLOR | MASK_TEXCOORD1;
 private:
     SharedPtr<VertexBuffer> vb_;
     SharedPtr<IndexBuffer> ib_;
@@ -0,0 +1,331 @@
+#ifdef VOXEL_SUPPORT
+#include <Urho3D/Core/Context.h>
+#include <Urho3D/IO/Log.h>
+#include <Urho3D/Graphics/Model.h>
+#include <Urho3D/Graphics/Material.h>
+#include <Urho3D/Resource/ResourceCache.h>
+#include "ChunkRegion.h"
+#include "Chunk.h"
+#include "VoxelWorld.h"
+#include "VoxelEvents.h"
+#include "../../Globals/ViewLayers.h"
+
+using namespace VoxelEvents;
+
+static const unsigned INITIAL_VERTEX_COUNT = 16384;
+static const unsigned INITIAL_INDEX_COUNT = 24576;
+
+void RegionLayer::Init(Context* context, Node* node, const String& material, bool occluder, const BoundingBox& boundingBox)
+{
+    vertexBuffer_ = new VertexBuffer(context);
+    vertexBuffer_->SetShadowed(true);
+    indexBuffer_ = new IndexBuffer(context);
+    indexBuffer_->SetShadowed(true);
+    geometry_ = new Geometry(context);
+    geometry_->SetVertexBuffer(0, vertexBuffer_);
+    geometry_->SetIndexBuffer(indexBuffer_);
+
+    SharedPtr<Model> model(new Model(context));
+    model->SetNumGeometries(1);
+    model->SetGeometry(0, 0, geometry_);
+    model->SetBoundingBox(boundingBox);
+
+    model_ = node->CreateComponent<StaticModel>(LOCAL);
+    model_->SetModel(model);
+    model_->SetViewMask(VIEW_MASK_CHUNK);
+    model_->SetOccluder(occluder);
+    model_->SetOccludee(true);
+    model_->SetMaterial(context->GetSubsystem<ResourceCache>()->GetResource<Material>(material));
+    // Nothing to draw until the first chunk is added
+    model_->SetEnabled(false);
+}
+
+void RegionLayer::SetChunkMesh(Chunk* chunk, ChunkMesh& mesh, const Vector3& offset, float morphStep, float morph)
+{
+    unsigned vertexCount = mesh.GetVertexCount();
+    unsigned indexCount = mesh.GetIndexCount();
+    if (vertexCount == 0 || indexCount == 0) {
+        RemoveChunk(chunk);
+        return;
+    }
+
+    auto it = allocations_.Find(chunk);
+    if (it != allocations_.End() && ((*it).second_.vertices_.count_ < vertexCount || (*it).second_.indices_.count_ < indexCount)) {
+        // Mesh doesn't fit in the previous range anymore
+        RemoveChunk(chunk);
+        it = allocations_.End();
+    }
+
+    if (it == allocations_.End()) {
+        // Reserve some extra space so that small edits can be updated in place
+        unsigned vertexCapacity = vertexCount + vertexCount / 4;
+        unsigned indexCapacity = indexCount + indexCount / 4;
+        RegionAllocation allocation;
+        if (!Allocate(freeVertices_, vertexCapacity, allocation.vertices_)) {
+            GrowVertexBuffer(vertexCapacity);
+            Allocate(freeVertices_, vertexCapacity, allocation.vertices_);
+        }
+        if (!Allocate(freeIndices_, indexCapacity, allocation.indices_)) {
+            GrowIndexBuffer(indexCapacity);
+            Allocate(freeIndices_, indexCapacity, allocation.indices_);
+        }
+        it = allocations_.Insert(MakePair(chunk, allocation));
+    }
+
+    const RegionAllocation& allocation = (*it).second_;
+
+    WriteVertices(allocation, mesh, offset, morphStep, morph);
+
+    if (allocation.visible_) {
+        WriteIndices(allocation, mesh);
+    } else {
+        ClearIndices(allocation.indices_);
+    }
+
+    UpdateDrawRange();
+}
+
+void RegionLayer::MorphChunkMesh(Chunk* chunk, ChunkMesh& mesh, const Vector3& offset, float morphStep, float morph)
+{
+    auto it = allocations_.Find(chunk);
+    if (it == allocations_.End() || (*it).second_.vertices_.count_ < mesh.GetVertexCount()) {
+        return;
+    }
+
+    WriteVertices((*it).second_, mesh, offset, morphStep, morph);
+}
+
+void RegionLayer::SetChunkVisible(Chunk* chunk, ChunkMesh& mesh, bool visible)
+{
+    auto it = allocations_.Find(chunk);
+    if (it == allocations_.End() || (*it).second_.visible_ == visible) {
+        return;
+    }
+
+    (*it).second_.visible_ = visible;
+    if (visible) {
+        WriteIndices((*it).second_, mesh);
+    } else {
+        ClearIndices((*it).second_.indices_);
+    }
+
+    UpdateDrawRange();
+}
+
+void RegionLayer::WriteVertices(const RegionAllocation& allocation, ChunkMesh& mesh, const Vector3& offset, float morphStep, float morph)
+{
+    unsigned vertexCount = mesh.GetVertexCount();
+    PODVector<unsigned char> vertexData(vertexCount * vertexBuffer_->GetVertexSize());
+    mesh.WriteVertices(vertexData.Buffer(), offset, morphStep, morph);
+    vertexBuffer_->SetDataRange(vertexData.Buffer(), allocation.vertices_.start_, vertexCount);
+}
+
+void RegionLayer::WriteIndices(const RegionAllocation& allocation, ChunkMesh& mesh)
+{
+    // Unused part of the index range is filled with degenerate triangles
+    const Vector<short>& indices = mesh.GetIndices();
+    unsigned indexCount = Min(mesh.GetIndexCount(), allocation.indices_.count_);
+    PODVector<unsigned> indexData(allocation.indices_.count_);
+    for (unsigned i = 0; i < allocation.indices_.count_; i++) {
+        if (i < indexCount) {
+            indexData[i] = allocation.vertices_.start_ + static_cast<unsigned short>(indices[i]);
+        } else {
+            indexData[i] = allocation.vertices_.start_;
+        }
+    }
+    indexBuffer_->SetDataRange(indexData.Buffer(), allocation.indices_.start_, allocation.indices_.count_);
+}
+
+void RegionLayer::RemoveChunk(Chunk* chunk)
+{
+    auto it = allocations_.Find(chunk);
+    if (it == allocations_.End()) {
+        return;
+    }
+
+    ClearIndices((*it).second_.indices_);
+    Free(freeVertices_, (*it).second_.vertices_);
+    Free(freeIndices_, (*it).second_.indices_);
+    allocations_.Erase(it);
+
+    UpdateDrawRange();
+}
+
+bool RegionLayer::Allocate(Vector<RegionRange>& freeRanges, unsigned count, RegionRange& range)
+{
+    for (unsigned i = 0; i < freeRanges.Size(); i++) {
+        if (freeRanges[i].count_ >= count) {
+            range = RegionRange(freeRanges[i].start_, count);
+            freeRanges[i].start_ += count;
+            freeRanges[i].count_ -= count;
+            if (freeRanges[i].count_ == 0) {
+                freeRanges.Erase(i);
+            }
+            return true;
+        }
+    }
+    return false;
+}
+
+void RegionLayer::Free(Vector<RegionRange>& freeRanges, const RegionRange& range)
+{
+    // Free ranges are kept sorted so that neighbors can be merged back together
+    unsigned i = 0;
+    while (i < freeRanges.Size() && freeRanges[i].start_ < range.start_) {
+        i++;
+    }
+    freeRanges.Insert(i, range);
+
+    if (i + 1 < freeRanges.Size() && freeRanges[i].start_ + freeRanges[i].count_ == freeRanges[i + 1].start_) {
+        freeRanges[i].count_ += freeRanges[i + 1].count_;
+        freeRanges.Erase(i + 1);
+    }
+    if (i > 0 && freeRanges[i - 1].start_ + freeRanges[i - 1].count_ == freeRanges[i].start_) {
+        freeRanges[i - 1].count_ += freeRanges[i].count_;
+        freeRanges.Erase(i);
+    }
+}
+
+void RegionLayer::GrowVertexBuffer(unsigned minCount)
+{
+    unsigned oldCount = vertexBuffer_->GetVertexCount();
+    unsigned newCount = Max(oldCount * 2, INITIAL_VERTEX_COUNT);
+    while (newCount - oldCount < minCount) {
+        newCount *= 2;
+    }
+
+    PODVector<unsigned char> data;
+    if (oldCount) {
+        data.Resize(oldCount * vertexBuffer_->GetVertexSize());
+        memcpy(data.Buffer(), vertexBuffer_->GetShadowData(), data.Size());
+    }
+    vertexBuffer_->SetSize(newCount, ChunkMesh::ELEMENT_MASK, true);
+    if (oldCount) {
+        vertexBuffer_->SetDataRange(data.Buffer(), 0, oldCount);
+    }
+    Free(freeVertices_, RegionRange(oldCount, newCount - oldCount));
+}
+
+void RegionLayer::GrowIndexBuffer(unsigned minCount)
+{
+    unsigned oldCount = indexBuffer_->GetIndexCount();
+    unsigned newCount = Max(oldCount * 2, INITIAL_INDEX_COUNT);
+    while (newCount - oldCount < minCount) {
+        newCount *= 2;
+    }
+
+    PODVector<unsigned char> data;
+    if (oldCount) {
+        data.Resize(oldCount * indexBuffer_->GetIndexSize());
+        memcpy(data.Buffer(), indexBuffer_->GetShadowData(), data.Size());
+    }
+    indexBuffer_->SetSize(newCount, true, true);
+    if (oldCount) {
+        indexBuffer_->SetDataRange(data.Buffer(), 0, oldCount);
+    }
+    Free(freeIndices_, RegionRange(oldCount, newCount - oldCount));
+}
+
+void RegionLayer::ClearIndices(const RegionRange& range)
+{
+    PODVector<unsigned> indexData(range.count_);
+    memset(indexData.Buffer(), 0, range.count_ * sizeof(unsigned));
+    indexBuffer_->SetDataRange(indexData.Buffer(), range.start_, range.count_);
+}
+
+void RegionLayer::UpdateDrawRange()
+{
+    unsigned vertexEnd = 0;
+    unsigned indexEnd = 0;
+    bool visible = false;
+    for (auto it = allocations_.Begin(); it != allocations_.End(); ++it) {
+        vertexEnd = Max(vertexEnd, (*it).second_.vertices_.start_ + (*it).second_.vertices_.count_);
+        indexEnd = Max(indexEnd, (*it).second_.indices_.start_ + (*it).second_.indices_.count_);
+        visible |= (*it).second_.visible_;
+    }
+
+    if (indexEnd == 0 || !visible) {
+        model_->SetEnabled(false);
+        return;
+    }
+    geometry_->SetDrawRange(TRIANGLE_LIST, 0, indexEnd, 0, vertexEnd);
+    model_->SetEnabled(true);
+}
+
+ChunkRegion::ChunkRegion(Context* context):
+    Object(context)
+{
+}
+
+ChunkRegion::~ChunkRegion()
+{
+    if (node_) {
+        node_->Remove();
+    }
+}
+
+void ChunkRegion::RegisterObject(Context* context)
+{
+    context->RegisterFactory<ChunkRegion>();
+}
+
+void ChunkRegion::Init(Scene* scene, const Vector3& position)
+{
+    position_ = position;
+    node_ = scene->CreateChild("Region" + position_.ToString(), LOCAL);
+    node_->SetWorldPosition(position_);
+
+    BoundingBox boundingBox(Vector3::ZERO, Vector3(SIZE_X, SIZE_Y, SIZE_Z) * REGION_SIZE);
+    ground_.Init(context_, node_->CreateChild("RegionGround", LOCAL), "Materials/Voxel.xml", true, boundingBox);
+    water_.Init(context_, node_->CreateChild("RegionWater", LOCAL), "Materials/VoxelWater.xml", false, boundingBox);
+
+    SubscribeToEvent(node_, E_CHUNK_HIT, URHO3D_HANDLER(ChunkRegion, HandleChunkEvent));
+    SubscribeToEvent(node_, E_CHUNK_ADD, URHO3D_HANDLER(ChunkRegion, HandleChunkEvent));
+}
+
+void ChunkRegion::UpdateChunk(Chunk* chunk, ChunkMesh& groundMesh, ChunkMesh& waterMesh, float morphStep, float morph)
+{
+    Vector3 offset = chunk->GetPosition() - position_;
+    ground_.SetChunkMesh(chunk, groundMesh, offset, morphStep, morph);
+    water_.SetChunkMesh(chunk, waterMesh, offset, morphStep, morph);
+}
+
+void ChunkRegion::MorphChunk(Chunk* chunk, ChunkMesh& groundMesh, ChunkMesh& waterMesh, float morphStep, float morph)
+{
+    Vector3 offset = chunk->GetPosition() - position_;
+    ground_.MorphChunkMesh(chunk, groundMesh, offset, morphStep, morph);
+    water_.MorphChunkMesh(chunk, waterMesh, offset, morphStep, morph);
+}
+
+void ChunkRegion::RemoveChunk(Chunk* chunk)
+{
+    ground_.RemoveChunk(chunk);
+    water_.RemoveChunk(chunk);
+}
+
+void ChunkRegion::SetChunkVisible(Chunk* chunk, ChunkMesh& groundMesh, ChunkMesh& waterMesh, bool visible)
+{
+    ground_.SetChunkVisible(chunk, groundMesh, visible);
+    water_.SetChunkVisible(chunk, waterMesh, visible);
+}
+
+bool ChunkRegion::IsEmpty() const
+{
+    return ground_.IsEmpty() && water_.IsEmpty();
+}
+
+int ChunkRegion::GetCulledDrawCalls() const
+{
+    return (ground_.IsCulled() ? 1 : 0) + (water_.IsCulled() ? 1 : 0);
+}
+
+void ChunkRegion::HandleChunkEvent(StringHash eventType, VariantMap& eventData)
+{
+    using namespace ChunkHit;
+    Vector3 position = eventData[P_POSITION].GetVector3();
+    auto chunk = GetSubsystem<VoxelWorld>()->GetChunkByPosition(position);
+    if (chunk && chunk->GetNode()) {
+        chunk->GetNode()->SendEvent(eventType, eventData);
+    }
+}
+#endif
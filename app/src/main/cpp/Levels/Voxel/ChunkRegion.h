@@ -0,0 +1,111 @@
+#ifdef VOXEL_SUPPORT
+#pragma once
+#include <Urho3D/Core/Object.h>
+#include <Urho3D/Scene/Scene.h>
+#include <Urho3D/Scene/Node.h>
+#include <Urho3D/Graphics/VertexBuffer.h>
+#include <Urho3D/Graphics/IndexBuffer.h>
+#include <Urho3D/Graphics/Geometry.h>
+#include <Urho3D/Graphics/StaticModel.h>
+#include "ChunkMesh.h"
+
+using namespace Urho3D;
+
+class Chunk;
+
+// Region size in chunks along each axis
+const int REGION_SIZE = 4;
+
+struct RegionRange {
+    RegionRange() {}
+    RegionRange(unsigned start, unsigned count): start_(start), count_(count) {}
+    unsigned start_{0};
+    unsigned count_{0};
+};
+
+struct RegionAllocation {
+    RegionRange vertices_;
+    RegionRange indices_;
+    // Hidden chunks keep their ranges but only degenerate indices are uploaded
+    bool visible_{true};
+};
+
+/**
+ * Single material mesh of the region, all chunk meshes are sub-allocated from one vertex and index buffer
+ */
+class RegionLayer {
+public:
+    void Init(Context* context, Node* node, const String& material, bool occluder, const BoundingBox& boundingBox);
+    /**
+     * Copy chunk mesh into the shared buffers, only the chunk range is uploaded
+     */
+    void SetChunkMesh(Chunk* chunk, ChunkMesh& mesh, const Vector3& offset, float morphStep = 1.0f, float morph = 1.0f);
+    /**
+     * Upload only the vertices of the chunk mesh which is already in the buffers, used while it morphs
+     */
+    void MorphChunkMesh(Chunk* chunk, ChunkMesh& mesh, const Vector3& offset, float morphStep, float morph);
+    void RemoveChunk(Chunk* chunk);
+    void SetChunkVisible(Chunk* chunk, ChunkMesh& mesh, bool visible);
+    bool IsEmpty() const { return allocations_.Empty(); }
+    /**
+     * Layer has geometry but all of it is hidden, so its draw call is skipped
+     */
+    bool IsCulled() const { return !allocations_.Empty() && !model_->IsEnabled(); }
+
+private:
+    bool Allocate(Vector<RegionRange>& freeRanges, unsigned count, RegionRange& range);
+    void Free(Vector<RegionRange>& freeRanges, const RegionRange& range);
+    void GrowVertexBuffer(unsigned minCount);
+    void GrowIndexBuffer(unsigned minCount);
+    void WriteVertices(const RegionAllocation& allocation, ChunkMesh& mesh, const Vector3& offset, float morphStep, float morph);
+    void WriteIndices(const RegionAllocation& allocation, ChunkMesh& mesh);
+    void ClearIndices(const RegionRange& range);
+    void UpdateDrawRange();
+
+    SharedPtr<VertexBuffer> vertexBuffer_;
+    SharedPtr<IndexBuffer> indexBuffer_;
+    SharedPtr<Geometry> geometry_;
+    SharedPtr<StaticModel> model_;
+    HashMap<Chunk*, RegionAllocation> allocations_;
+    Vector<RegionRange> freeVertices_;
+    Vector<RegionRange> freeIndices_;
+};
+
+/**
+ * Draws REGION_SIZE^3 chunks with one draw call per material
+ */
+class ChunkRegion : public Object {
+    URHO3D_OBJECT(ChunkRegion, Object);
+    ChunkRegion(Context* context);
+    virtual ~ChunkRegion();
+
+    static void RegisterObject(Context* context);
+public:
+    void Init(Scene* scene, const Vector3& position);
+    void UpdateChunk(Chunk* chunk, ChunkMesh& groundMesh, ChunkMesh& waterMesh, float morphStep = 1.0f, float morph = 1.0f);
+    /**
+     * Move the vertices of the chunk towards the final mesh after a switch to a finer level of detail
+     */
+    void MorphChunk(Chunk* chunk, ChunkMesh& groundMesh, ChunkMesh& waterMesh, float morphStep, float morph);
+    void RemoveChunk(Chunk* chunk);
+    /**
+     * Hide or show chunk which was culled by the visibility flood fill
+     */
+    void SetChunkVisible(Chunk* chunk, ChunkMesh& groundMesh, ChunkMesh& waterMesh, bool visible);
+    bool IsEmpty() const;
+    // Number of draw calls skipped because all chunks of a layer are hidden
+    int GetCulledDrawCalls() const;
+    const Vector3& GetPosition() const { return position_; }
+
+private:
+    /**
+     * Raycasts hit the region node, pass block events to the chunk which owns the block
+     */
+    void HandleChunkEvent(StringHash eventType, VariantMap& eventData);
+
+    SharedPtr<Node> node_;
+    Vector3 position_;
+    RegionLayer ground_;
+    RegionLayer water_;
+};
+#endif
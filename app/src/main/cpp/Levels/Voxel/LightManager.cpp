@@ -4,6 +4,7 @@
 #include <Urho3D/IO/Log.h>
 #include "LightManager.h"
 #include "VoxelWorld.h"
+#include "VoxelProfiler.h"
 #include <Urho3D/Engine/DebugHud.h>
 
 using namespace VoxelEvents;
@@ -57,6 +58,12 @@ void LightManager::AddLightRemovalNode(int x, int y, int z, int level, Chunk* ch
 //    failedLightRemovalBfsQueue_.emplace(x, y, z, level, position);
 //}
 
+bool LightManager::IsIdle() const
+{
+    MutexLock lock(mutex_);
+    return lightBfsQueue_.empty() && lightRemovalBfsQueue_.empty();
+}
+
 void LightManager::ResetFailedCalculations()
 {
     return;
@@ -88,7 +95,13 @@ void LightManager::Process()
 //        GetSubsystem<DebugHud>()->SetAppStats("LightManager::failedLightRemovalBfsQueue_", size3);
 //        GetSubsystem<DebugHud>()->SetAppStats("LightManager::failedLightBfsQueue_", size4);
     }
+    if (GetSubsystem<VoxelProfiler>()) {
+        GetSubsystem<VoxelProfiler>()->SetQueueDepth(VS_LIGHTING, lightRemovalBfsQueue_.size() + lightBfsQueue_.size());
+    }
+    // Empty passes would hide the real propagation times
+    VoxelProfileScope profile(IsIdle() ? nullptr : GetSubsystem<VoxelProfiler>(), VS_LIGHTING);
     MutexLock lock(mutex_);
+    BlockRegistry* blocks = GetSubsystem<BlockRegistry>();
     while(!lightRemovalBfsQueue_.empty()) {
         // Get a reference to the front node
         LightRemovalNode &node = lightRemovalBfsQueue_.front();
@@ -261,13 +274,10 @@ void LightManager::Process()
             if (insideChunk) {
                 BlockType type = chunk->GetBlockAt(IntVector3(dX, dY, dZ))->type;
                 int blockLightLevel = chunk->GetTorchlight(dX, dY, dZ);
-                if ((type == BlockType::BT_AIR || type == BlockType::BT_WATER) && blockLightLevel + 2 <= lightLevel) {
-                    if (type == BlockType::BT_WATER) {
-                        // Light in water will fade out a bit quicker
-                        chunk->SetTorchlight(dX, dY, dZ, lightLevel - 2);
-                    } else {
-                        chunk->SetTorchlight(dX, dY, dZ, lightLevel - 1);
-                    }
+                // Light fades out quicker in blocks with higher opacity, e.g. water
+                int opacity = blocks->GetOpacity(type);
+                if (opacity < MAX_OPACITY && blockLightLevel + 2 <= lightLevel) {
+                    chunk->SetTorchlight(dX, dY, dZ, Max(lightLevel - 1 - opacity, 0));
                     lightBfsQueue_.emplace(dX, dY, dZ, chunk);
                 }
             } else {
@@ -275,13 +285,9 @@ void LightManager::Process()
                 if (neighbor) {
                     BlockType type = neighbor->GetBlockAt(IntVector3(dX, dY, dZ))->type;
                     int blockLightLevel = neighbor->GetTorchlight(dX, dY, dZ);
-                    if ((type == BlockType::BT_AIR || type == BlockType::BT_WATER) && blockLightLevel + 2 <= lightLevel) {
-                        if (type == BlockType::BT_WATER) {
-                            // Light in water will fade out a bit quicker
-                            neighbor->SetTorchlight(dX, dY, dZ, lightLevel - 2);
-                        } else {
-                            neighbor->SetTorchlight(dX, dY, dZ, lightLevel - 1);
-                        }
+                    int opacity = blocks->GetOpacity(type);
+                    if (opacity < MAX_OPACITY && blockLightLevel + 2 <= lightLevel) {
+                        neighbor->SetTorchlight(dX, dY, dZ, Max(lightLevel - 1 - opacity, 0));
                         AddLightNode(dX, dY, dZ, neighbor);
                     }
                 } else {
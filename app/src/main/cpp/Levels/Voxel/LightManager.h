@@ -40,6 +40,10 @@ public:
 //    void AddFailedLightNode(int x, int y, int z, Vector3 position);
 //    void AddFailedLightRemovalNode(int x, int y, int z, int level, Vector3 position);
     void Process();
+    /**
+     * No light changes are waiting to be propagated
+     */
+    bool IsIdle() const;
 
 private:
     void HandleUpdate(StringHash eventType, VariantMap& eventData);
@@ -51,7 +55,7 @@ private:
 //    std::queue<LightNode> failedLightBfsQueue_;
 //    std::queue<LightRemovalNode> failedLightRemovalBfsQueue_;
 
-    Mutex mutex_;
+    mutable Mutex mutex_;
     Timer retryTimer_;
 };
 #endif
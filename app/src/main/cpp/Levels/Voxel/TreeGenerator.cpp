@@ -1,17 +1,28 @@
 #ifdef VOXEL_SUPPORT
 #include <Urho3D/Core/Context.h>
-#include <Urho3D/Core/CoreEvents.h>
 #include <Urho3D/IO/Log.h>
+#include <Urho3D/Engine/DebugHud.h>
 #include "TreeGenerator.h"
+#include "ChunkGenerator.h"
 #include "VoxelWorld.h"
 
 using namespace VoxelEvents;
 
+/**
+ * Deterministic per column random value
+ */
+static unsigned ColumnHash(int x, int z)
+{
+    unsigned hash = static_cast<unsigned>(x) * 73856093u ^ static_cast<unsigned>(z) * 19349663u;
+    hash ^= hash >> 13;
+    hash *= 0x5bd1e995u;
+    hash ^= hash >> 15;
+    return hash;
+}
+
 TreeGenerator::TreeGenerator(Context* context):
         Object(context)
 {
-//    SubscribeToEvent(E_UPDATE, URHO3D_HANDLER(TreeGenerator, HandleUpdate));
-    SubscribeToEvent(E_CHUNK_GENERATED, URHO3D_HANDLER(TreeGenerator, HandleChunkGenerated));
 }
 
 TreeGenerator::~TreeGenerator()
@@ -23,144 +34,82 @@ void TreeGenerator::RegisterObject(Context* context)
     context->RegisterFactory<TreeGenerator>();
 }
 
-void TreeGenerator::AddTreeNode(int x, int y, int z, int height, int width, Chunk *chunk)
-{
-    treeBfsQueue_.emplace(x, y, z, height, width, chunk);
-    chunk->MarkForGeometryCalculation();
-//    URHO3D_LOGINFOF("AddTreeNode %d %d %d => %d", x, y, z, height);
-}
-
-void TreeGenerator::Process()
+void TreeGenerator::PlaceTrees(Chunk* chunk)
 {
-    MutexLock lock(mutex_);
-
-    while(!treeBfsQueue_.empty()) {
-        // Get a reference to the front node.
-        TreeNode &node = treeBfsQueue_.front();
-        Chunk* chunk = node.chunk_;
-        int height = node.height_;
-        int width = node.width_;
-        // Pop the front node off the queue. We no longer need the node reference
-        treeBfsQueue_.pop();
-        if (!GetSubsystem<VoxelWorld>()->IsChunkValid(chunk)) {
-            continue;
-        }
+    const Vector3& origin = chunk->GetPosition();
+    IntVector3 chunkMin(origin.x_, origin.y_, origin.z_);
+    IntVector3 chunkMax(chunkMin.x_ + SIZE_X - 1, chunkMin.y_ + SIZE_Y - 1, chunkMin.z_ + SIZE_Z - 1);
 
-        for (int i = 0; i < 6; i++) {
-            BlockSide side = static_cast<BlockSide>(i);
-            int dX = node.x_;
-            int dY = node.y_;
-            int dZ = node.z_;
-            bool insideChunk = true;
-
-            if (side == BlockSide::BOTTOM) {
+    // Every chunk builds its own part of all trees within TREE_RADIUS, neighbors never have to be edited
+    PODVector<StructureBlock> blocks;
+    for (int x = chunkMin.x_ - TREE_RADIUS; x <= chunkMax.x_ + TREE_RADIUS; x++) {
+        for (int z = chunkMin.z_ - TREE_RADIUS; z <= chunkMax.z_ + TREE_RADIUS; z++) {
+            blocks.Clear();
+            GetColumnTree(x, z, blocks);
+            if (blocks.Empty()) {
                 continue;
             }
 
-            if (height < 5 && side != BlockSide::TOP) {
-                continue;
+            for (auto it = blocks.Begin(); it != blocks.End(); ++it) {
+                const IntVector3& position = (*it).position_;
+                if (position.x_ >= chunkMin.x_ && position.x_ <= chunkMax.x_
+                    && position.y_ >= chunkMin.y_ && position.y_ <= chunkMax.y_
+                    && position.z_ >= chunkMin.z_ && position.z_ <= chunkMax.z_) {
+                    ApplyEdit(chunk, position - chunkMin, (*it).type_);
+                }
             }
+        }
+    }
+}
 
-            if (side == BlockSide::TOP) {
-                height++;
-            }
-            switch (i) {
-                case BlockSide::LEFT:
-                    if (dX - 1 < 0) {
-                        insideChunk = false;
-                        dX = SIZE_X - 1;
-                    } else {
-                        dX -= 1;
-                    }
-                    break;
-                case BlockSide::RIGHT:
-                    if (dX + 1 >= SIZE_X) {
-                        insideChunk = false;
-                        dX = 0;
-                    } else {
-                        dX += 1;
-                    }
-                    break;
-                case BlockSide::BOTTOM:
-                    if (dY - 1 < 0) {
-                        insideChunk = false;
-                        dY = SIZE_Y - 1;
-                    } else {
-                        dY -= 1;
-                    }
-                    break;
-                case BlockSide::TOP:
-                    if (dY + 1 >= SIZE_Y) {
-                        insideChunk = false;
-                        dY = 0;
-                    } else {
-                        dY += 1;
-                    }
-                    break;
-                case BlockSide::FRONT:
-                    if (dZ - 1 < 0) {
-                        insideChunk = false;
-                        dZ = SIZE_Z - 1;
-                    } else {
-                        dZ -= 1;
-                    }
-                    break;
-                case BlockSide::BACK:
-                    if (dZ + 1 >= SIZE_Z) {
-                        insideChunk = false;
-                        dZ = 0;
-                    } else {
-                        dZ += 1;
-                    }
-                    break;
-            }
+void TreeGenerator::GetColumnTree(int x, int z, PODVector<StructureBlock>& blocks)
+{
+    auto chunkGenerator = GetSubsystem<ChunkGenerator>();
+    unsigned hash = ColumnHash(x, z);
+    // Keep trees apart from each other inside the forest areas
+    if ((hash & 15) != 0) {
+        return;
+    }
+    Vector3 columnPosition(x, 0, z);
+    if (!chunkGenerator->HaveTree(columnPosition)) {
+        return;
+    }
+
+    int surfaceHeight = chunkGenerator->GetTerrainHeight(columnPosition);
+    Vector3 basePosition(x, surfaceHeight, z);
+    BlockType surfaceType = chunkGenerator->GetCaveBlockType(basePosition, chunkGenerator->GetBlockType(basePosition, surfaceHeight));
+    if (surfaceType != BT_DIRT) {
+        return;
+    }
+
+    int trunkHeight = 4 + (hash >> 4) % 3;
+    for (int y = 0; y <= trunkHeight; y++) {
+        blocks.Push(StructureBlock{IntVector3(x, surfaceHeight + y, z), BT_WOOD});
+    }
 
-            int dWidth = width;
-            if (side == BlockSide::FRONT || side == BlockSide::BACK || side == BlockSide::LEFT || side == BlockSide::RIGHT) {
-                dWidth++;
-                if (width > 2) {
+    // Two wide leaf layers around the top of the trunk and a narrow cap above it
+    for (int y = trunkHeight - 1; y <= trunkHeight + 2; y++) {
+        int radius = y > trunkHeight ? 1 : TREE_RADIUS;
+        for (int dX = -radius; dX <= radius; dX++) {
+            for (int dZ = -radius; dZ <= radius; dZ++) {
+                if (Abs(dX) == radius && Abs(dZ) == radius && radius > 1) {
                     continue;
                 }
-            }
-            if (insideChunk) {
-                BlockType type = chunk->GetBlockAt(IntVector3(dX, dY, dZ))->type;
-                if (type == BT_AIR) {
-                    chunk->SetVoxel(dX, dY, dZ, height > 5 ? BT_TREE_LEAVES : BT_WOOD);
-                    if (height < 10) {
-                        AddTreeNode(dX, dY, dZ, height, dWidth, chunk);
-                    }
-                }
-            } else {
-                auto neighbor = chunk->GetNeighbor(static_cast<BlockSide>(i));
-                if (neighbor) {
-                    BlockType type = neighbor->GetBlockAt(IntVector3(dX, dY, dZ))->type;
-                    if (type == BT_AIR) {
-                        neighbor->SetVoxel(dX, dY, dZ, height > 5 ? BT_TREE_LEAVES : BT_WOOD);
-                        if (height < 10) {
-                            AddTreeNode(dX, dY, dZ, height, dWidth, neighbor);
-                        }
-                    }
-                } else {
-                    failedTreeBfsQueue_.emplace(node);
+                if (dX == 0 && dZ == 0 && y <= trunkHeight) {
+                    continue;
                 }
+                blocks.Push(StructureBlock{IntVector3(x + dX, surfaceHeight + y, z + dZ), BT_TREE_LEAVES});
             }
         }
     }
 }
 
-void TreeGenerator::HandleUpdate(StringHash eventType, VariantMap& eventData)
-{
-    if (GetSubsystem<VoxelWorld>()) {
-        Process();
-    }
-}
-
-void TreeGenerator::HandleChunkGenerated(StringHash eventType, VariantMap& eventData)
+void TreeGenerator::ApplyEdit(Chunk* chunk, const IntVector3& blockPosition, BlockType type)
 {
-    MutexLock lock(mutex_);
-    while(!failedTreeBfsQueue_.empty()) {
-        treeBfsQueue_.emplace(failedTreeBfsQueue_.front());
-        failedTreeBfsQueue_.pop();
+    BlockType current = chunk->GetBlockValue(blockPosition.x_, blockPosition.y_, blockPosition.z_);
+    // Trees never replace terrain, trunk may grow through leaves of other trees
+    if (current == BT_AIR || (type == BT_WOOD && (current == BT_TREE_LEAVES || current == BT_DIRT))) {
+        chunk->SetVoxel(blockPosition.x_, blockPosition.y_, blockPosition.z_, type);
     }
 }
 #endif
@@ -1,23 +1,25 @@
 #ifdef VOXEL_SUPPORT
 #pragma once
 #include <Urho3D/Core/Object.h>
-#include <queue>
 #include "VoxelDefs.h"
 #include "VoxelEvents.h"
 #include "Chunk.h"
 
 using namespace Urho3D;
 
-struct TreeNode {
-    TreeNode(short x, short y, short z, int height, int width, Chunk* ch) : x_(x), y_(y), z_(z), height_(height), width_(width), chunk_(ch) {}
-    short x_;
-    short y_;
-    short z_;
-    Chunk* chunk_;
-    int height_;
-    int width_;
+// How far leaves can reach from the tree column
+const int TREE_RADIUS = 2;
+
+struct StructureBlock {
+    // World block position
+    IntVector3 position_;
+    BlockType type_;
 };
 
+/**
+ * Places trees while chunks are generated. Tree shape only depends on its column, so every chunk
+ * builds the parts of nearby trees which reach into it without waiting for neighbors
+ */
 class TreeGenerator : public Object {
 URHO3D_OBJECT(TreeGenerator, Object);
     TreeGenerator(Context* context);
@@ -25,15 +27,13 @@ URHO3D_OBJECT(TreeGenerator, Object);
 
 public:
     static void RegisterObject(Context* context);
-    void AddTreeNode(int x, int y, int z, int height, int width, Chunk* chunk);
-    void Process();
+    /**
+     * Place all tree blocks which fall inside the chunk, called during chunk generation
+     */
+    void PlaceTrees(Chunk* chunk);
 
 private:
-    void HandleUpdate(StringHash eventType, VariantMap& eventData);
-    void HandleChunkGenerated(StringHash eventType, VariantMap& eventData);
-
-    std::queue<TreeNode> treeBfsQueue_;
-    std::queue<TreeNode> failedTreeBfsQueue_;
-    Mutex mutex_;
+    void GetColumnTree(int x, int z, PODVector<StructureBlock>& blocks);
+    void ApplyEdit(Chunk* chunk, const IntVector3& blockPosition, BlockType type);
 };
 #endif
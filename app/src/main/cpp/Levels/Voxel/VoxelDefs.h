@@ -13,7 +13,8 @@ enum BlockSide {
     BACK
 };
 
-enum BlockType {
+// Built-in block IDs, properties of all blocks come from the BlockRegistry
+enum BlockType : unsigned char {
     BT_AIR,
     BT_STONE,
     BT_DIRT,
@@ -23,6 +24,7 @@ enum BlockType {
     BT_WOOD,
     BT_TREE_LEAVES,
     BT_WATER,
+    // First ID which is free for blocks added only from config
     BT_NONE
 };
 
@@ -44,4 +46,5 @@ const int NETWORK_SEND_CHUNK = 154;
 const int NETWORK_REQUEST_CHUNK_HIT = 155;
 const int NETWORK_REQUEST_CHUNK_ADD = 156;
 const int NETWORK_SEND_CHUNK_UPDATE = 157;
+const int NETWORK_SEND_CHUNK_UNLOAD = 158;
 #endif
@@ -0,0 +1,203 @@
+#ifdef VOXEL_SUPPORT
+#include <Urho3D/Core/Context.h>
+#include <Urho3D/Core/CoreEvents.h>
+#include <Urho3D/IO/Log.h>
+#include <Urho3D/IO/File.h>
+#include <Urho3D/Resource/JSONFile.h>
+#include <Urho3D/Engine/DebugHud.h>
+#include "VoxelProfiler.h"
+#include "../../Console/ConsoleHandlerEvents.h"
+
+using namespace ConsoleHandlerEvents;
+
+static const char* STAGE_NAMES[VS_COUNT] = {
+    "Generation",
+    "Lighting",
+    "Meshing",
+    "Upload",
+    "Physics",
+    "Save",
+    "Network"
+};
+
+/**
+ * Value at the fraction (0..1) of the sorted durations
+ */
+static float Percentile(const PODVector<float>& sorted, float fraction)
+{
+    if (sorted.Empty()) {
+        return 0.0f;
+    }
+    return sorted[static_cast<unsigned>(Clamp(fraction, 0.0f, 1.0f) * (sorted.Size() - 1) + 0.5f)];
+}
+
+VoxelProfiler::VoxelProfiler(Context* context):
+    Object(context)
+{
+    SubscribeToEvent(E_UPDATE, URHO3D_HANDLER(VoxelProfiler, HandleUpdate));
+
+    SendEvent(
+            E_CONSOLE_COMMAND_ADD,
+            ConsoleCommandAdd::P_NAME, "voxel_profile_dump",
+            ConsoleCommandAdd::P_EVENT, "#voxel_profile_dump",
+            ConsoleCommandAdd::P_DESCRIPTION, "Save voxel pipeline timings [filename.csv|filename.json]",
+            ConsoleCommandAdd::P_OVERWRITE, true
+    );
+    SubscribeToEvent("#voxel_profile_dump", [&](StringHash eventType, VariantMap& eventData) {
+        StringVector params = eventData["Parameters"].GetStringVector();
+        if (params.Size() > 2) {
+            URHO3D_LOGERROR("This command accepts only the filename argument!");
+            return;
+        }
+        String filename = params.Size() == 2 ? params[1] : "VoxelProfile.csv";
+        if (Dump(filename)) {
+            URHO3D_LOGINFO("Voxel pipeline timings saved to " + filename);
+        }
+    });
+}
+
+VoxelProfiler::~VoxelProfiler()
+{
+}
+
+void VoxelProfiler::RegisterObject(Context* context)
+{
+    context->RegisterFactory<VoxelProfiler>();
+}
+
+void VoxelProfiler::AddSample(VoxelStage stage, float duration)
+{
+    MutexLock lock(mutex_);
+    StageHistory& history = stages_[stage];
+    history.samples_[history.next_].time_ = clock_.GetUSec(false) / 1000000.0f;
+    history.samples_[history.next_].duration_ = duration;
+    history.next_ = (history.next_ + 1) % PROFILER_WINDOW;
+    history.count_ = Min(history.count_ + 1, (unsigned)PROFILER_WINDOW);
+}
+
+void VoxelProfiler::SetQueueDepth(VoxelStage stage, int depth)
+{
+    MutexLock lock(mutex_);
+    stages_[stage].queueDepth_ = depth;
+}
+
+void VoxelProfiler::GetSortedDurations(VoxelStage stage, PODVector<float>& durations)
+{
+    {
+        MutexLock lock(mutex_);
+        const StageHistory& history = stages_[stage];
+        durations.Resize(history.count_);
+        for (unsigned i = 0; i < history.count_; i++) {
+            durations[i] = history.samples_[i].duration_;
+        }
+    }
+    Sort(durations.Begin(), durations.End());
+}
+
+float VoxelProfiler::GetPercentile(VoxelStage stage, float fraction)
+{
+    PODVector<float> durations;
+    GetSortedDurations(stage, durations);
+    return Percentile(durations, fraction);
+}
+
+const char* VoxelProfiler::GetStageName(VoxelStage stage)
+{
+    return STAGE_NAMES[stage];
+}
+
+bool VoxelProfiler::Dump(const String& filename)
+{
+    // Copy the samples first so that the workers are not blocked by the file writing
+    Vector<PODVector<StageSample>> samples(VS_COUNT);
+    PODVector<int> queueDepths(VS_COUNT);
+    {
+        MutexLock lock(mutex_);
+        for (int i = 0; i < VS_COUNT; i++) {
+            const StageHistory& history = stages_[i];
+            // Oldest sample first
+            unsigned start = history.count_ < PROFILER_WINDOW ? 0 : history.next_;
+            for (unsigned j = 0; j < history.count_; j++) {
+                samples[i].Push(history.samples_[(start + j) % PROFILER_WINDOW]);
+            }
+            queueDepths[i] = history.queueDepth_;
+        }
+    }
+
+    if (filename.EndsWith(".json", false)) {
+        JSONFile file(context_);
+        JSONArray stages;
+        for (int i = 0; i < VS_COUNT; i++) {
+            VoxelStage stage = static_cast<VoxelStage>(i);
+            PODVector<float> durations(samples[i].Size());
+            for (unsigned j = 0; j < samples[i].Size(); j++) {
+                durations[j] = samples[i][j].duration_;
+            }
+            Sort(durations.Begin(), durations.End());
+
+            JSONValue stageValue;
+            stageValue.Set("Name", GetStageName(stage));
+            stageValue.Set("P50", Percentile(durations, 0.5f));
+            stageValue.Set("P95", Percentile(durations, 0.95f));
+            stageValue.Set("P99", Percentile(durations, 0.99f));
+            stageValue.Set("QueueDepth", queueDepths[i]);
+            JSONArray trace;
+            for (auto it = samples[i].Begin(); it != samples[i].End(); ++it) {
+                JSONArray sample;
+                sample.Push((*it).time_);
+                sample.Push((*it).duration_);
+                trace.Push(sample);
+            }
+            stageValue.Set("Samples", trace);
+            stages.Push(stageValue);
+        }
+        file.GetRoot().Set("Stages", stages);
+        if (!file.SaveFile(filename)) {
+            URHO3D_LOGERROR("Failed to save voxel profile " + filename);
+            return false;
+        }
+        return true;
+    }
+
+    File file(context_);
+    if (!file.Open(filename, FILE_WRITE)) {
+        URHO3D_LOGERROR("Failed to save voxel profile " + filename);
+        return false;
+    }
+    file.WriteLine("stage,time_s,duration_ms,queue_depth");
+    for (int i = 0; i < VS_COUNT; i++) {
+        for (auto it = samples[i].Begin(); it != samples[i].End(); ++it) {
+            file.WriteLine(String(GetStageName(static_cast<VoxelStage>(i))) + "," + String((*it).time_) + ","
+                           + String((*it).duration_) + "," + String(queueDepths[i]));
+        }
+    }
+    file.Close();
+    return true;
+}
+
+void VoxelProfiler::HandleUpdate(StringHash eventType, VariantMap& eventData)
+{
+    if (statsTimer_.GetMSec(false) < 500 || !GetSubsystem<DebugHud>()) {
+        return;
+    }
+    statsTimer_.Reset();
+
+    for (int i = 0; i < VS_COUNT; i++) {
+        VoxelStage stage = static_cast<VoxelStage>(i);
+        PODVector<float> durations;
+        GetSortedDurations(stage, durations);
+        if (durations.Empty()) {
+            continue;
+        }
+        int queueDepth;
+        {
+            MutexLock lock(mutex_);
+            queueDepth = stages_[i].queueDepth_;
+        }
+        String stats;
+        stats.AppendWithFormat("p50 %.2f p95 %.2f p99 %.2f ms, queue %d", Percentile(durations, 0.5f),
+                               Percentile(durations, 0.95f), Percentile(durations, 0.99f), queueDepth);
+        GetSubsystem<DebugHud>()->SetAppStats("Voxel " + String(GetStageName(stage)), stats);
+    }
+}
+#endif
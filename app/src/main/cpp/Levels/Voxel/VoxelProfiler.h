@@ -0,0 +1,89 @@
+#ifdef VOXEL_SUPPORT
+#pragma once
+#include <Urho3D/Core/Object.h>
+#include <Urho3D/Core/Timer.h>
+#include <Urho3D/Core/Mutex.h>
+
+using namespace Urho3D;
+
+enum VoxelStage {
+    VS_GENERATION,
+    VS_LIGHTING,
+    VS_MESHING,
+    VS_UPLOAD,
+    VS_PHYSICS,
+    VS_SAVE,
+    VS_NETWORK,
+    VS_COUNT
+};
+
+// Number of latest samples kept for each stage
+const int PROFILER_WINDOW = 512;
+
+struct StageSample {
+    // Seconds since the profiler was created
+    float time_;
+    float duration_;
+};
+
+struct StageHistory {
+    StageSample samples_[PROFILER_WINDOW];
+    unsigned next_{0};
+    unsigned count_{0};
+    int queueDepth_{0};
+};
+
+/**
+ * Rolling timing histograms of the chunk pipeline stages, usable from the main and worker threads
+ */
+class VoxelProfiler : public Object {
+    URHO3D_OBJECT(VoxelProfiler, Object);
+    VoxelProfiler(Context* context);
+    virtual ~VoxelProfiler();
+
+    static void RegisterObject(Context* context);
+public:
+    void AddSample(VoxelStage stage, float duration);
+    /**
+     * Number of items waiting for the stage
+     */
+    void SetQueueDepth(VoxelStage stage, int depth);
+    /**
+     * Duration in milliseconds which given fraction (0..1) of the recent samples didn't exceed
+     */
+    float GetPercentile(VoxelStage stage, float fraction);
+    /**
+     * Write all recent samples to CSV file, or JSON file when the name ends with .json
+     */
+    bool Dump(const String& filename);
+    static const char* GetStageName(VoxelStage stage);
+
+private:
+    void HandleUpdate(StringHash eventType, VariantMap& eventData);
+    void GetSortedDurations(VoxelStage stage, PODVector<float>& durations);
+
+    StageHistory stages_[VS_COUNT];
+    Mutex mutex_;
+    HiresTimer clock_;
+    Timer statsTimer_;
+};
+
+/**
+ * Measures the time until the end of the scope and adds it to the stage
+ */
+class VoxelProfileScope {
+public:
+    VoxelProfileScope(VoxelProfiler* profiler, VoxelStage stage): profiler_(profiler), stage_(stage) {}
+    ~VoxelProfileScope()
+    {
+        if (profiler_) {
+            profiler_->AddSample(stage_, timer_.GetUSec(false) / 1000.0f);
+        }
+    }
+
+private:
+    VoxelProfiler* profiler_;
+    VoxelStage stage_;
+    HiresTimer timer_;
+};
+#endif
@@ -3,9 +3,15 @@
 #include <Urho3D/Core/Context.h>
 #include <Urho3D/Core/CoreEvents.h>
 #include <Urho3D/Engine/DebugHud.h>
+#include <Urho3D/Engine/Engine.h>
 #include <Urho3D/Math/Ray.h>
 #include <Urho3D/Container/Vector.h>
 #include <Urho3D/Graphics/Octree.h>
+#include <Urho3D/Graphics/Renderer.h>
+#include <Urho3D/Graphics/GraphicsEvents.h>
+#include <Urho3D/Graphics/Viewport.h>
+#include <Urho3D/Graphics/Camera.h>
+#include <Urho3D/Physics/RigidBody.h>
 #include <Urho3D/IO/FileSystem.h>
 
 #if !defined(__EMSCRIPTEN__)
@@ -21,13 +27,14 @@
 #include "../../Console/ConsoleHandlerEvents.h"
 #include "LightManager.h"
 #include "TreeGenerator.h"
+#include "VoxelProfiler.h"
 
 using namespace VoxelEvents;
 using namespace ConsoleHandlerEvents;
 
 bool CompareChunks(const Chunk* lhs, const Chunk* rhs)
 {
-   return lhs->GetDistance() < rhs->GetDistance();
+   return lhs->GetPriority() < rhs->GetPriority();
 }
 
 void UpdateChunkState(const WorkItem* item, unsigned threadIndex)
@@ -39,9 +46,6 @@ void UpdateChunkState(const WorkItem* item, unsigned threadIndex)
         world->GetSubsystem<LightManager>()->ResetFailedCalculations();
         world->GetSubsystem<LightManager>()->Process();
     }
-    if (world->GetSubsystem<TreeGenerator>()) {
-        world->GetSubsystem<TreeGenerator>()->Process();
-    }
     if (world->GetSubsystem<DebugHud>()) {
         world->GetSubsystem<DebugHud>()->SetAppStats("Chunks Loaded", world->chunks_.Size());
     }
@@ -67,6 +71,31 @@ void UpdateChunkState(const WorkItem* item, unsigned threadIndex)
     }
 
     Sort(chunks.Begin(), chunks.End(), CompareChunks);
+
+    // Released chunks can't be recycled before their edits are written, so they are saved first
+    for (auto it = world->savingChunks_.Begin(); it != world->savingChunks_.End() && savePerFrame < 1; ++it) {
+        if ((*it)->ShouldSave() && world->GetSubsystem<LightManager>()->IsIdle()) {
+            (*it)->Save();
+            savePerFrame++;
+        }
+    }
+
+    auto profiler = world->GetSubsystem<VoxelProfiler>();
+    if (profiler) {
+        int depths[VS_COUNT] = {0};
+        for (auto it = chunks.Begin(); it != chunks.End(); ++it) {
+            depths[VS_GENERATION] += (*it)->IsLoaded() ? 0 : 1;
+            depths[VS_MESHING] += (*it)->IsGeometryCalculated() ? 0 : 1;
+            depths[VS_UPLOAD] += (*it)->ShouldRender() ? 1 : 0;
+            depths[VS_SAVE] += (*it)->ShouldSave() ? 1 : 0;
+        }
+        depths[VS_SAVE] += world->savingChunks_.Size();
+        profiler->SetQueueDepth(VS_GENERATION, depths[VS_GENERATION]);
+        profiler->SetQueueDepth(VS_MESHING, depths[VS_MESHING]);
+        profiler->SetQueueDepth(VS_UPLOAD, depths[VS_UPLOAD]);
+        profiler->SetQueueDepth(VS_SAVE, depths[VS_SAVE]);
+    }
+
     for (auto it = chunks.Begin(); it != chunks.End(); ++it) {
 
         if (world->reloadAllChunks_) {
@@ -97,7 +126,8 @@ void UpdateChunkState(const WorkItem* item, unsigned threadIndex)
 //            URHO3D_LOGINFO("CalculateGeometry " + (*it).second_->GetPosition().ToString());
         }
 
-        if ((*it)->ShouldSave() && savePerFrame < 1) {
+        // Light is saved with the chunk, so wait until the queued light changes are propagated
+        if ((*it)->ShouldSave() && savePerFrame < 1 && world->GetSubsystem<LightManager>()->IsIdle()) {
             (*it)->Save();
             savePerFrame++;
         }
@@ -117,6 +147,14 @@ VoxelWorld::VoxelWorld(Context* context):
 void VoxelWorld::Init()
 {
     scene_ = GetSubsystem<SceneManager>()->GetActiveScene();
+    headless_ = GetSubsystem<Engine>()->IsHeadless();
+    snapshot_ = new WorldSnapshot(context_);
+    if (GetSubsystem<FileSystem>()->FileExists(WORLD_SNAPSHOT_FILE)) {
+        snapshot_->Open(WORLD_SNAPSHOT_FILE);
+    }
+    if (headless_) {
+        URHO3D_LOGINFO("Voxel world running in headless mode, chunks are not meshed for rendering");
+    }
 
     SubscribeToEvent(E_UPDATE, URHO3D_HANDLER(VoxelWorld, HandleUpdate));
     SubscribeToEvent(E_CHUNK_RECEIVED, URHO3D_HANDLER(VoxelWorld, HandleChunkReceived));
@@ -124,24 +162,98 @@ void VoxelWorld::Init()
 
 #if !defined(__EMSCRIPTEN__)
     SubscribeToEvent(E_NETWORKMESSAGE, URHO3D_HANDLER(VoxelWorld, HandleNetworkMessage));
+    SubscribeToEvent(E_CLIENTDISCONNECTED, URHO3D_HANDLER(VoxelWorld, HandleClientDisconnected));
 #endif
 
     SendEvent(
             E_CONSOLE_COMMAND_ADD,
             ConsoleCommandAdd::P_NAME, "chunk_visible_distance",
             ConsoleCommandAdd::P_EVENT, "#chunk_visible_distance",
-            ConsoleCommandAdd::P_DESCRIPTION, "How far away the generated chunks are visible",
+            ConsoleCommandAdd::P_DESCRIPTION, "How far away the generated chunks are visible [horizontal] [vertical]",
             ConsoleCommandAdd::P_OVERWRITE, true
     );
     SubscribeToEvent("#chunk_visible_distance", [&](StringHash eventType, VariantMap& eventData) {
+        StringVector params = eventData["Parameters"].GetStringVector();
+        if (params.Size() != 2 && params.Size() != 3) {
+            URHO3D_LOGERROR("radius parameter is required!");
+            return;
+        }
+        visibleDistance_ = ToInt(params[1]);
+        if (params.Size() == 3) {
+            verticalDistance_ = ToInt(params[2]);
+        }
+        URHO3D_LOGINFOF("Changing chunk visibility radius to %d, vertical %d", visibleDistance_, verticalDistance_);
+        if (lodDistance_ < visibleDistance_) {
+            lodDistance_ = visibleDistance_;
+        }
+    });
+
+    SendEvent(
+            E_CONSOLE_COMMAND_ADD,
+            ConsoleCommandAdd::P_NAME, "chunk_lod_distance",
+            ConsoleCommandAdd::P_EVENT, "#chunk_lod_distance",
+            ConsoleCommandAdd::P_DESCRIPTION, "How far away the reduced detail chunks are visible",
+            ConsoleCommandAdd::P_OVERWRITE, true
+    );
+    SubscribeToEvent("#chunk_lod_distance", [&](StringHash eventType, VariantMap& eventData) {
         StringVector params = eventData["Parameters"].GetStringVector();
         if (params.Size() != 2) {
             URHO3D_LOGERROR("radius parameter is required!");
             return;
         }
-        int value = ToInt(params[1]);
-        visibleDistance_ = value;
-        URHO3D_LOGINFOF("Changing chunk visibility radius to %d", value);
+        lodDistance_ = Max(ToInt(params[1]), visibleDistance_);
+        URHO3D_LOGINFOF("Changing reduced detail chunk radius to %d", lodDistance_);
+    });
+
+    SendEvent(
+            E_CONSOLE_COMMAND_ADD,
+            ConsoleCommandAdd::P_NAME, "chunk_lod_benchmark",
+            ConsoleCommandAdd::P_EVENT, "#chunk_lod_benchmark",
+            ConsoleCommandAdd::P_DESCRIPTION, "Compare frame time with and without the reduced detail chunks [seconds per configuration]",
+            ConsoleCommandAdd::P_OVERWRITE, true
+    );
+    SubscribeToEvent("#chunk_lod_benchmark", [&](StringHash eventType, VariantMap& eventData) {
+        StringVector params = eventData["Parameters"].GetStringVector();
+        if (params.Size() > 2) {
+            URHO3D_LOGERROR("This command takes only the duration!");
+            return;
+        }
+        if (headless_ || !GetSubsystem<Renderer>()) {
+            URHO3D_LOGERROR("LOD benchmark needs a renderer!");
+            return;
+        }
+        if (lodBenchmarkPhase_ >= 0) {
+            URHO3D_LOGERROR("LOD benchmark is already running!");
+            return;
+        }
+        lodBenchmarkDuration_ = params.Size() == 2 ? Max(ToFloat(params[1]), 1.0f) : 5.0f;
+        lodBenchmarkVisibleDistance_ = visibleDistance_;
+        lodBenchmarkLodDistance_ = lodDistance_;
+        lodBenchmarkPhase_ = 0;
+        lodBenchmarkPhaseApplied_ = false;
+        URHO3D_LOGINFOF("Starting LOD benchmark, %.1f seconds per configuration", lodBenchmarkDuration_);
+    });
+
+    SendEvent(
+            E_CONSOLE_COMMAND_ADD,
+            ConsoleCommandAdd::P_NAME, "chunk_occlusion",
+            ConsoleCommandAdd::P_EVENT, "#chunk_occlusion",
+            ConsoleCommandAdd::P_DESCRIPTION, "Enable or disable hiding chunks which can't be seen through caves [0|1]",
+            ConsoleCommandAdd::P_OVERWRITE, true
+    );
+    SubscribeToEvent("#chunk_occlusion", [&](StringHash eventType, VariantMap& eventData) {
+        StringVector params = eventData["Parameters"].GetStringVector();
+        if (params.Size() != 2) {
+            URHO3D_LOGERROR("This command requires exactly 1 argument!");
+            return;
+        }
+        occlusionCulling_ = ToBool(params[1]);
+        if (occlusionCulling_) {
+            MarkOcclusionDirty();
+        } else {
+            SetAllChunksVisible();
+        }
+        URHO3D_LOGINFOF("Chunk occlusion culling %s", occlusionCulling_ ? "enabled" : "disabled");
     });
 
     SendEvent(
@@ -157,6 +269,11 @@ void VoxelWorld::Init()
             URHO3D_LOGERROR("This command doesn't have any arguments!");
             return;
         }
+        {
+            // Chunk worker may be reading from the mapped file
+            MutexLock lock(mutex_);
+            snapshot_->Close();
+        }
         if(GetSubsystem<FileSystem>()->DirExists("World")) {
             Vector<String> files;
             GetSubsystem<FileSystem>()->ScanDir(files, "World", "", SCAN_FILES, false);
@@ -165,6 +282,73 @@ void VoxelWorld::Init()
                 GetSubsystem<FileSystem>()->Delete("World/" + (*it));
             }
         }
+        dormantChunks_.Clear();
+        dormantMemory_ = 0;
+        {
+            // Released chunks must not write their edits back to the emptied world
+            MutexLock lock(mutex_);
+            savingChunks_.Clear();
+        }
+    });
+
+    SendEvent(
+            E_CONSOLE_COMMAND_ADD,
+            ConsoleCommandAdd::P_NAME, "world_snapshot_save",
+            ConsoleCommandAdd::P_EVENT, "#world_snapshot_save",
+            ConsoleCommandAdd::P_DESCRIPTION, "Save all loaded chunks to read-only world snapshot [filename]",
+            ConsoleCommandAdd::P_OVERWRITE, true
+    );
+    SubscribeToEvent("#world_snapshot_save", [&](StringHash eventType, VariantMap& eventData) {
+        StringVector params = eventData["Parameters"].GetStringVector();
+        if (params.Size() > 2) {
+            URHO3D_LOGERROR("This command accepts only the filename argument!");
+            return;
+        }
+        SaveSnapshot(params.Size() == 2 ? params[1] : String(WORLD_SNAPSHOT_FILE));
+    });
+
+    SendEvent(
+            E_CONSOLE_COMMAND_ADD,
+            ConsoleCommandAdd::P_NAME, "chunk_rerender",
+            ConsoleCommandAdd::P_EVENT, "#chunk_rerender",
+            ConsoleCommandAdd::P_DESCRIPTION, "Rerender all chunks",
+            ConsoleCommandAdd::P_OVERWRITE, true
+    );
+    SubscribeToEvent("#chunk_rerender", [&](StringHash eventType, VariantMap& eventData) {
+        StringVector params = eventData["Parameters"].GetStringVector();
+        if (params.Size() != 1) {
+            URHO3D_LOGERROR("This command doesn't have any arguments!");
+            return;
+        }
+        for (auto it = chunks_.Begin(); it != chunks_.End(); ++it) {
+            if ((*it).second_) {
+                (*it).second_->MarkForGeometryCalculation();
+            }
+        }
+    });
+
+    SendEvent(
+            E_CONSOLE_COMMAND_ADD,
+            ConsoleCommandAdd::P_NAME, "chunk_memory_budget",
+            ConsoleCommandAdd::P_EVENT, "#chunk_memory_budget",
+            ConsoleCommandAdd::P_DESCRIPTION, "Memory limit in MB for active and dormant chunks",
+            ConsoleCommandAdd::P_OVERWRITE, true
+    );
+    SubscribeToEvent("#chunk_memory_budget", [&](StringHash eventType, VariantMap& eventData) {
+        StringVector params = eventData["Parameters"].GetStringVector();
+        if (params.Size() != 2) {
+            URHO3D_LOGERROR("Memory budget parameter is required!");
+            return;
+        }
+        int value = ToInt(params[1]);
+        if (value <= 0 || value > 4095) {
+            URHO3D_LOGERROR("Memory budget must be between 1 and 4095 MB!");
+            return;
+        }
+        memoryBudget_ = static_cast<unsigned>(value) * 1024 * 1024;
+        UpdateActiveMemory();
+        EvictChunks();
+        URHO3D_LOGINFOF("Changing chunk memory budget to %d MB", value);
     });
 
     SendEvent(
@@ -182,6 +366,30 @@ void VoxelWorld::Init()
         }
        SetSunlight(ToFloat(params[1]));
     });
+
+#if !defined(__EMSCRIPTEN__)
+    SendEvent(
+            E_CONSOLE_COMMAND_ADD,
+            ConsoleCommandAdd::P_NAME, "chunk_stream_bandwidth",
+            ConsoleCommandAdd::P_EVENT, "#chunk_stream_bandwidth",
+            ConsoleCommandAdd::P_DESCRIPTION, "Max chunk upload speed per client in KB/s",
+            ConsoleCommandAdd::P_OVERWRITE, true
+    );
+    SubscribeToEvent("#chunk_stream_bandwidth", [&](StringHash eventType, VariantMap& eventData) {
+        StringVector params = eventData["Parameters"].GetStringVector();
+        if (params.Size() != 2) {
+            URHO3D_LOGERROR("Bandwidth parameter is required!");
+            return;
+        }
+        int value = ToInt(params[1]);
+        if (value <= 0) {
+            URHO3D_LOGERROR("Bandwidth must be greater than 0!");
+            return;
+        }
+        streamBytesPerSecond_ = value * 1024;
+        URHO3D_LOGINFOF("Changing chunk stream bandwidth to %d KB/s", value);
+    });
+#endif
 }
 
 void VoxelWorld::RegisterObject(Context* context)
@@ -206,6 +414,8 @@ void VoxelWorld::RemoveObserver(SharedPtr<Node> observer)
 
 void VoxelWorld::HandleUpdate(StringHash eventType, VariantMap& eventData)
 {
+    using namespace Update;
+    float timeStep = eventData[P_TIMESTEP].GetFloat();
     int loadedChunkCounter = 0;
     if (!removeBlocks_.Empty()) {
         auto chunk = GetChunkByPosition(removeBlocks_.Front());
@@ -221,18 +431,360 @@ void VoxelWorld::HandleUpdate(StringHash eventType, VariantMap& eventData)
     }
 
     UpdateChunks();
+    UpdateChunkPoolStats();
+
+#if !defined(__EMSCRIPTEN__)
+    UpdateChunkStreaming(timeStep);
+#endif
 
+    UpdateChunkTicker();
+
+    if (headless_) {
+        return;
+    }
+
+    UpdateMorphingChunks(timeStep);
+    UpdateOcclusionCulling();
     SetSunlight(Sin(GetSubsystem<Time>()->GetElapsedTime() * 10.0f) * 0.5f + 0.5f);
 }
 
 Chunk* VoxelWorld::CreateChunk(const Vector3& position)
 {
     String id = GetChunkIdentificator(position);
-    chunks_[id] = new Chunk(context_);
-    chunks_[id]->Init(scene_, position);
+    for (auto it = savingChunks_.Begin(); it != savingChunks_.End(); ++it) {
+        if ((*it)->GetPosition() == position) {
+            // Chunk came back into range before its edits were written, it still has all of its data
+            chunks_[id] = *it;
+            savingChunks_.Erase(it);
+            chunks_[id]->SetOcclusionVisible(true);
+            return chunks_[id].Get();
+        }
+    }
+    if (!chunkPool_.Empty()) {
+        chunks_[id] = chunkPool_.Back();
+        chunkPool_.Pop();
+        chunks_[id]->Reuse(position);
+        chunksRecycled_++;
+    } else {
+        chunks_[id] = new Chunk(context_);
+        chunks_[id]->Init(scene_, position);
+        chunksAllocated_++;
+    }
+    // New chunk has to announce itself once it's loaded
+    tickingChunks_.Push(WeakPtr<Chunk>(chunks_[id]));
+
+    auto dormant = dormantChunks_.Find(position);
+    if (dormant != dormantChunks_.End()) {
+        if (chunks_[id]->LoadCompressed((*dormant).second_)) {
+            dormantHits_++;
+        }
+        dormantMemory_ -= (*dormant).second_.Size();
+        dormantChunks_.Erase(dormant);
+    }
     return chunks_[id].Get();
 }
 
+void VoxelWorld::ReleaseChunk(SharedPtr<Chunk> chunk)
+{
+    if (!chunk) {
+        return;
+    }
+    tickingChunks_.RemoveSwap(WeakPtr<Chunk>(chunk));
+    if (chunk->ShouldSave()) {
+        // Released chunk loses its block data, it waits hidden until the chunk worker writes the edits
+        chunk->SetOcclusionVisible(false);
+        savingChunks_.Push(chunk);
+        return;
+    }
+    RecycleChunk(chunk);
+}
+
+void VoxelWorld::RecycleChunk(Chunk* chunk)
+{
+    StoreDormantChunk(chunk);
+    if (chunkPool_.Size() >= maxPooledChunks_) {
+        // Pool is full, chunk is destroyed together with the last reference
+        return;
+    }
+    chunk->Release();
+    chunkPool_.Push(chunk);
+}
+
+void VoxelWorld::UpdateChunkTicker()
+{
+    // Only chunks which still wait for something are visited, loaded and announced chunks cost nothing
+    for (unsigned i = 0; i < tickingChunks_.Size();) {
+        Chunk* chunk = tickingChunks_[i];
+        if (!chunk) {
+            tickingChunks_.EraseSwap(i);
+            continue;
+        }
+        if (chunk->IsRequestedFromServer() && !chunk->IsLoaded() && chunk->GetServerRequestAge() > CHUNK_REQUEST_TIMEOUT) {
+            chunk->RetryServerRequest();
+        }
+        if (chunk->NotifyGenerated()) {
+            tickingChunks_.EraseSwap(i);
+            continue;
+        }
+        i++;
+    }
+
+    if (GetSubsystem<DebugHud>()) {
+        GetSubsystem<DebugHud>()->SetAppStats("Ticking chunks", tickingChunks_.Size());
+        GetSubsystem<DebugHud>()->SetAppStats("Morphing chunks", morphingChunks_.Size());
+    }
+}
+
+bool VoxelWorld::SaveSnapshot(const String& filename)
+{
+    // Chunk worker must not touch the chunks or the mapped file while it's replaced
+    MutexLock lock(mutex_);
+
+    HashMap<Vector3, PODVector<unsigned char>> blobs;
+    for (auto it = chunks_.Begin(); it != chunks_.End(); ++it) {
+        if ((*it).second_ && (*it).second_->IsLoaded() && !(*it).second_->IsFarData()) {
+            (*it).second_->Compress(blobs[(*it).second_->GetPosition()]);
+        }
+    }
+    for (auto it = dormantChunks_.Begin(); it != dormantChunks_.End(); ++it) {
+        if (!blobs.Contains((*it).first_)) {
+            blobs[(*it).first_] = (*it).second_;
+        }
+    }
+    // Headless servers don't calculate light, clients will do it when the chunks are loaded
+    bool hasLight = !headless_ && (!snapshot_->IsOpen() || snapshot_->HasLight());
+    snapshot_->CollectChunks(blobs);
+    // Mapped file can't be overwritten while it's open
+    snapshot_->Close();
+
+    if(!GetSubsystem<FileSystem>()->DirExists("World")) {
+        GetSubsystem<FileSystem>()->CreateDir("World");
+    }
+    bool saved = snapshot_->Save(filename, blobs, hasLight);
+    if (GetSubsystem<FileSystem>()->FileExists(WORLD_SNAPSHOT_FILE)) {
+        snapshot_->Open(WORLD_SNAPSHOT_FILE);
+    }
+    return saved;
+}
+
+void VoxelWorld::StoreDormantChunk(Chunk* chunk)
+{
+    // Far data lacks caves and trees, it would be mistaken for the full chunk
+    if (!chunk->IsLoaded() || chunk->IsFarData()) {
+        return;
+    }
+#if !defined(__EMSCRIPTEN__)
+    if (GetSubsystem<Network>()->GetServerConnection()) {
+        // Server owns the chunk data, client always asks for the latest version
+        return;
+    }
+#endif
+    const Vector3& position = chunk->GetPosition();
+    auto it = dormantChunks_.Find(position);
+    if (it != dormantChunks_.End()) {
+        dormantMemory_ -= (*it).second_.Size();
+        dormantChunks_.Erase(it);
+    }
+    PODVector<unsigned char>& buffer = dormantChunks_[position];
+    chunk->Compress(buffer);
+    dormantMemory_ += buffer.Size();
+
+    EvictChunks();
+}
+
+void VoxelWorld::UpdateActiveMemory()
+{
+    activeMemory_ = 0;
+    for (auto it = chunks_.Begin(); it != chunks_.End(); ++it) {
+        if ((*it).second_) {
+            activeMemory_ += (*it).second_->GetMemoryUsage();
+        }
+    }
+    for (auto it = savingChunks_.Begin(); it != savingChunks_.End(); ++it) {
+        activeMemory_ += (*it)->GetMemoryUsage();
+    }
+    for (auto it = chunkPool_.Begin(); it != chunkPool_.End(); ++it) {
+        activeMemory_ += (*it)->GetMemoryUsage();
+    }
+}
+
+void VoxelWorld::EvictChunks()
+{
+    // Chunks in range are needed by the observers, memory is taken back from the dormant tier first and then from the pool
+    while (activeMemory_ + dormantMemory_ > memoryBudget_ && !dormantChunks_.Empty()) {
+        auto it = dormantChunks_.Begin();
+        dormantMemory_ -= (*it).second_.Size();
+        dormantChunks_.Erase(it);
+    }
+    while (activeMemory_ > memoryBudget_ && !chunkPool_.Empty()) {
+        activeMemory_ -= chunkPool_.Back()->GetMemoryUsage();
+        chunkPool_.Pop();
+    }
+
+    if (activeMemory_ > memoryBudget_) {
+        if (!memoryBudgetExceeded_) {
+            URHO3D_LOGWARNINGF("Chunks in view range use %u MB, over the %u MB memory budget, lower the view distance",
+                               activeMemory_ / 1024 / 1024, memoryBudget_ / 1024 / 1024);
+        }
+        memoryBudgetExceeded_ = true;
+    } else {
+        memoryBudgetExceeded_ = false;
+    }
+}
+
+ChunkRegion* VoxelWorld::GetRegion(const Vector3& chunkPosition)
+{
+    Vector3 regionPosition(
+            Floor(chunkPosition.x_ / (SIZE_X * REGION_SIZE)) * SIZE_X * REGION_SIZE,
+            Floor(chunkPosition.y_ / (SIZE_Y * REGION_SIZE)) * SIZE_Y * REGION_SIZE,
+            Floor(chunkPosition.z_ / (SIZE_Z * REGION_SIZE)) * SIZE_Z * REGION_SIZE
+    );
+    auto it = regions_.Find(regionPosition);
+    if (it != regions_.End()) {
+        return (*it).second_;
+    }
+
+    SharedPtr<ChunkRegion> region(new ChunkRegion(context_));
+    region->Init(scene_, regionPosition);
+    regions_[regionPosition] = region;
+    return region;
+}
+
+void VoxelWorld::RemoveEmptyRegions()
+{
+    for (auto it = regions_.Begin(); it != regions_.End();) {
+        if ((*it).second_->IsEmpty()) {
+            it = regions_.Erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
+
+void VoxelWorld::UpdateOcclusionCulling()
+{
+    if (!occlusionCulling_ || occlusionTimer_.GetMSec(false) < 100) {
+        return;
+    }
+
+    Vector<Vector3> cameraChunks;
+    auto renderer = GetSubsystem<Renderer>();
+    if (renderer) {
+        for (unsigned i = 0; i < renderer->GetNumViewports(); i++) {
+            Viewport* viewport = renderer->GetViewport(i);
+            if (viewport && viewport->GetCamera()) {
+                cameraChunks.Push(GetWorldToChunkPosition(viewport->GetCamera()->GetNode()->GetWorldPosition()));
+            }
+        }
+    }
+    if (!occlusionDirty_ && cameraChunks == occlusionCameraChunks_) {
+        return;
+    }
+    occlusionTimer_.Reset();
+    occlusionDirty_ = false;
+    occlusionCameraChunks_ = cameraChunks;
+
+    struct VisibilityNode {
+        Chunk* chunk_;
+        // Face through which the flood fill entered the chunk, -1 for the camera chunk
+        int entrySide_;
+        // Directions already travelled, the fill never turns back towards the camera
+        unsigned char directions_;
+    };
+
+    HashSet<Chunk*> visible;
+    PODVector<VisibilityNode> queue;
+    for (auto it = cameraChunks.Begin(); it != cameraChunks.End(); ++it) {
+        Chunk* chunk = GetChunkByPosition(*it);
+        if (!chunk) {
+            // Camera is outside of the loaded area, nothing can be culled
+            SetAllChunksVisible();
+            return;
+        }
+        if (!visible.Contains(chunk)) {
+            visible.Insert(chunk);
+            queue.Push(VisibilityNode{chunk, -1, 0});
+        }
+    }
+
+    for (unsigned i = 0; i < queue.Size(); i++) {
+        VisibilityNode node = queue[i];
+        for (int side = 0; side < 6; side++) {
+            // TOP/BOTTOM, LEFT/RIGHT and FRONT/BACK are next to each other in BlockSide
+            int opposite = side ^ 1;
+            if (node.directions_ & (1 << opposite)) {
+                continue;
+            }
+            if (node.entrySide_ >= 0 && !node.chunk_->IsFaceConnected(static_cast<BlockSide>(node.entrySide_), static_cast<BlockSide>(side))) {
+                continue;
+            }
+            Chunk* neighbor = node.chunk_->GetNeighbor(static_cast<BlockSide>(side));
+            if (!neighbor || visible.Contains(neighbor)) {
+                continue;
+            }
+            visible.Insert(neighbor);
+            queue.Push(VisibilityNode{neighbor, opposite, static_cast<unsigned char>(node.directions_ | (1 << side))});
+        }
+    }
+
+    int culledChunks = 0;
+    for (auto it = chunks_.Begin(); it != chunks_.End(); ++it) {
+        if ((*it).second_) {
+            bool isVisible = visible.Contains((*it).second_.Get());
+            (*it).second_->SetOcclusionVisible(isVisible);
+            if (!isVisible) {
+                culledChunks++;
+            }
+        }
+    }
+
+    if (GetSubsystem<DebugHud>()) {
+        int culledDrawCalls = 0;
+        for (auto it = regions_.Begin(); it != regions_.End(); ++it) {
+            culledDrawCalls += (*it).second_->GetCulledDrawCalls();
+        }
+        GetSubsystem<DebugHud>()->SetAppStats("Occlusion culled chunks", culledChunks);
+        GetSubsystem<DebugHud>()->SetAppStats("Occlusion culled draw calls", culledDrawCalls);
+    }
+}
+
+void VoxelWorld::SetAllChunksVisible()
+{
+    for (auto it = chunks_.Begin(); it != chunks_.End(); ++it) {
+        if ((*it).second_) {
+            (*it).second_->SetOcclusionVisible(true);
+        }
+    }
+    if (GetSubsystem<DebugHud>()) {
+        GetSubsystem<DebugHud>()->SetAppStats("Occlusion culled chunks", 0);
+        GetSubsystem<DebugHud>()->SetAppStats("Occlusion culled draw calls", 0);
+    }
+}
+
+void VoxelWorld::UpdateChunkPoolStats()
+{
+    if (chunkPoolStatsTimer_.GetMSec(false) < 1000) {
+        return;
+    }
+    chunkPoolStatsTimer_.Reset();
+    UpdateActiveMemory();
+    EvictChunks();
+    if (GetSubsystem<DebugHud>()) {
+        GetSubsystem<DebugHud>()->SetAppStats("Chunk allocations/s", chunksAllocated_);
+        GetSubsystem<DebugHud>()->SetAppStats("Chunks recycled/s", chunksRecycled_);
+        GetSubsystem<DebugHud>()->SetAppStats("Pooled chunks", chunkPool_.Size());
+        GetSubsystem<DebugHud>()->SetAppStats("Released chunks waiting for save", savingChunks_.Size());
+        GetSubsystem<DebugHud>()->SetAppStats("Chunk regions", regions_.Size());
+        GetSubsystem<DebugHud>()->SetAppStats("Dormant chunks", dormantChunks_.Size());
+        GetSubsystem<DebugHud>()->SetAppStats("Active chunk memory KB", activeMemory_ / 1024);
+        GetSubsystem<DebugHud>()->SetAppStats("Dormant chunk memory KB", dormantMemory_ / 1024);
+        GetSubsystem<DebugHud>()->SetAppStats("Dormant chunk hits/s", dormantHits_);
+    }
+    chunksAllocated_ = 0;
+    chunksRecycled_ = 0;
+    dormantHits_ = 0;
+}
+
 Vector3 VoxelWorld::GetNodeToChunkPosition(Node* node)
 {
     Vector3 position = node->GetWorldPosition();
@@ -353,44 +905,56 @@ void VoxelWorld::RemoveBlockAtPosition(const Vector3& position)
 void VoxelWorld::UpdateChunks()
 {
     if (!updateWorkItem_) {
-        if (!chunksToLoad_.Empty()) {
-            for (auto it = chunks_.Begin(); it != chunks_.End(); ++it) {
-                if ((*it).second_) {
-                    (*it).second_->MarkForDeletion(true);
-                    (*it).second_->SetDistance(-1);
-                }
-            }
-        }
+        // Worker is done, values it produced can be read safely
+        PublishFullViewMetric();
 
+#if !defined(__EMSCRIPTEN__)
+        ApplyServerChunks();
+#endif
+
+        // Only the difference between the previous and the new load set is applied
         for (auto it = chunksToLoad_.Begin(); it != chunksToLoad_.End(); ++it) {
             Vector3 position = (*it).first_;
             String id = GetChunkIdentificator(position);
             auto chunkIterator = chunks_.Find(id);
             if (chunkIterator != chunks_.End()) {
-                (*chunkIterator).second_->MarkForDeletion(false);
-                (*chunkIterator).second_->SetDistance((*it).second_);
+                (*chunkIterator).second_->SetDistance((*it).second_.distance_);
+                (*chunkIterator).second_->SetFar((*it).second_.far_);
             } else {
                 auto chunk = CreateChunk(position);
-                chunk->SetDistance((*it).second_);
+                chunk->SetDistance((*it).second_.distance_);
+                chunk->SetFar((*it).second_.far_);
             }
         }
 
+        if (!chunksToLoad_.Empty() || !chunksToUnload_.Empty()) {
+            MarkOcclusionDirty();
+        }
         chunksToLoad_.Clear();
 
         MutexLock lock(mutex_);
-        for (auto it = chunks_.Begin(); it != chunks_.End(); ++it) {
-            if ((*it).second_) {
-                if ((*it).second_->IsMarkedForDeletion()) {
-                    int distance = (*it).second_->GetDistance();
-//                        URHO3D_LOGINFOF("Deleting chunk distance=%d ", distance);
-                    it = chunks_.Erase(it);
-                }
-                if (chunks_.End() == it) {
-                    break;
-                }
+        for (auto it = chunksToUnload_.Begin(); it != chunksToUnload_.End(); ++it) {
+            auto chunkIterator = chunks_.Find(GetChunkIdentificator(*it));
+            if (chunkIterator != chunks_.End()) {
+                ReleaseChunk((*chunkIterator).second_);
+                chunks_.Erase(chunkIterator);
             }
         }
+        chunksToUnload_.Clear();
 
+        for (auto it = savingChunks_.Begin(); it != savingChunks_.End();) {
+            if ((*it)->ShouldSave()) {
+                ++it;
+                continue;
+            }
+            RecycleChunk(*it);
+            it = savingChunks_.Erase(it);
+        }
+
+        RemoveEmptyRegions();
+        UpdateLodBenchmark();
+
+        CaptureObserverViews();
 
         WorkQueue *workQueue = GetSubsystem<WorkQueue>();
         updateWorkItem_ = workQueue->GetFreeItem();
@@ -403,18 +967,25 @@ void VoxelWorld::UpdateChunks()
         workQueue->AddWorkItem(updateWorkItem_);
     }
 
+    // Most important chunks are uploaded first, lower priority value means closer or in view.
+    // Priorities are copied because the worker may update them while sorting
+    renderQueue_.Clear();
+    for (auto it = chunks_.Begin(); it != chunks_.End(); ++it) {
+        if ((*it).second_ && (*it).second_->ShouldRender()) {
+            renderQueue_.Push(MakePair((*it).second_->GetPriority(), (*it).second_.Get()));
+        }
+    }
+    Sort(renderQueue_.Begin(), renderQueue_.End());
+
     int renderedChunkCount = 0;
     int renderedChunkLimit = 1;
-    for (auto it = chunks_.Begin(); it != chunks_.End(); ++it) {
-        if ((*it).second_->ShouldRender()) {
-            bool rendered = (*it).second_->Render();
-//            URHO3D_LOGINFO("Rendering chunk " + (*it).second_->GetPosition().ToString());
-            if (rendered) {
-                renderedChunkCount++;
-            }
-            if (renderedChunkCount >= renderedChunkLimit) {
-                break;
-            }
+    for (auto it = renderQueue_.Begin(); it != renderQueue_.End(); ++it) {
+        bool rendered = (*it).second_->Render();
+        if (rendered) {
+            renderedChunkCount++;
+        }
+        if (renderedChunkCount >= renderedChunkLimit) {
+            break;
         }
     }
 }
@@ -468,89 +1039,326 @@ void VoxelWorld::HandleWorkItemFinished(StringHash eventType, VariantMap& eventD
 
 const String VoxelWorld::GetBlockName(BlockType type)
 {
-    switch (type) {
-        case BT_AIR:
-            return "BT_AIR";
-        case BT_STONE:
-            return "BT_STONE";
-        case BT_DIRT:
-            return "BT_DIRT";
-        case BT_SAND:
-            return "BT_SAND";
-        case BT_COAL:
-            return "BT_COAL";
-        case BT_TORCH:
-            return "BT_TORCH";
-        case BT_WOOD:
-            return "BT_WOOD";
-        case BT_TREE_LEAVES:
-            return "BT_TREE_LEAVES";
-        case BT_WATER:
-            return "BT_WATER";
-        default:
-            return "BT_NONE";
+    const String& name = GetSubsystem<BlockRegistry>()->GetName(type);
+    if (name.Empty()) {
+        return "BT_NONE";
     }
+    return name;
 }
 
 bool VoxelWorld::ProcessQueue()
 {
+    // Load order follows the observers continuously
+    UpdateChunkPriorities();
+    UpdateFullViewMetric();
+
+#if !defined(__EMSCRIPTEN__)
+    // Clients don't decide which chunks are loaded, server pushes them
+    if (GetSubsystem<Network>()->GetServerConnection()) {
+        return false;
+    }
+#endif
+
     if (updateTimer_.GetMSec(false) < 100) {
         return false;
     }
     updateTimer_.Reset();
 
-    bool haveChanges = false;
+    if (observerViews_.Empty()) {
+        // Observer is being replaced, loaded chunks are kept until it's back
+        return false;
+    }
 
-    for (auto it = observers_.Begin(); it != observers_.End(); ++it) {
-        Vector3 currentChunkPosition = GetWorldToChunkPosition((*it)->GetWorldPosition());
-        if (!(*it)->GetVar("ChunkPosition").IsEmpty()) {
-            Vector3 lastChunkPosition = (*it)->GetVar("ChunkPosition").GetVector3();
-            if (lastChunkPosition.x_ != currentChunkPosition.x_ || lastChunkPosition.y_ != currentChunkPosition.y_ ||
-                lastChunkPosition.z_ != currentChunkPosition.z_) {
-                haveChanges = true;
+    HashMap<Vector3, ChunkLoadRequest> loadSet;
+    for (auto view = observerViews_.Begin(); view != observerViews_.End(); ++view) {
+        Vector3 center = GetWorldToChunkPosition((*view).position_);
+        for (int x = -lodDistance_; x <= lodDistance_; x++) {
+            for (int y = -verticalDistance_; y <= verticalDistance_; y++) {
+                for (int z = -lodDistance_; z <= lodDistance_; z++) {
+                    Vector3 position = center + Vector3(x * SIZE_X, y * SIZE_Y, z * SIZE_Z);
+                    // Full chunks only within visibleDistance_, the ring up to lodDistance_ gets reduced far data
+                    bool far = !IsChunkInRange(center, position);
+                    if (far && (headless_ || !IsChunkInLodRange(center, position))) {
+                        continue;
+                    }
+                    AddLoadRequest(loadSet, center, position, far);
+                }
             }
-        } else {
+        }
+
+        // Full chunks around the position the observer is heading to are loaded before it gets there
+        Vector3 lookAheadCenter = GetWorldToChunkPosition((*view).lookAheadPosition_);
+        if (lookAheadCenter != center) {
+            for (int x = -visibleDistance_; x <= visibleDistance_; x++) {
+                for (int y = -verticalDistance_; y <= verticalDistance_; y++) {
+                    for (int z = -visibleDistance_; z <= visibleDistance_; z++) {
+                        Vector3 position = lookAheadCenter + Vector3(x * SIZE_X, y * SIZE_Y, z * SIZE_Z);
+                        if (IsChunkInRange(lookAheadCenter, position)) {
+                            AddLoadRequest(loadSet, center, position, false);
+                        }
+                    }
+                }
+            }
+        }
+
+        // Chunks in view just past the full range get full data too, turning the camera doesn't wait for them
+        const Vector3 chunkSize(SIZE_X, SIZE_Y, SIZE_Z);
+        int prefetchDistance = visibleDistance_ + FRUSTUM_PREFETCH_DISTANCE;
+        for (int x = -prefetchDistance; x <= prefetchDistance && !viewFrustums_.Empty(); x++) {
+            for (int y = -verticalDistance_; y <= verticalDistance_; y++) {
+                for (int z = -prefetchDistance; z <= prefetchDistance; z++) {
+                    Vector3 position = center + Vector3(x * SIZE_X, y * SIZE_Y, z * SIZE_Z);
+                    if (IsChunkInRange(center, position) || !IsChunkInRange(center, position, FRUSTUM_PREFETCH_DISTANCE)) {
+                        continue;
+                    }
+                    BoundingBox box(position, position + chunkSize);
+                    for (auto frustum = viewFrustums_.Begin(); frustum != viewFrustums_.End(); ++frustum) {
+                        if ((*frustum).IsInsideFast(box) != OUTSIDE) {
+                            AddLoadRequest(loadSet, center, position, false);
+                            break;
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    // Hand only the changes over to the main thread
+    bool haveChanges = false;
+    for (auto it = loadSet.Begin(); it != loadSet.End(); ++it) {
+        auto previous = loadSet_.Find((*it).first_);
+        if (previous == loadSet_.End() || (*previous).second_.distance_ != (*it).second_.distance_
+            || (*previous).second_.far_ != (*it).second_.far_) {
+            chunksToLoad_[(*it).first_] = (*it).second_;
+            chunksToUnload_.Remove((*it).first_);
             haveChanges = true;
         }
-        if (haveChanges) {
-            (*it)->SetVar("ChunkPosition", currentChunkPosition);
-            URHO3D_LOGINFOF("Player %s moved to chunk %dx%dx%d", (*it)->GetName().CString(), (int)currentChunkPosition.x_, (int)currentChunkPosition.y_, (int)currentChunkPosition.z_);
+    }
+    for (auto it = loadSet_.Begin(); it != loadSet_.End(); ++it) {
+        if (!loadSet.Contains((*it).first_)) {
+            chunksToUnload_.Push((*it).first_);
+            chunksToLoad_.Erase((*it).first_);
+            haveChanges = true;
         }
     }
+    loadSet_.Swap(loadSet);
 
-    if (!haveChanges) {
-        return false;
+    if (haveChanges && !fullViewPending_) {
+        fullViewPending_ = true;
+        fullViewTimer_.Reset();
     }
 
+    return haveChanges;
+}
+
+void VoxelWorld::AddLoadRequest(HashMap<Vector3, ChunkLoadRequest>& loadSet, const Vector3& center, const Vector3& position, bool far)
+{
+    Vector3 offset = position - center;
+    int distance = RoundToInt(Vector3(offset.x_ / SIZE_X, offset.y_ / SIZE_Y, offset.z_ / SIZE_Z).Length());
+    auto it = loadSet.Find(position);
+    if (it == loadSet.End()) {
+        loadSet[position] = ChunkLoadRequest{distance, far};
+    } else {
+        (*it).second_.distance_ = Min((*it).second_.distance_, distance);
+        (*it).second_.far_ = (*it).second_.far_ && far;
+    }
+}
+
+void VoxelWorld::CaptureObserverViews()
+{
+    observerViews_.Clear();
     for (auto it = observers_.Begin(); it != observers_.End(); ++it) {
-        AddChunkToQueue(((*it)->GetWorldPosition()));
+        if (!(*it)) {
+            continue;
+        }
+        ObserverView view;
+        view.position_ = (*it)->GetWorldPosition();
+        view.lookAheadPosition_ = view.position_;
+        auto body = (*it)->GetComponent<RigidBody>();
+        if (body) {
+            view.lookAheadPosition_ += body->GetLinearVelocity() * lookAheadTime_;
+        }
+        observerViews_.Push(view);
     }
 
-    while (!chunkBfsQueue_.empty()) {
-        ChunkNode& node = chunkBfsQueue_.front();
-        int distance = node.distance_ + 1;
-        chunkBfsQueue_.pop();
-        if (distance <= visibleDistance_) {
-            AddChunkToQueue(node.position_ + Vector3::LEFT * SIZE_X, distance);
-            AddChunkToQueue(node.position_ + Vector3::RIGHT * SIZE_X, distance);
-            AddChunkToQueue(node.position_ + Vector3::FORWARD * SIZE_Z, distance);
-            AddChunkToQueue(node.position_ + Vector3::BACK * SIZE_Z, distance);
-            AddChunkToQueue(node.position_ + Vector3::UP * SIZE_Y, distance);
-            AddChunkToQueue(node.position_ + Vector3::DOWN * SIZE_Y, distance);
+    viewFrustums_.Clear();
+    auto renderer = GetSubsystem<Renderer>();
+    if (renderer) {
+        for (unsigned i = 0; i < renderer->GetNumViewports(); i++) {
+            Viewport* viewport = renderer->GetViewport(i);
+            if (viewport && viewport->GetCamera()) {
+                viewFrustums_.Push(viewport->GetCamera()->GetFrustum());
+            }
         }
     }
+}
 
+void VoxelWorld::UpdateChunkPriorities()
+{
+    const Vector3 chunkSize(SIZE_X, SIZE_Y, SIZE_Z);
+    for (auto it = chunks_.Begin(); it != chunks_.End(); ++it) {
+        Chunk* chunk = (*it).second_;
+        if (!chunk) {
+            continue;
+        }
+        Vector3 center = chunk->GetPosition() + chunkSize * 0.5f;
+        float distance = M_INFINITY;
+        float observerDistance = M_INFINITY;
+        for (auto view = observerViews_.Begin(); view != observerViews_.End(); ++view) {
+            observerDistance = Min(observerDistance, (center - (*view).position_).Length());
+            distance = Min(distance, (center - (*view).lookAheadPosition_).Length());
+        }
+        distance = Min(distance, observerDistance) / SIZE_X;
+        observerDistance /= SIZE_X;
+
+        // Hysteresis of half a chunk so that the detail level doesn't flip back and forth on the border
+        int lod = GetLodLevel(observerDistance);
+        if (lod != chunk->GetLod()) {
+            float hysteresis = lod > chunk->GetLod() ? -0.5f : 0.5f;
+            if (GetLodLevel(observerDistance + hysteresis) != chunk->GetLod()) {
+                chunk->SetLod(lod);
+            }
+        }
+
+        // Chunks which are visible on any of the cameras are processed first
+        BoundingBox box(chunk->GetPosition(), chunk->GetPosition() + chunkSize);
+        for (auto frustum = viewFrustums_.Begin(); frustum != viewFrustums_.End(); ++frustum) {
+            if ((*frustum).IsInsideFast(box) != OUTSIDE) {
+                distance *= 0.5f;
+                break;
+            }
+        }
+        chunk->SetPriority(distance);
+    }
+}
+
+bool VoxelWorld::AreChunksReady()
+{
+    for (auto it = chunks_.Begin(); it != chunks_.End(); ++it) {
+        Chunk* chunk = (*it).second_;
+        if (chunk && (!chunk->IsLoaded() || !chunk->IsGeometryCalculated() || chunk->ShouldRender())) {
+            return false;
+        }
+    }
     return true;
 }
 
-void VoxelWorld::AddChunkToQueue(Vector3 position, int distance)
+void VoxelWorld::UpdateFullViewMetric()
+{
+    if (!fullViewPending_ || !AreChunksReady()) {
+        return;
+    }
+
+    fullViewPending_ = false;
+    lastFullViewTime_ = fullViewTimer_.GetMSec(false);
+    fullViewReady_ = true;
+}
+
+void VoxelWorld::PublishFullViewMetric()
+{
+    if (!fullViewReady_) {
+        return;
+    }
+    fullViewReady_ = false;
+    if (GetSubsystem<DebugHud>()) {
+        GetSubsystem<DebugHud>()->SetAppStats("Time to full view", String(lastFullViewTime_) + "ms");
+    }
+    URHO3D_LOGINFOF("All visible chunks ready in %dms", lastFullViewTime_);
+}
+
+void VoxelWorld::UpdateLodBenchmark()
+{
+    if (lodBenchmarkPhase_ < 0 || lodBenchmarkSampling_) {
+        return;
+    }
+
+    if (lodBenchmarkPhase_ >= LOD_BENCHMARK_PHASES) {
+        visibleDistance_ = lodBenchmarkVisibleDistance_;
+        lodDistance_ = lodBenchmarkLodDistance_;
+        lodBenchmarkPhase_ = -1;
+        URHO3D_LOGINFO("LOD benchmark finished");
+        return;
+    }
+
+    if (!lodBenchmarkPhaseApplied_) {
+        // Reduced detail radius is at least twice the full detail radius, that's the view distance the LOD is meant to give
+        int reducedDistance = Max(lodBenchmarkLodDistance_, lodBenchmarkVisibleDistance_ * 2);
+        switch (lodBenchmarkPhase_) {
+            case 0:
+                visibleDistance_ = lodBenchmarkVisibleDistance_;
+                lodDistance_ = lodBenchmarkVisibleDistance_;
+                break;
+            case 1:
+                visibleDistance_ = lodBenchmarkVisibleDistance_;
+                lodDistance_ = reducedDistance;
+                break;
+            default:
+                visibleDistance_ = reducedDistance;
+                lodDistance_ = reducedDistance;
+                break;
+        }
+        lodBenchmarkPhaseApplied_ = true;
+        lodBenchmarkTimer_.Reset();
+        return;
+    }
+
+    // New load set is applied over several passes, readiness only counts once it had time to settle
+    if (lodBenchmarkTimer_.GetMSec(false) < LOD_BENCHMARK_SETTLE_TIME || !AreChunksReady() || !morphingChunks_.Empty()) {
+        return;
+    }
+
+    lodBenchmarkSampling_ = true;
+    lodBenchmarkFrameTime_ = 0;
+    lodBenchmarkFrames_ = 0;
+    lodBenchmarkBatches_ = 0;
+    lodBenchmarkPrimitives_ = 0;
+    lodBenchmarkTimer_.Reset();
+    // Sampling starts in the middle of a frame, its first part is measured from here
+    lodBenchmarkFrameTimer_.Reset();
+    SubscribeToEvent(E_BEGINFRAME, [&](StringHash eventType, VariantMap& eventData) {
+        lodBenchmarkFrameTimer_.Reset();
+    });
+    SubscribeToEvent(E_ENDRENDERING, URHO3D_HANDLER(VoxelWorld, HandleLodBenchmarkFrame));
+}
+
+void VoxelWorld::HandleLodBenchmarkFrame(StringHash eventType, VariantMap& eventData)
 {
-    Vector3 fixedPosition = GetWorldToChunkPosition(position);
-    String id = GetChunkIdentificator(fixedPosition);
-    ChunkNode node(position, distance);
-    if (!chunksToLoad_.Contains(fixedPosition)) {
-        chunksToLoad_[fixedPosition] = distance;
-        chunkBfsQueue_.emplace(node);
+    auto renderer = GetSubsystem<Renderer>();
+    lodBenchmarkFrameTime_ += lodBenchmarkFrameTimer_.GetUSec(false);
+    lodBenchmarkFrames_++;
+    lodBenchmarkBatches_ += renderer->GetNumBatches();
+    lodBenchmarkPrimitives_ += renderer->GetNumPrimitives();
+    if (lodBenchmarkTimer_.GetMSec(false) < lodBenchmarkDuration_ * 1000.0f) {
+        return;
+    }
+
+    UnsubscribeFromEvent(E_BEGINFRAME);
+    UnsubscribeFromEvent(E_ENDRENDERING);
+    URHO3D_LOGINFOF("LOD benchmark full detail radius %d, reduced detail radius %d, %u chunks: %.2f ms per frame, %lld batches, %lld primitives",
+                    visibleDistance_, lodDistance_, chunks_.Size(), lodBenchmarkFrameTime_ / 1000.0f / lodBenchmarkFrames_,
+                    lodBenchmarkBatches_ / lodBenchmarkFrames_, lodBenchmarkPrimitives_ / lodBenchmarkFrames_);
+    lodBenchmarkSampling_ = false;
+    lodBenchmarkPhaseApplied_ = false;
+    lodBenchmarkPhase_++;
+}
+
+void VoxelWorld::AddMorphingChunk(Chunk* chunk)
+{
+    WeakPtr<Chunk> morphingChunk(chunk);
+    if (!morphingChunks_.Contains(morphingChunk)) {
+        morphingChunks_.Push(morphingChunk);
+    }
+}
+
+void VoxelWorld::UpdateMorphingChunks(float timeStep)
+{
+    for (unsigned i = 0; i < morphingChunks_.Size();) {
+        Chunk* chunk = morphingChunks_[i];
+        if (!chunk || !chunk->UpdateMorph(timeStep)) {
+            morphingChunks_.EraseSwap(i);
+            continue;
+        }
+        i++;
     }
 }
 
@@ -602,18 +1410,13 @@ void VoxelWorld::HandleNetworkMessage(StringHash eventType, VariantMap& eventDat
                 if (chunk->IsLoaded()) {
                     auto *sender = static_cast<Connection *>(eventData[P_CONNECTION].GetPtr());
 //                URHO3D_LOGINFO("Client " + sender->ToString() + " requested chunk : " + chunkPosition.ToString());
-
-                    VectorBuffer sendMsg;
-                    sendMsg.WriteVector3(chunk->GetPosition());
-                    for (int x = 0; x < SIZE_X; x++) {
-                        for (int y = 0; y < SIZE_Y; y++) {
-                            for (int z = 0; z < SIZE_Z; z++) {
-                                sendMsg.WriteInt(static_cast<int>(chunk->GetBlockAt(IntVector3(x, y, z))->type));
-                            }
-                        }
+                    unsigned size = SendChunk(chunk, sender);
+                    auto streamIt = streamingClients_.Find(sender);
+                    if (streamIt != streamingClients_.End()) {
+                        // Requested chunks use the same bandwidth budget as pushed ones
+                        (*streamIt).second_.bandwidthTokens_ -= size;
+                        (*streamIt).second_.sentChunks_.Insert(chunk->GetPosition());
                     }
-                    // Broadcast as in-order and reliable
-                    sender->SendMessage(NETWORK_SEND_CHUNK, true, true, sendMsg);
                 } else {
 //                    URHO3D_LOGINFO("Chunk not yet loaded, cannot send it to client " + chunkPosition.ToString());
                 }
@@ -622,17 +1425,15 @@ void VoxelWorld::HandleNetworkMessage(StringHash eventType, VariantMap& eventDat
             }
         }
     } else if (msgID == NETWORK_SEND_CHUNK) {
+        if (!network->IsServerRunning()) {
+            // Chunk list can't be modified while the update work item is running
+            receivedChunks_.Push(eventData[P_DATA].GetBuffer());
+        }
+    } else if (msgID == NETWORK_SEND_CHUNK_UNLOAD) {
         if (!network->IsServerRunning()) {
             const PODVector<unsigned char>& data = eventData[P_DATA].GetBuffer();
-            // Use a MemoryBuffer to read the message data so that there is no unnecessary copying
             MemoryBuffer msg(data);
-            Vector3 chunkPosition = msg.ReadVector3();
-            auto chunk = GetChunkByPosition(chunkPosition);
-            if (chunk) {
-                chunk->ProcessServerResponse(msg);
-            } else {
-                URHO3D_LOGINFO("Requested chunk doesn't exist anymore " + chunkPosition.ToString());
-            }
+            unloadedChunks_.Push(msg.ReadVector3());
         }
     } else if (msgID == NETWORK_REQUEST_CHUNK_HIT) {
         if (network->IsServerRunning()) {
@@ -688,8 +1489,230 @@ void VoxelWorld::HandleNetworkMessage(StringHash eventType, VariantMap& eventDat
         }
     }
 }
+
+void VoxelWorld::HandleClientDisconnected(StringHash eventType, VariantMap& eventData)
+{
+    using namespace ClientDisconnected;
+    auto* connection = static_cast<Connection*>(eventData[P_CONNECTION].GetPtr());
+    RemoveStreamingClient(connection);
+}
+
+void VoxelWorld::AddStreamingClient(Connection* connection, Node* observer)
+{
+    ChunkStreamState& state = streamingClients_[connection];
+    state.observer_ = observer;
+    state.sentChunks_.Clear();
+    state.pendingChunks_.Clear();
+    state.bandwidthTokens_ = 0.0f;
+    // Plan the first batch immediately so the client doesn't wait for the next planning interval
+    PlanChunkStreaming(connection, state);
+    URHO3D_LOGINFO("Streaming voxel world to " + connection->ToString());
+}
+
+void VoxelWorld::RemoveStreamingClient(Connection* connection)
+{
+    streamingClients_.Erase(connection);
+}
+
+void VoxelWorld::UpdateChunkStreaming(float timeStep)
+{
+    if (streamingClients_.Empty() || !GetSubsystem<Network>()->IsServerRunning()) {
+        return;
+    }
+
+    bool replan = streamTimer_.GetMSec(false) >= 100;
+    int pendingChunks = 0;
+    if (replan) {
+        streamTimer_.Reset();
+    }
+
+    for (auto it = streamingClients_.Begin(); it != streamingClients_.End(); ++it) {
+        Connection* connection = (*it).first_;
+        ChunkStreamState& state = (*it).second_;
+        Node* previousObserver = state.observer_;
+        if (!ResolveStreamObserver(connection, state)) {
+            continue;
+        }
+
+        if (replan || state.observer_.Get() != previousObserver) {
+            PlanChunkStreaming(connection, state);
+        }
+
+        // Token bucket, allow up to 1 second worth of burst. The real size of every sent chunk is
+        // subtracted, so a chunk larger than the remaining tokens leaves a debt for the next frames
+        state.bandwidthTokens_ = Min(state.bandwidthTokens_ + streamBytesPerSecond_ * timeStep, (float)streamBytesPerSecond_);
+        while (!state.pendingChunks_.Empty() && state.bandwidthTokens_ > 0.0f) {
+            Vector3 position = state.pendingChunks_.Back().position_;
+            state.pendingChunks_.Pop();
+            String id = GetChunkIdentificator(position);
+            auto chunkIterator = chunks_.Find(id);
+            if (chunkIterator == chunks_.End() || !(*chunkIterator).second_ || !(*chunkIterator).second_->IsLoaded()) {
+                continue;
+            }
+            state.bandwidthTokens_ -= SendChunk((*chunkIterator).second_.Get(), connection);
+            state.sentChunks_.Insert(position);
+        }
+        pendingChunks += state.pendingChunks_.Size();
+    }
+
+    if (GetSubsystem<VoxelProfiler>()) {
+        GetSubsystem<VoxelProfiler>()->SetQueueDepth(VS_NETWORK, pendingChunks);
+    }
+}
+
+bool VoxelWorld::ResolveStreamObserver(Connection* connection, ChunkStreamState& state)
+{
+    if (state.observer_ && state.observer_->GetOwner() == connection) {
+        return true;
+    }
+
+    state.observer_.Reset();
+    if (!scene_) {
+        return false;
+    }
+    const Vector<SharedPtr<Node>>& children = scene_->GetChildren();
+    for (auto it = children.Begin(); it != children.End(); ++it) {
+        if ((*it)->GetOwner() == connection) {
+            state.observer_ = *it;
+            return true;
+        }
+    }
+    return false;
+}
+
+void VoxelWorld::PlanChunkStreaming(Connection* connection, ChunkStreamState& state)
+{
+    if (!state.observer_) {
+        return;
+    }
+    Vector3 observerChunk = GetWorldToChunkPosition(state.observer_->GetWorldPosition());
+    const Controls& controls = connection->GetControls();
+    Vector3 viewDirection = Quaternion(controls.pitch_, controls.yaw_, 0.0f) * Vector3::FORWARD;
+
+    // Tell the client to drop chunks which are out of range, extra chunk of margin avoids
+    // unload/load flapping when moving along the chunk border
+    for (auto it = state.sentChunks_.Begin(); it != state.sentChunks_.End();) {
+        if (!IsChunkInRange(observerChunk, *it, 1)) {
+            VectorBuffer msg;
+            msg.WriteVector3(*it);
+            connection->SendMessage(NETWORK_SEND_CHUNK_UNLOAD, true, true, msg);
+            it = state.sentChunks_.Erase(it);
+        } else {
+            ++it;
+        }
+    }
+
+    state.pendingChunks_.Clear();
+    for (auto it = chunks_.Begin(); it != chunks_.End(); ++it) {
+        Chunk* chunk = (*it).second_;
+        if (!chunk || !chunk->IsLoaded()) {
+            continue;
+        }
+        const Vector3& position = chunk->GetPosition();
+        if (state.sentChunks_.Contains(position)) {
+            continue;
+        }
+        if (!IsChunkInRange(observerChunk, position)) {
+            continue;
+        }
+        float distance = GetChunkDistance(observerChunk, position);
+        // Chunks in front of the player are sent up to 2x sooner than chunks behind
+        Vector3 direction = (position - observerChunk).Normalized();
+        float score = distance * (1.5f - 0.5f * viewDirection.DotProduct(direction));
+        state.pendingChunks_.Push(ChunkStreamCandidate(position, score));
+    }
+
+    Sort(state.pendingChunks_.Begin(), state.pendingChunks_.End(), [](const ChunkStreamCandidate& lhs, const ChunkStreamCandidate& rhs) {
+        return lhs.score_ > rhs.score_;
+    });
+}
+
+unsigned VoxelWorld::SendChunk(Chunk* chunk, Connection* connection)
+{
+    VoxelProfileScope profile(GetSubsystem<VoxelProfiler>(), VS_NETWORK);
+    VectorBuffer sendMsg;
+    sendMsg.WriteVector3(chunk->GetPosition());
+    for (int x = 0; x < SIZE_X; x++) {
+        for (int y = 0; y < SIZE_Y; y++) {
+            for (int z = 0; z < SIZE_Z; z++) {
+                sendMsg.WriteUByte(static_cast<unsigned char>(chunk->GetBlockValue(x, y, z)));
+            }
+        }
+    }
+    // Send as in-order and reliable
+    connection->SendMessage(NETWORK_SEND_CHUNK, true, true, sendMsg);
+    return sendMsg.GetSize();
+}
+
+void VoxelWorld::ApplyServerChunks()
+{
+    for (auto it = receivedChunks_.Begin(); it != receivedChunks_.End(); ++it) {
+        MemoryBuffer msg(*it);
+        Vector3 chunkPosition = msg.ReadVector3();
+        auto chunk = GetChunkByPosition(chunkPosition);
+        if (!chunk) {
+            chunk = CreateChunk(chunkPosition);
+        }
+        chunk->ProcessServerResponse(msg);
+        for (int i = 0; i < 6; i++) {
+            auto neighbor = chunk->GetNeighbor(static_cast<BlockSide>(i));
+            if (neighbor) {
+                neighbor->MarkForGeometryCalculation();
+            }
+        }
+    }
+    receivedChunks_.Clear();
+
+    if (!unloadedChunks_.Empty()) {
+        MutexLock lock(mutex_);
+        for (auto it = unloadedChunks_.Begin(); it != unloadedChunks_.End(); ++it) {
+            auto chunkIterator = chunks_.Find(GetChunkIdentificator(*it));
+            if (chunkIterator != chunks_.End()) {
+                ReleaseChunk((*chunkIterator).second_);
+                chunks_.Erase(chunkIterator);
+            }
+        }
+        unloadedChunks_.Clear();
+    }
+}
 #endif
 
+float VoxelWorld::GetChunkDistance(const Vector3& a, const Vector3& b)
+{
+    Vector3 offset = b - a;
+    return Vector3(offset.x_ / SIZE_X, offset.y_ / SIZE_Y, offset.z_ / SIZE_Z).Length();
+}
+
+int VoxelWorld::GetLodLevel(float distance)
+{
+    if (distance <= visibleDistance_ + 0.5f) {
+        return 0;
+    }
+    if (distance >= lodDistance_) {
+        return MAX_LOD;
+    }
+    // Reduced detail range is split into MAX_LOD equal bands
+    float band = Max((lodDistance_ - visibleDistance_) / static_cast<float>(MAX_LOD), 1.0f);
+    return Min(1 + static_cast<int>((distance - visibleDistance_ - 0.5f) / band), MAX_LOD);
+}
+
+bool VoxelWorld::IsChunkInRange(const Vector3& center, const Vector3& position, int margin)
+{
+    int x = RoundToInt((position.x_ - center.x_) / SIZE_X);
+    int y = RoundToInt((position.y_ - center.y_) / SIZE_Y);
+    int z = RoundToInt((position.z_ - center.z_) / SIZE_Z);
+    int horizontal = visibleDistance_ + margin;
+    return x * x + z * z <= horizontal * horizontal && Abs(y) <= verticalDistance_ + margin;
+}
+
+bool VoxelWorld::IsChunkInLodRange(const Vector3& center, const Vector3& position)
+{
+    int x = RoundToInt((position.x_ - center.x_) / SIZE_X);
+    int y = RoundToInt((position.y_ - center.y_) / SIZE_Y);
+    int z = RoundToInt((position.z_ - center.z_) / SIZE_Z);
+    return x * x + z * z <= lodDistance_ * lodDistance_ && Abs(y) <= verticalDistance_;
+}
+
 void VoxelWorld::SetSunlight(float value)
 {
     auto cache = GetSubsystem<ResourceCache>();
@@ -5,17 +5,65 @@
 #include <Urho3D/Scene/Node.h>
 #include <Urho3D/Scene/Scene.h>
 #include <Urho3D/Core/Timer.h>
-#include <queue>
+#include <Urho3D/Math/Frustum.h>
+#include <Urho3D/Container/HashSet.h>
+#if !defined(__EMSCRIPTEN__)
+#include <Urho3D/Network/Connection.h>
+#endif
 #include <map>
 
 #include "Chunk.h"
+#include "WorldSnapshot.h"
+
+// Milliseconds to wait for the server chunk data before requesting it again
+const unsigned CHUNK_REQUEST_TIMEOUT = 5000;
+// Opened automatically when the world is created
+const char* const WORLD_SNAPSHOT_FILE = "World/world.snapshot";
+// Chunks in the camera view up to this many chunks past the full range are loaded with full data
+const int FRUSTUM_PREFETCH_DISTANCE = 2;
+// Full detail radius alone, the same radius with the reduced detail ring and the whole ring at full detail
+const int LOD_BENCHMARK_PHASES = 3;
+// Chunk set has to stay ready for this long before the frames are sampled
+const unsigned LOD_BENCHMARK_SETTLE_TIME = 2000;
 
-struct ChunkNode {
-    ChunkNode(Vector3 position, int distance): position_(position), distance_(distance) {}
+/**
+ * Observer state captured on the main thread for the chunk update work item
+ */
+struct ObserverView {
     Vector3 position_;
+    // Where the observer will be after VoxelWorld::lookAheadTime_ seconds with the current velocity
+    Vector3 lookAheadPosition_;
+};
+
+struct ChunkLoadRequest {
     int distance_;
+    // Outside of the full load range of every observer, only far data is generated
+    bool far_;
+};
+
+#if !defined(__EMSCRIPTEN__)
+struct ChunkStreamCandidate {
+    ChunkStreamCandidate() {}
+    ChunkStreamCandidate(Vector3 position, float score): position_(position), score_(score) {}
+    Vector3 position_;
+    float score_;
 };
 
+/**
+ * Server side view of the chunks that a single client connection has received
+ */
+struct ChunkStreamState {
+    // Node owned by the connection, resolved again whenever the player node is recreated
+    WeakPtr<Node> observer_;
+    // Chunks which the client already has
+    HashSet<Vector3> sentChunks_;
+    // Chunks waiting to be pushed, the most important one is at the back
+    Vector<ChunkStreamCandidate> pendingChunks_;
+    // Can go negative, the debt of an oversized chunk is paid back before the next send
+    float bandwidthTokens_{0.0f};
+};
+#endif
+
 class VoxelWorld : public Object {
     URHO3D_OBJECT(VoxelWorld, Object);
     VoxelWorld(Context* context);
@@ -33,20 +81,117 @@ class VoxelWorld : public Object {
     const String GetBlockName(BlockType type);
     Vector3 GetWorldToChunkPosition(const Vector3& position);
     IntVector3 GetWorldToChunkBlockPosition(const Vector3& position);
+    /**
+     * Time in milliseconds it took to load and render all chunks around the observers after they last changed
+     */
+    unsigned GetLastFullViewTime() const { return lastFullViewTime_; }
+    /**
+     * Get or create the render region which contains the chunk
+     */
+    ChunkRegion* GetRegion(const Vector3& chunkPosition);
+    /**
+     * Chunk set or chunk connectivity changed, visibility flood fill has to run again
+     */
+    void MarkOcclusionDirty() { occlusionDirty_ = true; }
+    /**
+     * Chunk switched to a finer mesh, its vertices are moved every frame until the morph is done
+     */
+    void AddMorphingChunk(Chunk* chunk);
+    /**
+     * Prebuilt read-only world, nullptr when there is no snapshot file
+     */
+    WorldSnapshot* GetSnapshot() const { return snapshot_ && snapshot_->IsOpen() ? snapshot_.Get() : nullptr; }
+#if !defined(__EMSCRIPTEN__)
+    /**
+     * Start pushing chunks around the observer to the client connection
+     */
+    void AddStreamingClient(Connection* connection, Node* observer);
+    void RemoveStreamingClient(Connection* connection);
+#endif
 private:
     void HandleUpdate(StringHash eventType, VariantMap& eventData);
     void HandleChunkReceived(StringHash eventType, VariantMap& eventData);
     void HandleWorkItemFinished(StringHash eventType, VariantMap& eventData);
     void HandleNetworkMessage(StringHash eventType, VariantMap& eventData);
+#if !defined(__EMSCRIPTEN__)
+    void HandleClientDisconnected(StringHash eventType, VariantMap& eventData);
+    void UpdateChunkStreaming(float timeStep);
+    void PlanChunkStreaming(Connection* connection, ChunkStreamState& state);
+    /**
+     * Find the node owned by the connection, player nodes are replaced on respawn and reconnect
+     */
+    bool ResolveStreamObserver(Connection* connection, ChunkStreamState& state);
+    unsigned SendChunk(Chunk* chunk, Connection* connection);
+    void ApplyServerChunks();
+#endif
+    float GetChunkDistance(const Vector3& a, const Vector3& b);
+    /**
+     * Chunk is within the full load range of the observer
+     */
+    bool IsChunkInRange(const Vector3& center, const Vector3& position, int margin = 0);
+    /**
+     * Chunk is within the reduced detail range, chunks outside of the full range only get far data
+     */
+    bool IsChunkInLodRange(const Vector3& center, const Vector3& position);
+    void CaptureObserverViews();
+    void UpdateChunkPriorities();
+    void UpdateFullViewMetric();
+    void PublishFullViewMetric();
+    /**
+     * All chunks are loaded and their latest geometry is rendered
+     */
+    bool AreChunksReady();
+    /**
+     * Apply the next benchmark configuration and start sampling once its chunks are ready, runs while the worker is idle
+     */
+    void UpdateLodBenchmark();
+    void HandleLodBenchmarkFrame(StringHash eventType, VariantMap& eventData);
+    int GetLodLevel(float distance);
     void LoadChunk(const Vector3& position);
     void UpdateChunks();
     Vector3 GetNodeToChunkPosition(Node* node);
     bool IsChunkLoaded(const Vector3& position);
     bool IsEqualPositions(Vector3 a, Vector3 b);
     Chunk* CreateChunk(const Vector3& position);
+    void ReleaseChunk(SharedPtr<Chunk> chunk);
+    /**
+     * Store the clean chunk as dormant and return it to the pool
+     */
+    void RecycleChunk(Chunk* chunk);
+    /**
+     * Visit chunks waiting for load notification or server response
+     */
+    void UpdateChunkTicker();
+    void UpdateMorphingChunks(float timeStep);
+    /**
+     * Write all known chunks to a new snapshot file and switch to it
+     */
+    bool SaveSnapshot(const String& filename);
+    /**
+     * Keep compressed block data of the chunk which went out of range, so that it doesn't have to be loaded again
+     */
+    void StoreDormantChunk(Chunk* chunk);
+    /**
+     * Measure the chunks which are in use, waiting for save or pooled
+     */
+    void UpdateActiveMemory();
+    /**
+     * Drop least recently stored dormant chunks and then pooled chunks until both tiers fit in the memory budget
+     */
+    void EvictChunks();
+    void UpdateChunkPoolStats();
+    void RemoveEmptyRegions();
+    void UpdateOcclusionCulling();
+    void SetAllChunksVisible();
     String GetChunkIdentificator(const Vector3& position);
+    /**
+     * Collect the chunks the observers need and queue the difference to the previous set, runs on the chunk worker
+     */
     bool ProcessQueue();
-    void AddChunkToQueue(Vector3 position, int distance = 0);
+    /**
+     * Add chunk to the load set, chunk needed by several observers keeps the closest distance and full data
+     */
+    void AddLoadRequest(HashMap<Vector3, ChunkLoadRequest>& loadSet, const Vector3& center, const Vector3& position, bool far);
     void SetSunlight(float value);
 
 //    void RaycastFromObservers();
@@ -56,13 +201,86 @@ private:
     Scene* scene_;
     List<Vector3> removeBlocks_;
     HashMap<String, SharedPtr<Chunk>> chunks_;
+    // Chunks which went out of range, reused by CreateChunk
+    Vector<SharedPtr<Chunk>> chunkPool_;
+    unsigned maxPooledChunks_{512};
+    // Released chunks with unsaved edits, recycled once the chunk worker has written them
+    Vector<SharedPtr<Chunk>> savingChunks_;
+    unsigned chunksAllocated_{0};
+    unsigned chunksRecycled_{0};
+    Timer chunkPoolStatsTimer_;
+    // Chunks which still need per frame attention, removed once they are loaded and announced
+    Vector<WeakPtr<Chunk>> tickingChunks_;
+    // Chunks which still morph from their previous coarser mesh
+    Vector<WeakPtr<Chunk>> morphingChunks_;
+    // Compressed chunks which went out of range, in the order they were stored
+    HashMap<Vector3, PODVector<unsigned char>> dormantChunks_;
+    unsigned dormantMemory_{0};
+    unsigned dormantHits_{0};
+    // Measured once per second, includes the pooled chunks and the ones waiting for save
+    unsigned activeMemory_{0};
+    // Memory limit in bytes for the active and dormant chunks together
+    unsigned memoryBudget_{256 * 1024 * 1024};
+    // Active chunks alone don't fit in the budget, only warned once until they fit again
+    bool memoryBudgetExceeded_{false};
+    SharedPtr<WorldSnapshot> snapshot_;
+    HashMap<Vector3, SharedPtr<ChunkRegion>> regions_;
+    // Dedicated server, nothing is rendered
+    bool headless_{false};
+    bool occlusionCulling_{true};
+    bool occlusionDirty_{true};
+    Vector<Vector3> occlusionCameraChunks_;
+    Timer occlusionTimer_;
     Mutex mutex_;
     SharedPtr<WorkItem> updateWorkItem_;
     bool reloadAllChunks_{false};
     Timer sunlightTimer_;
-    std::queue<ChunkNode> chunkBfsQueue_;
-    HashMap<Vector3, int> chunksToLoad_;
+    // Chunks which were added to the load set or changed since the last update
+    HashMap<Vector3, ChunkLoadRequest> chunksToLoad_;
+    // Chunks which left the load set since the last update
+    PODVector<Vector3> chunksToUnload_;
+    // Load set of the previous update, only owned by the chunk worker
+    HashMap<Vector3, ChunkLoadRequest> loadSet_;
+    // Chunks waiting for geometry upload, sorted by priority every frame
+    Vector<Pair<float, Chunk*>> renderQueue_;
     Timer updateTimer_;
+    // Horizontal radius in chunks for full detail chunks
     int visibleDistance_{5};
+    // Horizontal radius in chunks for reduced detail far chunks past visibleDistance_
+    int lodDistance_{10};
+    // Vertical load radius in chunks
+    int verticalDistance_{3};
+    float lookAheadTime_{1.0f};
+    Vector<ObserverView> observerViews_;
+    Vector<Frustum> viewFrustums_;
+    bool fullViewPending_{false};
+    Timer fullViewTimer_;
+    unsigned lastFullViewTime_{0};
+    // Set on the worker thread, stats and log are published from the main thread
+    bool fullViewReady_{false};
+    // LOD benchmark configuration which is measured, -1 when the benchmark isn't running
+    int lodBenchmarkPhase_{-1};
+    bool lodBenchmarkPhaseApplied_{false};
+    bool lodBenchmarkSampling_{false};
+    float lodBenchmarkDuration_{5.0f};
+    Timer lodBenchmarkTimer_;
+    // Measures the frame from its start until rendering ends, frame limiter and present are left out
+    HiresTimer lodBenchmarkFrameTimer_;
+    long long lodBenchmarkFrameTime_{0};
+    unsigned lodBenchmarkFrames_{0};
+    long long lodBenchmarkBatches_{0};
+    long long lodBenchmarkPrimitives_{0};
+    // Distances the benchmark started with, restored when it finishes
+    int lodBenchmarkVisibleDistance_{0};
+    int lodBenchmarkLodDistance_{0};
+#if !defined(__EMSCRIPTEN__)
+    HashMap<Connection*, ChunkStreamState> streamingClients_;
+    Timer streamTimer_;
+    // Per connection chunk upload limit
+    int streamBytesPerSecond_{256 * 1024};
+    // Chunk data received from the server, applied when the update work item is not running
+    Vector<PODVector<unsigned char>> receivedChunks_;
+    Vector<Vector3> unloadedChunks_;
+#endif
 };
 #endif
@@ -0,0 +1,224 @@
+#ifdef VOXEL_SUPPORT
+#include <Urho3D/Core/Context.h>
+#include <Urho3D/IO/Log.h>
+#include <Urho3D/IO/File.h>
+#include <Urho3D/IO/FileSystem.h>
+#include <Urho3D/Container/Sort.h>
+#if !defined(_WIN32) && !defined(__EMSCRIPTEN__)
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#define SNAPSHOT_MMAP
+#endif
+#include "WorldSnapshot.h"
+
+static const char SNAPSHOT_MAGIC[4] = {'V', 'X', 'S', 'N'};
+// Magic, version, flags and chunk count
+static const unsigned HEADER_SIZE = 16;
+// Chunk x, y, z, blob offset and blob size
+static const unsigned INDEX_ENTRY_SIZE = 20;
+
+struct SnapshotEntry {
+    int x_;
+    int y_;
+    int z_;
+    const PODVector<unsigned char>* blob_;
+};
+
+static bool CompareEntries(const SnapshotEntry& lhs, const SnapshotEntry& rhs)
+{
+    if (lhs.x_ != rhs.x_) {
+        return lhs.x_ < rhs.x_;
+    }
+    if (lhs.y_ != rhs.y_) {
+        return lhs.y_ < rhs.y_;
+    }
+    return lhs.z_ < rhs.z_;
+}
+
+static unsigned ReadUInt(const unsigned char* data)
+{
+    unsigned value;
+    memcpy(&value, data, sizeof(value));
+    return value;
+}
+
+static int ReadInt(const unsigned char* data)
+{
+    int value;
+    memcpy(&value, data, sizeof(value));
+    return value;
+}
+
+WorldSnapshot::WorldSnapshot(Context* context):
+    Object(context)
+{
+}
+
+WorldSnapshot::~WorldSnapshot()
+{
+    Close();
+}
+
+void WorldSnapshot::RegisterObject(Context* context)
+{
+    context->RegisterFactory<WorldSnapshot>();
+}
+
+bool WorldSnapshot::Open(const String& filename)
+{
+    Close();
+
+#ifdef SNAPSHOT_MMAP
+    int fd = open(GetNativePath(filename).CString(), O_RDONLY);
+    if (fd < 0) {
+        URHO3D_LOGERROR("Failed to open world snapshot " + filename);
+        return false;
+    }
+    struct stat fileStat;
+    if (fstat(fd, &fileStat) != 0 || fileStat.st_size < static_cast<off_t>(HEADER_SIZE)) {
+        close(fd);
+        URHO3D_LOGERROR("Invalid world snapshot " + filename);
+        return false;
+    }
+    void* mapping = mmap(nullptr, fileStat.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    // Mapping stays valid after the descriptor is closed
+    close(fd);
+    if (mapping == MAP_FAILED) {
+        URHO3D_LOGERROR("Failed to map world snapshot " + filename);
+        return false;
+    }
+    data_ = static_cast<const unsigned char*>(mapping);
+    size_ = static_cast<unsigned>(fileStat.st_size);
+    mapped_ = true;
+#else
+    File file(context_);
+    if (!file.Open(filename, FILE_READ) || file.GetSize() < HEADER_SIZE) {
+        URHO3D_LOGERROR("Failed to open world snapshot " + filename);
+        return false;
+    }
+    buffer_.Resize(file.GetSize());
+    file.Read(buffer_.Buffer(), buffer_.Size());
+    data_ = buffer_.Buffer();
+    size_ = buffer_.Size();
+#endif
+
+    unsigned chunkCount = ReadUInt(data_ + 12);
+    if (memcmp(data_, SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC)) != 0 || ReadUInt(data_ + 4) != SNAPSHOT_VERSION
+        || HEADER_SIZE + (unsigned long long)chunkCount * INDEX_ENTRY_SIZE > size_) {
+        URHO3D_LOGERROR("Unsupported world snapshot " + filename);
+        Close();
+        return false;
+    }
+    flags_ = ReadUInt(data_ + 8);
+    chunkCount_ = chunkCount;
+
+    URHO3D_LOGINFOF("World snapshot %s opened with %u chunks", filename.CString(), chunkCount_);
+    return true;
+}
+
+void WorldSnapshot::Close()
+{
+#ifdef SNAPSHOT_MMAP
+    if (mapped_ && data_) {
+        munmap(const_cast<unsigned char*>(data_), size_);
+    }
+#endif
+    buffer_.Clear();
+    data_ = nullptr;
+    size_ = 0;
+    flags_ = 0;
+    chunkCount_ = 0;
+    mapped_ = false;
+}
+
+const unsigned char* WorldSnapshot::Find(const Vector3& chunkPosition, unsigned& size) const
+{
+    if (!data_) {
+        return nullptr;
+    }
+
+    // Binary search over the sorted index, nothing is built when the snapshot is opened
+    SnapshotEntry key{static_cast<int>(chunkPosition.x_), static_cast<int>(chunkPosition.y_), static_cast<int>(chunkPosition.z_), nullptr};
+    const unsigned char* index = data_ + HEADER_SIZE;
+    unsigned low = 0;
+    unsigned high = chunkCount_;
+    while (low < high) {
+        unsigned middle = (low + high) / 2;
+        const unsigned char* entry = index + middle * INDEX_ENTRY_SIZE;
+        SnapshotEntry current{ReadInt(entry), ReadInt(entry + 4), ReadInt(entry + 8), nullptr};
+        if (CompareEntries(current, key)) {
+            low = middle + 1;
+        } else if (CompareEntries(key, current)) {
+            high = middle;
+        } else {
+            unsigned offset = ReadUInt(entry + 12);
+            size = ReadUInt(entry + 16);
+            if ((unsigned long long)offset + size > size_) {
+                URHO3D_LOGERROR("World snapshot chunk " + chunkPosition.ToString() + " is out of file bounds");
+                return nullptr;
+            }
+            return data_ + offset;
+        }
+    }
+    return nullptr;
+}
+
+void WorldSnapshot::CollectChunks(HashMap<Vector3, PODVector<unsigned char>>& chunks) const
+{
+    if (!data_) {
+        return;
+    }
+    const unsigned char* index = data_ + HEADER_SIZE;
+    for (unsigned i = 0; i < chunkCount_; i++) {
+        const unsigned char* entry = index + i * INDEX_ENTRY_SIZE;
+        Vector3 position(ReadInt(entry), ReadInt(entry + 4), ReadInt(entry + 8));
+        unsigned offset = ReadUInt(entry + 12);
+        unsigned size = ReadUInt(entry + 16);
+        if (chunks.Contains(position) || (unsigned long long)offset + size > size_) {
+            continue;
+        }
+        PODVector<unsigned char>& blob = chunks[position];
+        blob.Resize(size);
+        memcpy(blob.Buffer(), data_ + offset, size);
+    }
+}
+
+bool WorldSnapshot::Save(const String& filename, const HashMap<Vector3, PODVector<unsigned char>>& chunks, bool hasLight)
+{
+    PODVector<SnapshotEntry> entries;
+    for (auto it = chunks.Begin(); it != chunks.End(); ++it) {
+        const Vector3& position = (*it).first_;
+        entries.Push(SnapshotEntry{static_cast<int>(position.x_), static_cast<int>(position.y_), static_cast<int>(position.z_), &(*it).second_});
+    }
+    Sort(entries.Begin(), entries.End(), CompareEntries);
+
+    File file(context_);
+    if (!file.Open(filename, FILE_WRITE)) {
+        URHO3D_LOGERROR("Failed to create world snapshot " + filename);
+        return false;
+    }
+    file.Write(SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC));
+    file.WriteUInt(SNAPSHOT_VERSION);
+    file.WriteUInt(hasLight ? SNAPSHOT_FLAG_LIGHT : 0);
+    file.WriteUInt(entries.Size());
+
+    unsigned offset = HEADER_SIZE + entries.Size() * INDEX_ENTRY_SIZE;
+    for (auto it = entries.Begin(); it != entries.End(); ++it) {
+        file.WriteInt((*it).x_);
+        file.WriteInt((*it).y_);
+        file.WriteInt((*it).z_);
+        file.WriteUInt(offset);
+        file.WriteUInt((*it).blob_->Size());
+        offset += (*it).blob_->Size();
+    }
+    for (auto it = entries.Begin(); it != entries.End(); ++it) {
+        file.Write((*it).blob_->Buffer(), (*it).blob_->Size());
+    }
+    file.Close();
+
+    URHO3D_LOGINFOF("World snapshot %s saved with %u chunks", filename.CString(), entries.Size());
+    return true;
+}
+#endif
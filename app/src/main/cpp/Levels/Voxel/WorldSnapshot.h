@@ -0,0 +1,51 @@
+#ifdef VOXEL_SUPPORT
+#pragma once
+#include <Urho3D/Core/Object.h>
+#include <Urho3D/Container/HashMap.h>
+
+using namespace Urho3D;
+
+const unsigned SNAPSHOT_VERSION = 1;
+// Snapshot contains valid light maps
+const unsigned SNAPSHOT_FLAG_LIGHT = 1;
+
+/**
+ * Read-only world file with sorted chunk index followed by compressed chunk blobs.
+ * File is memory mapped, so opening it costs nothing and the pages are shared between server processes
+ */
+class WorldSnapshot : public Object {
+    URHO3D_OBJECT(WorldSnapshot, Object);
+    WorldSnapshot(Context* context);
+    virtual ~WorldSnapshot();
+
+    static void RegisterObject(Context* context);
+public:
+    bool Open(const String& filename);
+    void Close();
+    bool IsOpen() const { return data_ != nullptr; }
+    /**
+     * Compressed chunk data in Chunk::Compress format, nullptr when the snapshot doesn't have the chunk.
+     * Safe to call from the worker threads
+     */
+    const unsigned char* Find(const Vector3& chunkPosition, unsigned& size) const;
+    bool HasLight() const { return (flags_ & SNAPSHOT_FLAG_LIGHT) != 0; }
+    unsigned GetChunkCount() const { return chunkCount_; }
+    /**
+     * Copy all chunks which are not in the map yet, used to carry old chunks over to the new snapshot
+     */
+    void CollectChunks(HashMap<Vector3, PODVector<unsigned char>>& chunks) const;
+    /**
+     * Write chunk blobs keyed by chunk position to a new snapshot file
+     */
+    bool Save(const String& filename, const HashMap<Vector3, PODVector<unsigned char>>& chunks, bool hasLight);
+
+private:
+    const unsigned char* data_{nullptr};
+    unsigned size_{0};
+    unsigned flags_{0};
+    unsigned chunkCount_{0};
+    // Whether data_ is memory mapped or read to buffer_
+    bool mapped_{false};
+    PODVector<unsigned char> buffer_;
+};
+#endif
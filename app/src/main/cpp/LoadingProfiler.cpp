@@ -0,0 +1,261 @@
+#include <Urho3D/IO/Log.h>
+#include <Urho3D/Resource/JSONFile.h>
+#include <Urho3D/Container/Sort.h>
+#include "LoadingProfiler.h"
+#include "Console/ConsoleHandlerEvents.h"
+
+using namespace ConsoleHandlerEvents;
+
+LoadingProfiler::LoadingProfiler(Context* context) :
+        Object(context)
+{
+}
+
+LoadingProfiler::~LoadingProfiler()
+{
+}
+
+void LoadingProfiler::BeginMap(const String& map)
+{
+    currentMap_ = map;
+    maps_[map] = MapLoadingTrace();
+    maps_[map].map = map;
+    timer_.Reset();
+
+    // Console handler is created after the SceneManager, so the commands are added when the first map is loaded
+    SendEvent(E_CONSOLE_COMMAND_ADD, ConsoleCommandAdd::P_NAME, "loading_slowest", ConsoleCommandAdd::P_EVENT, "#loading_slowest",
+              ConsoleCommandAdd::P_DESCRIPTION, "Show the slowest loading steps of the last map [count]", ConsoleCommandAdd::P_OVERWRITE, true);
+    SubscribeToEvent("#loading_slowest", [&](StringHash eventType, VariantMap& eventData) {
+        StringVector params = eventData["Parameters"].GetStringVector();
+        unsigned count = params.Size() > 1 ? ToUInt(params[1]) : 5;
+        LogSlowestSteps(currentMap_, count);
+    });
+
+    SendEvent(E_CONSOLE_COMMAND_ADD, ConsoleCommandAdd::P_NAME, "loading_trace", ConsoleCommandAdd::P_EVENT, "#loading_trace",
+              ConsoleCommandAdd::P_DESCRIPTION, "Save loading step timeline in Chrome trace format [filename]", ConsoleCommandAdd::P_OVERWRITE, true);
+    SubscribeToEvent("#loading_trace", [&](StringHash eventType, VariantMap& eventData) {
+        StringVector params = eventData["Parameters"].GetStringVector();
+        String filename = params.Size() > 1 ? params[1] : "LoadingTrace.json";
+        if (SaveChromeTrace(filename)) {
+            URHO3D_LOGINFO("Loading trace saved to " + filename);
+        }
+    });
+}
+
+void LoadingProfiler::EndMap()
+{
+    auto it = maps_.Find(currentMap_);
+    if (it != maps_.End()) {
+        (*it).second_.duration = GetTime();
+    }
+}
+
+LoadingStepTrace* LoadingProfiler::GetStep(const String& event)
+{
+    auto it = maps_.Find(currentMap_);
+    if (it == maps_.End()) {
+        return nullptr;
+    }
+    LoadingStepTrace& step = (*it).second_.steps[event];
+    step.event = event;
+    return &step;
+}
+
+void LoadingProfiler::StepStarted(const String& event, const String& name, const StringVector& dependsOn)
+{
+    LoadingStepTrace* step = GetStep(event);
+    if (step) {
+        step->name = name;
+        step->dependsOn = dependsOn;
+        step->start = GetTime();
+    }
+}
+
+void LoadingProfiler::StepAcked(const String& event)
+{
+    LoadingStepTrace* step = GetStep(event);
+    if (step) {
+        step->ack = GetTime();
+    }
+}
+
+void LoadingProfiler::StepProgress(const String& event, float progress)
+{
+    LoadingStepTrace* step = GetStep(event);
+    if (step) {
+        step->progress.Push(LoadingProgressMark{GetTime(), progress});
+    }
+}
+
+void LoadingProfiler::StepFinished(const String& event, bool failed)
+{
+    LoadingStepTrace* step = GetStep(event);
+    if (step) {
+        step->finish = GetTime();
+        step->failed = failed;
+    }
+}
+
+void LoadingProfiler::StepTimedOut(const String& event)
+{
+    LoadingStepTrace* step = GetStep(event);
+    if (step) {
+        step->timeout = GetTime();
+    }
+}
+
+Vector<const LoadingStepTrace*> LoadingProfiler::GetCriticalPath(const String& map) const
+{
+    Vector<const LoadingStepTrace*> path;
+    auto mapIt = maps_.Find(map);
+    if (mapIt == maps_.End()) {
+        return path;
+    }
+    const HashMap<String, LoadingStepTrace>& steps = (*mapIt).second_.steps;
+
+    // Loading ended with the step which finished last
+    const LoadingStepTrace* current = nullptr;
+    for (auto it = steps.Begin(); it != steps.End(); ++it) {
+        if ((*it).second_.start >= 0 && (!current || (*it).second_.finish > current->finish)) {
+            current = &(*it).second_;
+        }
+    }
+
+    // Each step waited for its dependency which finished last
+    while (current) {
+        path.Insert(0, current);
+        const LoadingStepTrace* blocker = nullptr;
+        for (auto it = current->dependsOn.Begin(); it != current->dependsOn.End(); ++it) {
+            auto dependency = steps.Find(*it);
+            if (dependency != steps.End() && (*dependency).second_.start >= 0
+                && (!blocker || (*dependency).second_.finish > blocker->finish)) {
+                blocker = &(*dependency).second_;
+            }
+        }
+        current = blocker;
+    }
+    return path;
+}
+
+String LoadingProfiler::GetCriticalPathString(const String& map) const
+{
+    Vector<const LoadingStepTrace*> path = GetCriticalPath(map);
+    String criticalPath;
+    for (auto it = path.Begin(); it != path.End(); ++it) {
+        if (!criticalPath.Empty()) {
+            criticalPath += " -> ";
+        }
+        criticalPath.AppendWithFormat("%s (%.1f ms)", (*it)->name.CString(), (*it)->GetDuration() / 1000.0);
+    }
+    return criticalPath;
+}
+
+bool LoadingProfiler::SaveChromeTrace(const String& filename) const
+{
+    JSONArray events;
+    int pid = 1;
+    for (auto mapIt = maps_.Begin(); mapIt != maps_.End(); ++mapIt, ++pid) {
+        const MapLoadingTrace& trace = (*mapIt).second_;
+        {
+            JSONValue process;
+            process.Set("name", "process_name");
+            process.Set("ph", "M");
+            process.Set("pid", pid);
+            JSONValue args;
+            args.Set("name", trace.map);
+            process.Set("args", args);
+            events.Push(process);
+        }
+
+        Vector<const LoadingStepTrace*> steps;
+        for (auto it = trace.steps.Begin(); it != trace.steps.End(); ++it) {
+            if ((*it).second_.start >= 0) {
+                steps.Push(&(*it).second_);
+            }
+        }
+        Sort(steps.Begin(), steps.End(), [](const LoadingStepTrace* lhs, const LoadingStepTrace* rhs) {
+            return lhs->start < rhs->start;
+        });
+
+        // Concurrent steps are placed on separate rows
+        PODVector<long long> laneEnds;
+        for (auto it = steps.Begin(); it != steps.End(); ++it) {
+            const LoadingStepTrace* step = *it;
+            long long end = step->finish >= 0 ? step->finish : trace.duration;
+            unsigned lane = 0;
+            while (lane < laneEnds.Size() && laneEnds[lane] > step->start) {
+                lane++;
+            }
+            if (lane == laneEnds.Size()) {
+                laneEnds.Push(end);
+            } else {
+                laneEnds[lane] = end;
+            }
+
+            JSONValue event;
+            event.Set("name", step->name);
+            event.Set("cat", "loading");
+            event.Set("ph", "X");
+            event.Set("pid", pid);
+            event.Set("tid", (int)lane);
+            event.Set("ts", (double)step->start);
+            event.Set("dur", (double)Max(end - step->start, 0LL));
+            JSONValue args;
+            args.Set("event", step->event);
+            args.Set("ack_ms", step->ack >= 0 ? (step->ack - step->start) / 1000.0 : -1.0);
+            args.Set("failed", step->failed);
+            args.Set("timed_out", step->timeout >= 0);
+            event.Set("args", args);
+            events.Push(event);
+
+            for (auto progress = step->progress.Begin(); progress != step->progress.End(); ++progress) {
+                JSONValue counter;
+                counter.Set("name", step->name + " progress");
+                counter.Set("ph", "C");
+                counter.Set("pid", pid);
+                counter.Set("ts", (double)(*progress).time);
+                JSONValue counterArgs;
+                counterArgs.Set("progress", (*progress).progress);
+                counter.Set("args", counterArgs);
+                events.Push(counter);
+            }
+        }
+    }
+
+    JSONFile file(context_);
+    file.GetRoot().Set("traceEvents", events);
+    file.GetRoot().Set("displayTimeUnit", "ms");
+    if (!file.SaveFile(filename)) {
+        URHO3D_LOGERROR("Failed to save loading trace " + filename);
+        return false;
+    }
+    return true;
+}
+
+void LoadingProfiler::LogSlowestSteps(const String& map, unsigned count) const
+{
+    auto mapIt = maps_.Find(map);
+    if (mapIt == maps_.End()) {
+        URHO3D_LOGWARNING("No loading trace for map '" + map + "'");
+        return;
+    }
+    const MapLoadingTrace& trace = (*mapIt).second_;
+
+    Vector<const LoadingStepTrace*> steps;
+    for (auto it = trace.steps.Begin(); it != trace.steps.End(); ++it) {
+        if ((*it).second_.start >= 0) {
+            steps.Push(&(*it).second_);
+        }
+    }
+    Sort(steps.Begin(), steps.End(), [](const LoadingStepTrace* lhs, const LoadingStepTrace* rhs) {
+        return lhs->GetDuration() > rhs->GetDuration();
+    });
+
+    URHO3D_LOGINFOF("Map '%s' loaded in %.1f ms, slowest loading steps:", map.CString(), trace.duration / 1000.0);
+    for (unsigned i = 0; i < steps.Size() && i < count; i++) {
+        URHO3D_LOGINFOF("  %s: %.1f ms%s%s", steps[i]->name.CString(), steps[i]->GetDuration() / 1000.0,
+                        steps[i]->timeout >= 0 ? " (timed out)" : "", steps[i]->failed ? " (failed)" : "");
+    }
+
+    URHO3D_LOGINFO("Critical path: " + GetCriticalPathString(map));
+}
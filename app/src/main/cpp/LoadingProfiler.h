@@ -0,0 +1,101 @@
+#pragma once
+
+#include <Urho3D/Core/Object.h>
+#include <Urho3D/Core/Timer.h>
+#include <Urho3D/Container/HashMap.h>
+
+using namespace Urho3D;
+
+struct LoadingProgressMark {
+    long long time;
+    float progress;
+};
+
+/**
+ * Timestamps of single loading step, all times are microseconds since the map loading started, -1 if not reached
+ */
+struct LoadingStepTrace {
+    String event;
+    String name;
+    StringVector dependsOn;
+    long long start{-1};
+    long long ack{-1};
+    long long finish{-1};
+    long long timeout{-1};
+    bool failed{false};
+    PODVector<LoadingProgressMark> progress;
+
+    long long GetDuration() const { return start >= 0 && finish >= start ? finish - start : 0; }
+};
+
+struct MapLoadingTrace {
+    String map;
+    long long duration{0};
+    // Keyed by loading step event
+    HashMap<String, LoadingStepTrace> steps;
+};
+
+/**
+ * Records the loading step timeline for each map, finds the critical path and exports Chrome trace files
+ */
+class LoadingProfiler : public Object
+{
+URHO3D_OBJECT(LoadingProfiler, Object);
+public:
+    LoadingProfiler(Context* context);
+
+    ~LoadingProfiler();
+
+    /**
+     * Start new trace for the map, previous trace of the same map is replaced
+     */
+    void BeginMap(const String& map);
+
+    /**
+     * Whole map loading finished
+     */
+    void EndMap();
+
+    void StepStarted(const String& event, const String& name, const StringVector& dependsOn);
+
+    void StepAcked(const String& event);
+
+    void StepProgress(const String& event, float progress);
+
+    void StepFinished(const String& event, bool failed);
+
+    void StepTimedOut(const String& event);
+
+    /**
+     * Chain of steps which delayed the end of the map loading, first step is the one which started first
+     */
+    Vector<const LoadingStepTrace*> GetCriticalPath(const String& map) const;
+
+    /**
+     * Critical path of the map formatted for the log, step names with their durations
+     */
+    String GetCriticalPathString(const String& map) const;
+
+    /**
+     * Write all recorded maps in Chrome trace event format, open it in chrome://tracing
+     */
+    bool SaveChromeTrace(const String& filename) const;
+
+    /**
+     * Log the slowest loading steps and the critical path of the map
+     */
+    void LogSlowestSteps(const String& map, unsigned count) const;
+
+    const String& GetCurrentMap() const { return currentMap_; }
+
+private:
+    LoadingStepTrace* GetStep(const String& event);
+
+    long long GetTime() const { return timer_.GetUSec(false); }
+
+    HashMap<String, MapLoadingTrace> maps_;
+
+    String currentMap_;
+
+    HiresTimer timer_;
+};
@@ -1,5 +1,4 @@
 #include <Urho3D/Core/CoreEvents.h>
-#include <Urho3D/Core/WorkQueue.h>
 #include <Urho3D/IO/Log.h>
 #include <Urho3D/Scene/ValueAnimation.h>
 #include <Urho3D/Scene/ObjectAnimation.h>
@@ -15,15 +14,86 @@
 #include "../Audio/AudioEvents.h"
 #include "MessageEvents.h"
 #include "../Globals/Settings.h"
+#include "../Console/ConsoleHandlerEvents.h"
 
 using namespace Urho3D;
 using namespace AudioEvents;
 using namespace MessageEvents;
+using namespace ConsoleHandlerEvents;
 
-void SaveProgressAsync(const WorkItem* item, unsigned threadIndex)
+/**
+ * Progress changes are collected for this many MS before they are saved
+ */
+const unsigned ACHIEVEMENT_SAVE_DELAY = 1000;
+
+void AchievementMatcher::Add(AchievementRule* rule)
+{
+    if (rule->deepCheck) {
+        parameters_[rule->parameterName][GetValueHash(rule->parameterValue)].Push(rule);
+    } else {
+        unconditional_.Push(rule);
+    }
+}
+
+void AchievementMatcher::Remove(AchievementRule* rule)
+{
+    if (!rule->deepCheck) {
+        unconditional_.RemoveSwap(rule);
+        return;
+    }
+
+    auto parameter = parameters_.Find(rule->parameterName);
+    if (parameter == parameters_.End()) {
+        return;
+    }
+    auto bucket = (*parameter).second_.Find(GetValueHash(rule->parameterValue));
+    if (bucket == (*parameter).second_.End()) {
+        return;
+    }
+    (*bucket).second_.RemoveSwap(rule);
+    if ((*bucket).second_.Empty()) {
+        (*parameter).second_.Erase(bucket);
+        if ((*parameter).second_.Empty()) {
+            parameters_.Erase(parameter);
+        }
+    }
+}
+
+void AchievementMatcher::Match(const VariantMap& eventData, PODVector<AchievementRule*>& result) const
+{
+    result = unconditional_;
+    for (auto parameter = parameters_.Begin(); parameter != parameters_.End(); ++parameter) {
+        auto value = eventData.Find((*parameter).first_);
+        if (value == eventData.End()) {
+            continue;
+        }
+        auto bucket = (*parameter).second_.Find(GetValueHash((*value).second_));
+        if (bucket == (*parameter).second_.End()) {
+            continue;
+        }
+        // Different values can share the hash
+        for (auto rule = (*bucket).second_.Begin(); rule != (*bucket).second_.End(); ++rule) {
+            if ((*value).second_ == (*rule)->parameterValue) {
+                result.Push(*rule);
+            }
+        }
+    }
+}
+
+unsigned AchievementMatcher::GetValueHash(const Variant& value)
 {
-    Achievements* achievementHandler = reinterpret_cast<Achievements*>(item->aux_);
-    achievementHandler->SaveProgress();
+    switch (value.GetType()) {
+    case VAR_INT:
+        return (unsigned) value.GetInt();
+    case VAR_BOOL:
+        return value.GetBool() ? 1 : 0;
+    case VAR_STRING:
+        return StringHash(value.GetString()).Value();
+    case VAR_STRINGHASH:
+        return value.GetStringHash().Value();
+    default:
+        return StringHash(value.ToString()).Value();
+    }
 }
 
 Achievements::Achievements(Context* context) :
@@ -45,6 +115,7 @@ void Achievements::SetShowAchievements(bool show)
 
 void Achievements::Init()
 {
+    writer_ = new DeferredWriter(context_, this, "Achievement", ACHIEVEMENT_SAVE_DELAY);
     SubscribeToEvents();
     LoadAchievementList();
 }
@@ -55,6 +126,15 @@ void Achievements::SubscribeToEvents()
     SubscribeToEvent(E_NEW_ACHIEVEMENT, URHO3D_HANDLER(Achievements, HandleNewAchievement));
     SubscribeToEvent(E_ADD_ACHIEVEMENT, URHO3D_HANDLER(Achievements, HandleAddAchievement));
     SubscribeToEvent(E_UPDATE, URHO3D_HANDLER(Achievements, HandleUpdate));
+
+    SendEvent(E_CONSOLE_COMMAND_ADD, ConsoleCommandAdd::P_NAME, "achievements_benchmark", ConsoleCommandAdd::P_EVENT, "#achievements_benchmark",
+              ConsoleCommandAdd::P_DESCRIPTION, "Measure achievement rule matching [rules] [events]", ConsoleCommandAdd::P_OVERWRITE, true);
+    SubscribeToEvent("#achievements_benchmark", [&](StringHash eventType, VariantMap& eventData) {
+        StringVector params = eventData["Parameters"].GetStringVector();
+        unsigned rules = params.Size() > 1 ? ToUInt(params[1]) : 1000;
+        unsigned events = params.Size() > 2 ? ToUInt(params[2]) : 100000;
+        RunMatcherBenchmark(Max(rules, 1U), Max(events, 1U));
+    });
 }
 
 void Achievements::HandleNewAchievement(StringHash eventType, VariantMap& eventData)
@@ -221,48 +301,136 @@ void Achievements::LoadAchievementList()
 
 void Achievements::HandleRegisteredEvent(StringHash eventType, VariantMap& eventData)
 {
-    bool processed = false;
-    if (registeredAchievements_.Contains(eventType)) {
-        for (auto it = registeredAchievements_[eventType].Begin(); it != registeredAchievements_[eventType].End(); ++it) {
-            if ((*it).deepCheck) {
-                // check if the event contains specified parameter and same value
-                if (eventData[(*it).parameterName] == (*it).parameterValue) {
-                    (*it).current++;
-                    processed = true;
-                }
-            } else {
-                // No additional check needed, event was called, so we can increment our counter
-                (*it).current++;
-                processed = true;
+    auto matcher = matchers_.Find(eventType);
+    if (matcher == matchers_.End()) {
+        return;
+    }
+
+    PODVector<AchievementRule*> matched;
+    (*matcher).second_.Match(eventData, matched);
+    if (matched.Empty()) {
+        return;
+    }
+
+    PODVector<AchievementRule*> unlocked;
+    for (auto it = matched.Begin(); it != matched.End(); ++it) {
+        (*it)->current++;
+        //URHO3D_LOGINFOF("Achievement progress: '%s' => %i/%i",(*it)->message.CString(), (*it)->current, (*it)->threshold);
+        if ((*it)->current >= (*it)->threshold && !(*it)->completed) {
+            (*it)->completed = true;
+            // Completed rules no longer need to be checked
+            (*matcher).second_.Remove(*it);
+            unlocked.Push(*it);
+        }
+    }
+
+    if ((*matcher).second_.Empty()) {
+        matchers_.Erase(matcher);
+        UnsubscribeFromEvent(eventType);
+    }
+
+    // Event handlers may fire achievement events again, so notifications are sent after the matcher update
+    for (auto it = unlocked.Begin(); it != unlocked.End(); ++it) {
+        VariantMap& data = GetEventDataMap();
+        data["Message"] = (*it)->message;
+        data["Image"] = (*it)->image;
+        SendEvent(E_NEW_ACHIEVEMENT, data);
+    }
+
+    writer_->MarkDirty();
+}
+
+void Achievements::RebuildMatchers()
+{
+    for (auto it = matchers_.Begin(); it != matchers_.End(); ++it) {
+        UnsubscribeFromEvent((*it).first_);
+    }
+    matchers_.Clear();
+
+    for (auto it = registeredAchievements_.Begin(); it != registeredAchievements_.End(); ++it) {
+        for (auto achievement = (*it).second_.Begin(); achievement != (*it).second_.End(); ++achievement) {
+            if (!(*achievement).completed) {
+                matchers_[(*it).first_].Add(&(*achievement));
             }
+        }
+        if (matchers_.Contains((*it).first_)) {
+            SubscribeToEvent((*it).first_, URHO3D_HANDLER(Achievements, HandleRegisteredEvent));
+        }
+    }
+}
+
+void Achievements::RunMatcherBenchmark(unsigned ruleCount, unsigned eventCount)
+{
+    // Every 10th rule only checks the event, others wait for one of the parameter values
+    const unsigned VALUE_COUNT = 100;
+    List<AchievementRule> rules;
+    AchievementMatcher matcher;
+    for (unsigned i = 0; i < ruleCount; i++) {
+        AchievementRule rule;
+        rule.eventName = "AchievementBenchmark";
+        rule.threshold = M_MAX_INT;
+        rule.current = 0;
+        rule.completed = false;
+        rule.deepCheck = i % 10 != 0;
+        if (rule.deepCheck) {
+            rule.parameterName = i % 2 ? "Type" : "Name";
+            rule.parameterValue = i % 2 ? Variant((int) (i % VALUE_COUNT)) : Variant("Value" + String(i % VALUE_COUNT));
+        }
+        rules.Push(rule);
+        matcher.Add(&rules.Back());
+    }
 
-            //URHO3D_LOGINFOF("Achievement progress: '%s' => %i/%i",(*it).message.CString(), (*it).current, (*it).threshold);
-            if ((*it).current >= (*it).threshold && !(*it).completed) {
-                (*it).completed = true;
-                VariantMap& data = GetEventDataMap();
-                data["Message"] = (*it).message;
-                data["Image"] = (*it).image;
-                SendEvent(E_NEW_ACHIEVEMENT, data);
+    Vector<VariantMap> events(VALUE_COUNT);
+    for (unsigned i = 0; i < VALUE_COUNT; i++) {
+        events[i]["Type"] = (int) i;
+        events[i]["Name"] = "Value" + String(i);
+    }
+
+    HiresTimer timer;
+    unsigned linearMatches = 0;
+    for (unsigned i = 0; i < eventCount; i++) {
+        const VariantMap& eventData = events[i % VALUE_COUNT];
+        for (auto rule = rules.Begin(); rule != rules.End(); ++rule) {
+            if (!(*rule).deepCheck) {
+                linearMatches++;
+                continue;
+            }
+            auto value = eventData.Find((*rule).parameterName);
+            if (value != eventData.End() && (*value).second_ == (*rule).parameterValue) {
+                linearMatches++;
             }
         }
     }
+    long long linearTime = timer.GetUSec(true);
+
+    unsigned matcherMatches = 0;
+    PODVector<AchievementRule*> matched;
+    for (unsigned i = 0; i < eventCount; i++) {
+        matcher.Match(events[i % VALUE_COUNT], matched);
+        matcherMatches += matched.Size();
+    }
+    long long matcherTime = timer.GetUSec(false);
 
-    // If any of the achievements were updated, save progress
-    if (processed) {
-        WorkQueue *workQueue = GetSubsystem<WorkQueue>();
-        SharedPtr<WorkItem> item = workQueue->GetFreeItem();
-        item->priority_ = M_MAX_UNSIGNED;
-        item->workFunction_ = SaveProgressAsync;
-        item->aux_ = this;
-        // send E_WORKITEMCOMPLETED event after finishing WorkItem
-        item->sendEvent_ = true;
+    URHO3D_LOGINFOF("Achievement matching, %u rules, %u events: linear %.2f ms (%u matches), matcher %.2f ms (%u matches)",
+                    ruleCount, eventCount, linearTime / 1000.0f, linearMatches, matcherTime / 1000.0f, matcherMatches);
+}
 
-        item->start_ = nullptr;
-        item->end_ = nullptr;
-        workQueue->AddWorkItem(item);
+void Achievements::PrepareWrite()
+{
+    pendingProgress_.Clear();
+    for (auto it = registeredAchievements_.Begin(); it != registeredAchievements_.End(); ++it) {
+        for (auto achievement = (*it).second_.Begin(); achievement != (*it).second_.End(); ++achievement) {
+            StringHash id = (*achievement).eventName + (*achievement).message;
+            pendingProgress_[id.ToString()] = (*achievement).current;
+        }
     }
 }
 
+void Achievements::Flush()
+{
+    writer_->Flush();
+}
+
 List<AchievementRule> Achievements::GetAchievements()
 {
     achievements_.Clear();
@@ -275,22 +443,20 @@ List<AchievementRule> Achievements::GetAchievements()
     return achievements_;
 }
 
-void Achievements::SaveProgress()
+bool Achievements::Write()
 {
     JSONFile file(context_);
-    for (auto it = registeredAchievements_.Begin(); it != registeredAchievements_.End(); ++it) {
-        for (auto achievement = (*it).second_.Begin(); achievement != (*it).second_.End(); ++achievement) {
-            StringHash id = (*achievement).eventName + (*achievement).message;
-            file.GetRoot()[id.ToString()] = (*achievement).current;
-        }
+    for (auto it = pendingProgress_.Begin(); it != pendingProgress_.End(); ++it) {
+        file.GetRoot()[(*it).first_] = (*it).second_;
     }
 #if defined(__ANDROID__)
     String directory = GetSubsystem<FileSystem>()->GetUserDocumentsDir() + DOCUMENTS_DIR;
-    file.SaveFile(directory + "/Achievements.json");
+    return file.SaveFile(directory + "/Achievements.json");
 #elif defined(__EMSCRIPTEN__)
     //TODO: implement local storage utilization for web
+    return true;
 #else
-    file.SaveFile(GetSubsystem<FileSystem>()->GetProgramDir() + "Data/Saves/Achievements.json");
+    return file.SaveFile(GetSubsystem<FileSystem>()->GetProgramDir() + "Data/Saves/Achievements.json");
 #endif
 }
 
@@ -324,7 +490,8 @@ void Achievements::ClearAchievementsProgress()
         }
     }
 
-    SaveProgress();
+    RebuildMatchers();
+    writer_->MarkDirty();
 }
 
 void Achievements::AddAchievement(String message, 
@@ -367,7 +534,10 @@ void Achievements::AddAchievement(String message,
 
 //    URHO3D_LOGINFOF("Registering achievement [%s]", rule.message.CString());
 
-    SubscribeToEvent(eventName, URHO3D_HANDLER(Achievements, HandleRegisteredEvent));
+    if (!rule.completed) {
+        matchers_[eventName].Add(&registeredAchievements_[eventName].Back());
+        SubscribeToEvent(eventName, URHO3D_HANDLER(Achievements, HandleRegisteredEvent));
+    }
 
     if (GetSubsystem<DebugHud>()) {
         GetSubsystem<DebugHud>()->SetAppStats("Total achievements loaded", CountAchievements());
@@ -1,8 +1,8 @@
 #pragma once
 
 #include <Urho3D/Container/List.h>
-#include <Urho3D/Core/WorkQueue.h>
 #include "SingleAchievement.h"
+#include "../State/DeferredWriter.h"
 
 using namespace Urho3D;
 
@@ -47,7 +47,36 @@ struct AchievementRule {
     bool deepCheck;
 };
 
-class Achievements : public Object
+/**
+ * Active rules of a single event, deep check rules are bucketed by parameter name and value hash
+ * so that only the rules which match the event data are visited
+ */
+class AchievementMatcher
+{
+public:
+    void Add(AchievementRule* rule);
+
+    void Remove(AchievementRule* rule);
+
+    /**
+     * Collect rules which match the event data
+     */
+    void Match(const VariantMap& eventData, PODVector<AchievementRule*>& result) const;
+
+    bool Empty() const { return unconditional_.Empty() && parameters_.Empty(); }
+
+    static unsigned GetValueHash(const Variant& value);
+
+private:
+    PODVector<AchievementRule*> unconditional_;
+
+    /**
+     * Parameter name -> value hash -> rules
+     */
+    HashMap<StringHash, HashMap<unsigned, PODVector<AchievementRule*>>> parameters_;
+};
+
+class Achievements : public Object, public DeferredWriteSource
 {
     URHO3D_OBJECT(Achievements, Object);
 
@@ -73,9 +102,17 @@ public:
      */
     void ClearAchievementsProgress();
 
-private:
-    friend void SaveProgressAsync(const WorkItem* item, unsigned threadIndex);
+    /**
+     * Compare linear rule scan with the compiled matcher on generated rules
+     */
+    void RunMatcherBenchmark(unsigned ruleCount, unsigned eventCount);
 
+    /**
+     * Wait for the running save and write pending progress right away
+     */
+    void Flush();
+
+private:
     /**
      * Initialize achievements
      */
@@ -112,15 +149,25 @@ private:
      */
     void HandleRegisteredEvent(StringHash eventType, VariantMap& eventData);
 
+    /**
+     * Rebuild matchers from all incomplete rules
+     */
+    void RebuildMatchers();
+
     /**
      * Load achievements configuration
      */
     void LoadAchievementList();
 
     /**
-     * Save achievement progress
+     * Copy current progress for the progress writer
+     */
+    void PrepareWrite() override;
+
+    /**
+     * Save achievement progress snapshot, runs on a worker thread
      */
-    void SaveProgress();
+    bool Write() override;
 
     /**
      * Load achievement progress
@@ -155,6 +202,11 @@ private:
      */
     HashMap<StringHash, List<AchievementRule>> registeredAchievements_;
 
+    /**
+     * Incomplete rules of each event
+     */
+    HashMap<StringHash, AchievementMatcher> matchers_;
+
     /**
      * All achievements
      */
@@ -164,4 +216,15 @@ private:
      * Current achievement progress
      */
     HashMap<String, int> progress_;
+
+    /**
+     * Progress copy owned by the running save
+     */
+    HashMap<String, int> pendingProgress_;
+
+    /**
+     * Progress changes are saved in the background, bursts of events are written once.
+     * Declared last, so that it waits for the running save before the saved data is destroyed
+     */
+    SharedPtr<DeferredWriter> writer_;
 };
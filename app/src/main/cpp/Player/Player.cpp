@@ -192,6 +192,9 @@ void Player::CreateNode(Scene* scene, int controllerId, Terrain* terrain, int ty
     playerState->SetPlayerID(controllerId_);
     URHO3D_LOGINFOF("Creating player node=%d, playerstate=%d", node_->GetID(), playerState->GetID());
     node_->SetVar("Player", controllerId_);
+    if (connection_) {
+        node_->SetOwner(connection_);
+    }
 
     node_->SetPosition(Vector3(0, 2, 0));
     SetScale(0.9f);
@@ -468,6 +471,10 @@ void Player::HandleNodeCollision(StringHash eventType, VariantMap& eventData)
 void Player::SetClientConnection(Connection* connection)
 {
     connection_ = connection;
+    // Server finds the node which streams chunks to this connection through the owner
+    if (node_) {
+        node_->SetOwner(connection_);
+    }
     selectedItemUI_->Remove();
     selectedItemUI_.Reset();
     positionUI_->Remove();
@@ -536,10 +543,14 @@ void Player::HandleMappedControlPressed(StringHash eventType, VariantMap& eventD
         if (action == CTRL_CHANGE_ITEM) {
 #ifdef VOXEL_SUPPORT
             if (GetSubsystem<VoxelWorld>()) {
-                selectedItem_++;
-                if (selectedItem_ >= BlockType::BT_NONE) {
-                    selectedItem_ = 1;
-                }
+                // Skip air and IDs which are not used by any block
+                auto blocks = GetSubsystem<BlockRegistry>();
+                do {
+                    selectedItem_++;
+                    if (selectedItem_ >= static_cast<int>(blocks->GetIdRange())) {
+                        selectedItem_ = 1;
+                    }
+                } while (blocks->GetName(static_cast<BlockType>(selectedItem_)).Empty() && selectedItem_ != 1);
                 selectedItemUI_->SetText(GetSubsystem<VoxelWorld>()->GetBlockName(static_cast<BlockType>(selectedItem_)));
             }
 #endif
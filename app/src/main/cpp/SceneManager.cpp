@@ -4,15 +4,22 @@
 #include <Urho3D/IO/Log.h>
 #include <Urho3D/IO/IOEvents.h>
 #include <Urho3D/Core/Context.h>
+#include <Urho3D/Resource/XMLFile.h>
+#include <Urho3D/Resource/ResourceEvents.h>
 
 #ifdef URHO3D_ANGELSCRIPT
 #include <Urho3D/AngelScript/Script.h>
 #endif
 #include <Urho3D/Core/CoreEvents.h>
+#include <Urho3D/Engine/Engine.h>
+#include <Urho3D/Container/Sort.h>
+#include <Urho3D/Container/HashSet.h>
 #include "SceneManager.h"
 #include "SceneManagerEvents.h"
 #include "Console/ConsoleHandlerEvents.h"
 #include "LevelManagerEvents.h"
+#include "Config/ConfigManager.h"
+#include "LevelManager.h"
 
 using namespace Urho3D;
 using namespace ConsoleHandlerEvents;
@@ -25,12 +32,14 @@ using namespace LevelManagerEvents;
 const int LOADING_STEP_ACK_MAX_TIME       = 2000; // Max wait time in MS for ACK message for loading step
 const int LOADING_STEP_MAX_EXECUTION_TIME = 10 * 1000; // Max loading step execution time in MS, 0 - infinite
 const float PROGRESS_SPEED                = 1.0f; // how fast should the progress bar increase each second, e.g. 1 would load 0 to 100% in 1 second
+const float ASYNC_LOADING_FRAME_RESERVE   = 2.0f; // MS of each frame left for the loading screen itself when adaptive budget is used
 
 SceneManager::SceneManager(Context* context) :
         Object(context)
 {
     SubscribeToEvent(E_REGISTER_LOADING_STEP, URHO3D_HANDLER(SceneManager, HandleRegisterLoadingStep));
     SubscribeToEvent(E_ADD_MAP, URHO3D_HANDLER(SceneManager, HandleAddMap));
+    SubscribeToEvent(E_RESOURCEBACKGROUNDLOADED, URHO3D_HANDLER(SceneManager, HandleResourceBackgroundLoaded));
     SubscribeToEvent(E_LOADING_STEP_CRITICAL_FAIL, [&](StringHash eventType, VariantMap &eventData) {
         UnsubscribeFromEvent(E_UPDATE);
         using namespace LoadingStepCriticalFail;
@@ -41,6 +50,8 @@ SceneManager::SceneManager(Context* context) :
         SendEvent(E_SET_LEVEL, data);
     });
 
+    loadingProfiler_ = new LoadingProfiler(context_);
+
     LoadDefaultMaps();
 }
 
@@ -56,13 +67,20 @@ void SceneManager::RegisterObject(Context* context)
 void SceneManager::LoadScene(const String& filename)
 {
     ResetProgress();
+    loadingTimer_.Reset();
     activeScene_.Reset();
     activeScene_ = new Scene(context_);
-    activeScene_->SetAsyncLoadingMs(1);
+    asyncLoadingBudget_ = Max(GetSubsystem<ConfigManager>()->GetInt("game", "AsyncLoadingMs", 1), 1);
+    activeScene_->SetAsyncLoadingMs((int) asyncLoadingBudget_);
     auto xmlFile = GetSubsystem<ResourceCache>()->GetFile(filename);
     activeScene_->LoadAsyncXML(xmlFile);
     loadingStatus_ = "Loading scene";
 
+    SubscribeToFrameTiming();
+
+    loadingProfiler_->BeginMap(filename);
+    loadingProfiler_->StepStarted("Scene", "Loading scene", StringVector());
+
     if (GetSubsystem<DebugHud>()) {
         GetSubsystem<DebugHud>()->SetAppStats("Scene manager map", filename);
     }
@@ -85,6 +103,146 @@ void SceneManager::LoadScene(const String& filename)
             activeScene_->Clear(true, false);
         }
     });
+
+    SendEvent(E_CONSOLE_COMMAND_ADD, ConsoleCommandAdd::P_NAME, "map_preload", ConsoleCommandAdd::P_EVENT, "#map_preload",
+              ConsoleCommandAdd::P_DESCRIPTION, "Load map resources in the background [map]", ConsoleCommandAdd::P_OVERWRITE, true);
+    SubscribeToEvent("#map_preload", [&](StringHash eventType, VariantMap& eventData) {
+        StringVector params = eventData["Parameters"].GetStringVector();
+        if (params.Size() != 2) {
+            URHO3D_LOGERROR("map_preload expects map filename, e.g. Scenes/Flat.xml");
+            return;
+        }
+        PreloadMap(params[1]);
+    });
+
+    SendEvent(E_CONSOLE_COMMAND_ADD, ConsoleCommandAdd::P_NAME, "loading_benchmark", ConsoleCommandAdd::P_EVENT, "#loading_benchmark",
+              ConsoleCommandAdd::P_DESCRIPTION, "Measure load time of each map with the given async loading budgets in MS, 0 - adaptive [budget...]",
+              ConsoleCommandAdd::P_OVERWRITE, true);
+    SubscribeToEvent("#loading_benchmark", [&](StringHash eventType, VariantMap& eventData) {
+        StringVector params = eventData["Parameters"].GetStringVector();
+        if (!benchmarkQueue_.Empty() || (activeScene_ && activeScene_->IsAsyncLoading())) {
+            URHO3D_LOGWARNING("Scene loading already in progress, try again later");
+            return;
+        }
+        PODVector<int> budgets;
+        for (unsigned i = 1; i < params.Size(); i++) {
+            budgets.Push(Max(ToInt(params[i]), 0));
+        }
+        if (budgets.Empty()) {
+            budgets.Push(1);
+            budgets.Push(5);
+            budgets.Push(0);
+        }
+        for (auto map = availableMaps_.Begin(); map != availableMaps_.End(); ++map) {
+            for (auto budget = budgets.Begin(); budget != budgets.End(); ++budget) {
+                benchmarkQueue_.Push(MakePair((*map).map, *budget));
+            }
+        }
+        StartLoadingBenchmark();
+    });
+}
+
+void SceneManager::UpdateAsyncLoadingBudget()
+{
+    bool benchmarkAdaptive = benchmarkScene_ && !benchmarkQueue_.Empty() && benchmarkQueue_.Front().second_ == 0;
+    bool loading = activeScene_ && activeScene_->IsAsyncLoading();
+    if (benchmarkScene_) {
+        benchmarkFrames_++;
+    }
+    if (!loading && !benchmarkAdaptive) {
+        if (!benchmarkScene_) {
+            UnsubscribeFromEvent(E_BEGINFRAME);
+            UnsubscribeFromEvent(E_ENDFRAME);
+        }
+        return;
+    }
+
+    float minBudget = Max(GetSubsystem<ConfigManager>()->GetInt("game", "AsyncLoadingMs", 1), 1);
+    auto levelManager = GetSubsystem<LevelManager>();
+    bool gameplay = levelManager && levelManager->GetCurrentLevel() == "Level";
+    if (gameplay || !GetSubsystem<ConfigManager>()->GetBool("game", "AdaptiveAsyncLoading", true)) {
+        // Streamed scene shares the frame with the game, loading must not cause hitches
+        asyncLoadingBudget_ = minBudget;
+    } else {
+        int maxFps = GetSubsystem<Engine>()->GetMaxFps();
+        float frameTarget = 1000.0f / (maxFps > 0 ? maxFps : 60);
+        float maxBudget = Max(frameTarget - ASYNC_LOADING_FRAME_RESERVE, minBudget);
+        float frameTime = frameTimer_.GetUSec(false) / 1000.0f;
+        if (frameTime < frameTarget) {
+            // Take half of the idle time each frame so that the budget settles without overshooting
+            asyncLoadingBudget_ += (frameTarget - frameTime) * 0.5f;
+        } else {
+            asyncLoadingBudget_ *= 0.75f;
+        }
+        asyncLoadingBudget_ = Clamp(asyncLoadingBudget_, minBudget, maxBudget);
+    }
+
+    if (loading) {
+        activeScene_->SetAsyncLoadingMs((int) asyncLoadingBudget_);
+    }
+    if (benchmarkAdaptive) {
+        benchmarkScene_->SetAsyncLoadingMs((int) asyncLoadingBudget_);
+    }
+
+    if (GetSubsystem<DebugHud>()) {
+        GetSubsystem<DebugHud>()->SetAppStats("Async loading budget", (int) asyncLoadingBudget_);
+    }
+}
+
+void SceneManager::StartLoadingBenchmark()
+{
+    if (benchmarkQueue_.Empty()) {
+        benchmarkScene_.Reset();
+        URHO3D_LOGINFO("Loading benchmark finished");
+        return;
+    }
+
+    const String& map = benchmarkQueue_.Front().first_;
+    int budget = benchmarkQueue_.Front().second_;
+
+    // Every run starts with a cold cache, except for the retained resources
+    benchmarkScene_.Reset();
+    GetSubsystem<ResourceCache>()->ReleaseAllResources(false);
+
+    // Async loading only advances in the scene update, the scene is dropped in HandleEndFrame before it
+    // gets a regular update
+    benchmarkScene_ = new Scene(context_);
+    asyncLoadingBudget_ = Max(GetSubsystem<ConfigManager>()->GetInt("game", "AsyncLoadingMs", 1), 1);
+    benchmarkScene_->SetAsyncLoadingMs(budget > 0 ? budget : (int) asyncLoadingBudget_);
+    benchmarkFrames_ = 0;
+    benchmarkTimer_.Reset();
+    SubscribeToFrameTiming();
+
+    if (!benchmarkScene_->LoadAsyncXML(GetSubsystem<ResourceCache>()->GetFile(map))) {
+        URHO3D_LOGERROR("Loading benchmark failed to load " + map);
+        benchmarkQueue_.Erase(0);
+        StartLoadingBenchmark();
+    }
+}
+
+void SceneManager::SubscribeToFrameTiming()
+{
+    SubscribeToEvent(E_BEGINFRAME, [&](StringHash eventType, VariantMap& eventData) {
+        frameTimer_.Reset();
+    });
+    SubscribeToEvent(E_ENDFRAME, URHO3D_HANDLER(SceneManager, HandleEndFrame));
+}
+
+void SceneManager::HandleEndFrame(StringHash eventType, VariantMap& eventData)
+{
+    // Benchmark scene is replaced here rather than in its own finished event
+    if (benchmarkScene_ && !benchmarkScene_->IsAsyncLoading()) {
+        const String& map = benchmarkQueue_.Front().first_;
+        int budget = benchmarkQueue_.Front().second_;
+        String budgetName = budget > 0 ? String(budget) + " ms" : "adaptive";
+        URHO3D_LOGINFOF("Loading benchmark '%s' budget %s: %.1f ms, %u frames", map.CString(), budgetName.CString(),
+                        benchmarkTimer_.GetUSec(false) / 1000.0f, benchmarkFrames_);
+
+        benchmarkQueue_.Erase(0);
+        StartLoadingBenchmark();
+    }
+
+    UpdateAsyncLoadingBudget();
 }
 
 void SceneManager::HandleAsyncSceneLoadingProgress(StringHash eventType, VariantMap& eventData)
@@ -115,11 +273,22 @@ void SceneManager::HandleAsyncSceneLoadingFinished(StringHash eventType, Variant
     UnsubscribeFromEvent(E_ASYNCLOADPROGRESS);
     UnsubscribeFromEvent(E_ASYNCLOADFINISHED);
 
+    loadingProfiler_->StepFinished("Scene", false);
+
+    // Scene holds its own resources now, remember which of them are shared with other maps
+    GetMapResources(activeScene_->GetFileName());
+    if (preloadMap_ == activeScene_->GetFileName()) {
+        preloadMap_.Clear();
+    }
+    UpdateRetainedResources();
+
     SubscribeToEvent(E_ACK_LOADING_STEP, URHO3D_HANDLER(SceneManager, HandleLoadingStepAck));
     SubscribeToEvent(E_LOADING_STEP_PROGRESS, URHO3D_HANDLER(SceneManager, HandleLoadingStepProgress));
     SubscribeToEvent(E_LOADING_STEP_FINISHED, URHO3D_HANDLER(SceneManager, HandleLoadingStepFinished));
     SubscribeToEvent(E_LOADING_STEP_SKIP, URHO3D_HANDLER(SceneManager, HandleSkipLoadingStep));
 
+    SubscribeToEvent(E_WORKITEMCOMPLETED, URHO3D_HANDLER(SceneManager, HandleWorkItemCompleted));
+
     SubscribeToEvent(E_UPDATE, URHO3D_HANDLER(SceneManager, HandleUpdate));
     URHO3D_LOGINFO("Scene loaded: " + activeScene_->GetFileName());
 }
@@ -143,75 +312,75 @@ void SceneManager::HandleUpdate(StringHash eventType, VariantMap& eventData)
         progress_ = targetProgress_;
     }
 
-    float completed = 1;
-    targetProgress_ = (float)completed / ( (float) loadingSteps_.Size() + 1.0f );
-    for (auto it = loadingSteps_.Begin(); it != loadingSteps_.End(); ++it) {
-        if ((*it).second_.finished) {
-            completed++;
-        }
-        if ((*it).second_.ackSent && !(*it).second_.ack && (*it).second_.ackTimer.GetMSec(false) > LOADING_STEP_ACK_MAX_TIME) {
-            (*it).second_.finished = true;
-            (*it).second_.ack      = true;
-        }
-        targetProgress_ = (float)completed / ( (float) loadingSteps_.Size() + 1.0f );
-
-        if (!(*it).second_.map.Empty() && (*it).second_.map != activeScene_->GetFileName()) {
-            (*it).second_.finished = true;
-            continue;
-        }
-
-        if (CanLoadingStepRun((*it).second_)) {
-
-            //TODO: implement fix for web builds as the loading steps might take longer to execute
-            // due to the inactive browsers tabs where game is running in the background
-            // Handle loading steps which take too much time to execute
-            if ((*it).second_.ackSent && (*it).second_.ackTimer.GetMSec(false) > LOADING_STEP_MAX_EXECUTION_TIME + LOADING_STEP_ACK_MAX_TIME) {
-                (*it).second_.finished = true;
-                (*it).second_.failed   = true;
-                URHO3D_LOGERROR("Loading step '" + (*it).second_.name + "' failed, took too long to execute!");
-
-                using namespace LoadingStepTimedOut;
-                VariantMap& data = GetEventDataMap();
-                data[P_EVENT] = (*it).second_.event;
-                SendEvent(E_LOADING_STEP_TIMED_OUT, data);
-                URHO3D_LOGINFO("Loading step skipped, no ACK retrieved for " + (*it).second_.name);
-                return;
-
-                // Note the the tasks could still succeed in the background, but the loading screen will move further without waiting it to finish
-                return;
+    // Steps which finish right in their start event handler unlock their dependants in the same frame
+    bool started = true;
+    while (started) {
+        started = false;
+        // Start events can register new loading steps, so the steps to start are collected first
+        StringVector ready;
+        for (auto it = loadingSteps_.Begin(); it != loadingSteps_.End(); ++it) {
+            LoadingStep& step = (*it).second_;
+            if (step.finished) {
+                continue;
             }
-            if (!(*it).second_.ackSent) {
-
-                if (loadingStatus_ != (*it).second_.name) {
-                    loadingStatus_ = (*it).second_.name;
-                    // Delay loading step execution till the next frame
-                    // to allow the status to be updated
-                    using namespace LoadingStatusUpdate;
-                    VariantMap data;
-                    data[P_NAME] = (*it).second_.name;
-                    SendEvent(E_LOADING_STATUS_UPDATE, data);
-                    return;
+            if (!step.map.Empty() && step.map != activeScene_->GetFileName()) {
+                step.finished = true;
+                continue;
+            }
+
+            if (step.ackSent) {
+                if (!step.ack && step.ackTimer.GetMSec(false) > LOADING_STEP_ACK_MAX_TIME) {
+                    URHO3D_LOGINFO("Loading step skipped, no ACK retrieved for " + step.name);
+                    step.ack = true;
+                    loadingProfiler_->StepTimedOut(step.event);
+                    FinishLoadingStep(step);
+                    started = true;
+                }
+                //TODO: implement fix for web builds as the loading steps might take longer to execute
+                // due to the inactive browsers tabs where game is running in the background
+                // Handle loading steps which take too much time to execute
+                else if (!step.workItem && step.ackTimer.GetMSec(false) > LOADING_STEP_MAX_EXECUTION_TIME + LOADING_STEP_ACK_MAX_TIME) {
+                    URHO3D_LOGERROR("Loading step '" + step.name + "' failed, took too long to execute!");
+                    loadingProfiler_->StepTimedOut(step.event);
+                    FinishLoadingStep(step, true);
+                    started = true;
+
+                    // Note the the tasks could still succeed in the background, but the loading screen will move further without waiting it to finish
+                    using namespace LoadingStepTimedOut;
+                    VariantMap& data = GetEventDataMap();
+                    data[P_EVENT] = step.event;
+                    SendEvent(E_LOADING_STEP_TIMED_OUT, data);
                 }
+                continue;
+            }
 
-                VariantMap data;
-                data["Map"] = activeScene_->GetFileName();
-                // Send out event to start this loading step
-                SendEvent((*it).second_.event, data);
+            if (CanLoadingStepRun(step)) {
+                ready.Push(step.event);
+            }
+        }
 
-                // We register that start event was sent out, loading step must send back ACK message
-                // to let us know that the loading step was started, otherwise it will be automatically
-                // marked as a finished job, to avoid app inifite loading
-                (*it).second_.ackSent = true;
-                (*it).second_.ackTimer.Reset();
+        for (auto it = ready.Begin(); it != ready.End(); ++it) {
+            auto step = loadingSteps_.Find(*it);
+            if (step != loadingSteps_.End() && !(*step).second_.ackSent) {
+                StartLoadingStep((*step).second_);
+                started = true;
             }
-            completed += (*it).second_.progress;
-            targetProgress_ = (float)completed / ( (float) loadingSteps_.Size() + 1.0f );
-            return;
         }
+    }
 
+    float completed = 1;
+    bool allFinished = true;
+    for (auto it = loadingSteps_.Begin(); it != loadingSteps_.End(); ++it) {
+        if ((*it).second_.finished) {
+            completed++;
+        } else {
+            completed += (*it).second_.progress;
+            allFinished = false;
+        }
     }
+    targetProgress_ = completed / ((float) loadingSteps_.Size() + 1.0f);
 
-    if (progress_ >= 1.0f) {
+    if (allFinished && progress_ >= 1.0f) {
         progress_ = 1.0f;
         UnsubscribeFromEvent(E_UPDATE);
 
@@ -222,11 +391,102 @@ void SceneManager::HandleUpdate(StringHash eventType, VariantMap& eventData)
         UnsubscribeFromEvent(E_LOADING_STEP_PROGRESS);
         UnsubscribeFromEvent(E_LOADING_STEP_FINISHED);
         UnsubscribeFromEvent(E_LOADING_STEP_SKIP);
+        UnsubscribeFromEvent(E_WORKITEMCOMPLETED);
 
+        loadingProfiler_->EndMap();
+        LogLoadingReport();
         CleanupLoadingSteps();
     }
 }
 
+void SceneManager::StartLoadingStep(LoadingStep& loadingStep)
+{
+    loadingStatus_ = loadingStep.name;
+    {
+        using namespace LoadingStatusUpdate;
+        VariantMap data;
+        data[P_NAME] = loadingStep.name;
+        SendEvent(E_LOADING_STATUS_UPDATE, data);
+    }
+
+    // We register that start event was sent out, loading step must send back ACK message
+    // to let us know that the loading step was started, otherwise it will be automatically
+    // marked as a finished job, to avoid app inifite loading
+    loadingStep.ackSent = true;
+    loadingStep.ackTimer.Reset();
+    loadingStep.loadTime.Reset();
+    loadingStep.startTime = loadingTimer_.GetMSec(false);
+    loadingProfiler_->StepStarted(loadingStep.event, loadingStep.name, loadingStep.dependsOn);
+
+    if (loadingStep.workFunction) {
+        // Work item is its own ACK, it's finished by the E_WORKITEMCOMPLETED event
+        loadingStep.ack = true;
+        loadingProfiler_->StepAcked(loadingStep.event);
+        auto workQueue = GetSubsystem<WorkQueue>();
+        loadingStep.workItem = workQueue->GetFreeItem();
+        loadingStep.workItem->workFunction_ = loadingStep.workFunction;
+        loadingStep.workItem->aux_ = loadingStep.workData;
+        loadingStep.workItem->priority_ = M_MAX_UNSIGNED;
+        loadingStep.workItem->sendEvent_ = true;
+        workQueue->AddWorkItem(loadingStep.workItem);
+        URHO3D_LOGINFO("Loading step '" + loadingStep.name + "' started on worker thread");
+        return;
+    }
+
+    VariantMap data;
+    data["Map"] = activeScene_->GetFileName();
+    // Send out event to start this loading step
+    SendEvent(loadingStep.event, data);
+}
+
+void SceneManager::FinishLoadingStep(LoadingStep& loadingStep, bool failed)
+{
+    if (loadingStep.finished) {
+        return;
+    }
+    loadingStep.finished = true;
+    loadingStep.failed = failed;
+    loadingStep.duration = loadingStep.ackSent ? loadingStep.loadTime.GetMSec(false) : 0;
+    if (loadingStep.ackSent) {
+        loadingProfiler_->StepFinished(loadingStep.event, failed);
+    }
+}
+
+void SceneManager::LogLoadingReport()
+{
+    Vector<LoadingStep*> steps;
+    for (auto it = loadingSteps_.Begin(); it != loadingSteps_.End(); ++it) {
+        if ((*it).second_.ackSent) {
+            steps.Push(&(*it).second_);
+        }
+    }
+    Sort(steps.Begin(), steps.End(), [](const LoadingStep* lhs, const LoadingStep* rhs) {
+        return lhs->startTime < rhs->startTime;
+    });
+
+    URHO3D_LOGINFOF("Scene loaded in %u ms", loadingTimer_.GetMSec(false));
+    for (auto it = steps.Begin(); it != steps.End(); ++it) {
+        URHO3D_LOGINFOF("Loading step '%s' started at %u ms, took %u ms%s", (*it)->name.CString(), (*it)->startTime,
+                        (*it)->duration, (*it)->failed ? " (failed)" : "");
+    }
+
+    URHO3D_LOGINFO("Loading critical path: " + loadingProfiler_->GetCriticalPathString(loadingProfiler_->GetCurrentMap()));
+}
+
+void SceneManager::HandleWorkItemCompleted(StringHash eventType, VariantMap& eventData)
+{
+    using namespace WorkItemCompleted;
+    WorkItem* item = static_cast<WorkItem*>(eventData[P_ITEM].GetPtr());
+    for (auto it = loadingSteps_.Begin(); it != loadingSteps_.End(); ++it) {
+        if ((*it).second_.workItem == item) {
+            FinishLoadingStep((*it).second_);
+            (*it).second_.workItem.Reset();
+            URHO3D_LOGINFO("Loading step " + (*it).second_.event + " finished");
+            return;
+        }
+    }
+}
+
 void SceneManager::ResetProgress()
 {
     progress_       = 0.0f;
@@ -237,6 +497,8 @@ void SceneManager::ResetProgress()
         (*it).second_.ack      = false;
         (*it).second_.ackSent  = false;
         (*it).second_.progress = 0.0f;
+        (*it).second_.failed   = false;
+        (*it).second_.duration = 0;
     }
 }
 
@@ -253,6 +515,10 @@ void SceneManager::HandleRegisterLoadingStep(StringHash eventType, VariantMap& e
     step.progress = 0;
     step.autoRemove = false;
     step.dependsOn = eventData[P_DEPENDS_ON].GetStringVector();
+    step.workFunction = reinterpret_cast<void (*)(const WorkItem*, unsigned)>(eventData[P_WORK_FUNCTION].GetVoidPtr());
+    step.workData = eventData[P_WORK_DATA].GetVoidPtr();
+    step.startTime = 0;
+    step.duration = 0;
 
     if (eventData.Contains(P_REMOVE_ON_FINISH) && eventData[P_REMOVE_ON_FINISH].GetBool()) {
         step.autoRemove = true;
@@ -277,7 +543,7 @@ void SceneManager::HandleLoadingStepAck(StringHash eventType, VariantMap& eventD
     String name = eventData[P_EVENT].GetString();
 
     loadingSteps_[name].ack = true;
-    loadingSteps_[name].loadTime.Reset();
+    loadingProfiler_->StepAcked(name);
     URHO3D_LOGINFO("Loading step  '" + name + "' acknowlished");
 }
 
@@ -288,6 +554,7 @@ void SceneManager::HandleLoadingStepProgress(StringHash eventType, VariantMap& e
     float progress = eventData[P_PROGRESS].GetFloat();
     progress       = Clamp(progress, 0.0f, 1.0f);
     loadingSteps_[event].progress = progress;
+    loadingProfiler_->StepProgress(event, progress);
 
     URHO3D_LOGINFO("Loading step progress update '" + event + "' : " + String(progress));
 }
@@ -297,7 +564,7 @@ void SceneManager::HandleLoadingStepFinished(StringHash eventType, VariantMap& e
     using namespace LoadingStepFinished;
     String event = eventData[P_EVENT].GetString();
 
-    loadingSteps_[event].finished = true;
+    FinishLoadingStep(loadingSteps_[event]);
 
     URHO3D_LOGINFO("Loading step " + event + " finished");
 }
@@ -307,7 +574,7 @@ void SceneManager::HandleSkipLoadingStep(StringHash eventType, VariantMap& event
     using namespace LoadingStepSkip;
     String event = eventData[P_EVENT].GetString();
     if (loadingSteps_.Contains(event)) {
-        loadingSteps_[event].finished = true;
+        FinishLoadingStep(loadingSteps_[event]);
     }
 }
 
@@ -421,3 +688,132 @@ const MapInfo* SceneManager::GetCurrentMapInfo() const
 {
     return currentMap_;
 }
+
+void SceneManager::PreloadMap(const String& filename)
+{
+    if (filename == preloadMap_ || (activeScene_ && activeScene_->GetFileName() == filename)) {
+        return;
+    }
+
+    preloadMap_ = filename;
+    auto cache = GetSubsystem<ResourceCache>();
+    const StringVector& resources = GetMapResources(filename);
+    unsigned queued = 0;
+    for (auto it = resources.Begin(); it != resources.End(); ++it) {
+        StringVector parts = (*it).Split(';');
+        if (!cache->GetExistingResource(StringHash(parts[0]), parts[1]) && cache->BackgroundLoadResource(StringHash(parts[0]), parts[1])) {
+            queued++;
+        }
+    }
+    URHO3D_LOGINFOF("Preloading map '%s', %u of %u resources queued", filename.CString(), queued, resources.Size());
+
+    UpdateRetainedResources();
+}
+
+const StringVector& SceneManager::GetMapResources(const String& filename)
+{
+    auto it = mapResources_.Find(filename);
+    if (it != mapResources_.End()) {
+        return (*it).second_;
+    }
+
+    StringVector& resources = mapResources_[filename];
+    // Temporary resource, the scene file itself is not kept in the cache
+    SharedPtr<XMLFile> xmlFile = GetSubsystem<ResourceCache>()->GetTempResource<XMLFile>(filename);
+    if (!xmlFile) {
+        URHO3D_LOGERROR("Unable to read map resources from " + filename);
+        return resources;
+    }
+
+    const HashMap<StringHash, SharedPtr<ObjectFactory>>& factories = context_->GetObjectFactories();
+    PODVector<XMLElement> stack;
+    stack.Push(xmlFile->GetRoot());
+    while (!stack.Empty()) {
+        XMLElement element = stack.Back();
+        stack.Pop();
+        for (XMLElement child = element.GetChild(); child; child = child.GetNext()) {
+            stack.Push(child);
+        }
+
+        // ResourceRef is stored as "Type;Name", ResourceRefList as "Type;Name1;Name2..."
+        StringVector parts = element.GetAttribute("value").Split(';');
+        if (element.GetName() != "attribute" || parts.Size() < 2 || !factories.Contains(StringHash(parts[0]))) {
+            continue;
+        }
+        for (unsigned i = 1; i < parts.Size(); i++) {
+            String resource = parts[0] + ";" + parts[i];
+            if (!parts[i].Empty() && !resources.Contains(resource)) {
+                resources.Push(resource);
+            }
+        }
+    }
+    return resources;
+}
+
+void SceneManager::UpdateRetainedResources()
+{
+    bool retainShared = GetSubsystem<ConfigManager>()->GetBool("game", "RetainSharedResources", true);
+
+    HashMap<String, unsigned> usage;
+    for (auto it = mapResources_.Begin(); it != mapResources_.End(); ++it) {
+        for (auto resource = (*it).second_.Begin(); resource != (*it).second_.End(); ++resource) {
+            usage[*resource]++;
+        }
+    }
+
+    HashSet<String> wanted;
+    if (retainShared) {
+        for (auto it = usage.Begin(); it != usage.End(); ++it) {
+            if ((*it).second_ > 1) {
+                wanted.Insert((*it).first_);
+            }
+        }
+    }
+    if (!preloadMap_.Empty()) {
+        const StringVector& resources = GetMapResources(preloadMap_);
+        for (auto it = resources.Begin(); it != resources.End(); ++it) {
+            wanted.Insert(*it);
+        }
+    }
+
+    for (auto it = retainedResources_.Begin(); it != retainedResources_.End();) {
+        if (!wanted.Contains((*it).first_)) {
+            it = retainedResources_.Erase(it);
+        } else {
+            ++it;
+        }
+    }
+
+    // Resources which are still loading are picked up in HandleResourceBackgroundLoaded
+    auto cache = GetSubsystem<ResourceCache>();
+    for (auto it = wanted.Begin(); it != wanted.End(); ++it) {
+        if (!retainedResources_.Contains(*it)) {
+            StringVector parts = (*it).Split(';');
+            SharedPtr<Resource> resource(cache->GetExistingResource(StringHash(parts[0]), parts[1]));
+            if (resource) {
+                retainedResources_[*it] = resource;
+            }
+        }
+    }
+
+    if (GetSubsystem<DebugHud>()) {
+        GetSubsystem<DebugHud>()->SetAppStats("Retained resources", retainedResources_.Size());
+    }
+}
+
+void SceneManager::HandleResourceBackgroundLoaded(StringHash eventType, VariantMap& eventData)
+{
+    using namespace ResourceBackgroundLoaded;
+    if (preloadMap_.Empty() || !eventData[P_SUCCESS].GetBool()) {
+        return;
+    }
+
+    auto* resource = static_cast<Resource*>(eventData[P_RESOURCE].GetPtr());
+    String key = resource->GetTypeName() + ";" + eventData[P_RESOURCENAME].GetString();
+    if (GetMapResources(preloadMap_).Contains(key)) {
+        retainedResources_[key] = resource;
+        if (GetSubsystem<DebugHud>()) {
+            GetSubsystem<DebugHud>()->SetAppStats("Retained resources", retainedResources_.Size());
+        }
+    }
+}
@@ -4,6 +4,9 @@
 #include <Urho3D/Core/Timer.h>
 #include <Urho3D/Scene/Scene.h>
 #include <Urho3D/Container/Vector.h>
+#include <Urho3D/Core/WorkQueue.h>
+#include <Urho3D/Resource/Resource.h>
+#include "LoadingProfiler.h"
 
 using namespace Urho3D;
 
@@ -20,6 +23,13 @@ struct LoadingStep {
     bool autoRemove;
     StringVector dependsOn;
     String map;
+    // Optional function which runs on the WorkQueue instead of the start event handler
+    void (*workFunction)(const WorkItem*, unsigned);
+    void* workData;
+    SharedPtr<WorkItem> workItem;
+    // Milliseconds since the scene loading started
+    unsigned startTime;
+    unsigned duration;
 };
 
 struct MapInfo {
@@ -73,14 +83,81 @@ public:
 
     const MapInfo* GetCurrentMapInfo() const;
 
+    /**
+     * Start loading resources of the map scene in the background, so that the
+     * next LoadScene call finds them already in the resource cache
+     */
+    void PreloadMap(const String& filename);
+
+    /**
+     * Number of resources which are kept alive between level switches
+     */
+    unsigned GetRetainedResourceCount() const { return retainedResources_.Size(); }
+
 private:
 
+    /**
+     * Collect "Type;Name" resource references from the scene file attributes
+     */
+    const StringVector& GetMapResources(const String& filename);
+
+    /**
+     * Hold references to the preloaded resources and the ones shared between multiple maps,
+     * everything else is released by the LevelManager after the level switch
+     */
+    void UpdateRetainedResources();
+
+    /**
+     * Preloaded resource is ready
+     */
+    void HandleResourceBackgroundLoaded(StringHash eventType, VariantMap& eventData);
+
+    /**
+     * Grow async loading time slice while only the loading screen is shown, shrink it during gameplay
+     */
+    void UpdateAsyncLoadingBudget();
+
+    /**
+     * Load the next map of the benchmark queue into a temporary scene
+     */
+    void StartLoadingBenchmark();
+
+    /**
+     * Measure frame time without the frame limiter sleep while any scene is loading
+     */
+    void SubscribeToFrameTiming();
+
+    /**
+     * Adjust the loading budget and move the benchmark forward
+     */
+    void HandleEndFrame(StringHash eventType, VariantMap& eventData);
+
     void CleanupLoadingSteps();
 
     void LoadDefaultMaps();
 
     bool CanLoadingStepRun(LoadingStep& loadingStep);
 
+    /**
+     * Send the start event or queue the work function of the loading step
+     */
+    void StartLoadingStep(LoadingStep& loadingStep);
+
+    /**
+     * Mark loading step as finished and remember how long it took
+     */
+    void FinishLoadingStep(LoadingStep& loadingStep, bool failed = false);
+
+    /**
+     * Log how long each loading step took
+     */
+    void LogLoadingReport();
+
+    /**
+     * Threaded loading step finished
+     */
+    void HandleWorkItemCompleted(StringHash eventType, VariantMap& eventData);
+
     /**
      * Scene loading in progress
      */
@@ -153,4 +230,53 @@ private:
     Vector<MapInfo> availableMaps_;
 
     MapInfo* currentMap_;
+
+    /**
+     * Time since the scene loading started, used for the loading step timings
+     */
+    Timer loadingTimer_;
+
+    /**
+     * Loading step timeline of each loaded map
+     */
+    SharedPtr<LoadingProfiler> loadingProfiler_;
+
+    /**
+     * Resource references of each scanned map
+     */
+    HashMap<String, StringVector> mapResources_;
+
+    /**
+     * Resources which survive ResourceCache::ReleaseAllResources, keyed by "Type;Name"
+     */
+    HashMap<String, SharedPtr<Resource>> retainedResources_;
+
+    /**
+     * Map which is being preloaded
+     */
+    String preloadMap_;
+
+    /**
+     * Current async loading time slice in MS
+     */
+    float asyncLoadingBudget_{1.0f};
+
+    /**
+     * Time spent in the current frame, excluding the frame limiter sleep
+     */
+    HiresTimer frameTimer_;
+
+    /**
+     * Maps and their async loading budgets waiting to be measured, 0 budget - adaptive
+     */
+    Vector<Pair<String, int>> benchmarkQueue_;
+
+    /**
+     * Temporary scene used by the loading benchmark
+     */
+    SharedPtr<Scene> benchmarkScene_;
+
+    HiresTimer benchmarkTimer_;
+
+    unsigned benchmarkFrames_{0};
 };
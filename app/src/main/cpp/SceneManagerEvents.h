@@ -42,6 +42,8 @@ namespace SceneManagerEvents {
         URHO3D_PARAM(P_REMOVE_ON_FINISH, RemoveOnFinish); // bool - automatically remove this loading step when finished
         URHO3D_PARAM(P_DEPENDS_ON, DependsOn); // String array - other loading step events that should be run before this
         URHO3D_PARAM(P_MAP, Map); // string - in which level this loading step should appear
+        URHO3D_PARAM(P_WORK_FUNCTION, WorkFunction); // void ptr - optional "void (const WorkItem*, unsigned)" function which runs on WorkQueue thread instead of sending the start event
+        URHO3D_PARAM(P_WORK_DATA, WorkData); // void ptr - passed to the work function as WorkItem::aux_
     }
 
     // Called when new loading step is about to start
@@ -0,0 +1,118 @@
+#include <Urho3D/Core/CoreEvents.h>
+#include <Urho3D/Engine/DebugHud.h>
+#include "DeferredWriter.h"
+
+/**
+ * Lowest priority, so that systems which complete their own work items never wait for the file writes
+ */
+const unsigned DEFERRED_WRITE_PRIORITY = 0;
+
+DeferredWriter::DeferredWriter(Context* context, DeferredWriteSource* source, const String& name, unsigned delay) :
+    Object(context),
+    source_(source),
+    name_(name),
+    delay_(delay)
+{
+    SubscribeToEvent(E_UPDATE, URHO3D_HANDLER(DeferredWriter, HandleUpdate));
+    SubscribeToEvent(E_WORKITEMCOMPLETED, URHO3D_HANDLER(DeferredWriter, HandleWorkItemCompleted));
+}
+
+DeferredWriter::~DeferredWriter()
+{
+    // Worker must not touch the source after it's gone, pending changes are only written by Flush
+    if (writeItem_ && GetSubsystem<WorkQueue>()) {
+        WaitForWrite();
+        writeItem_.Reset();
+    }
+}
+
+void DeferredWriter::MarkDirty()
+{
+    if (dirty_) {
+        writesSkipped_++;
+        if (GetSubsystem<DebugHud>()) {
+            GetSubsystem<DebugHud>()->SetAppStats(name_ + " saves skipped", writesSkipped_);
+        }
+        return;
+    }
+
+    dirty_ = true;
+    dirtyTimer_.Reset();
+}
+
+void DeferredWriter::StartWrite()
+{
+    dirty_ = false;
+    source_->PrepareWrite();
+
+    auto workQueue = GetSubsystem<WorkQueue>();
+    writeItem_ = workQueue->GetFreeItem();
+    writeItem_->priority_ = DEFERRED_WRITE_PRIORITY;
+    writeItem_->workFunction_ = WriteWork;
+    writeItem_->aux_ = this;
+    writeItem_->sendEvent_ = true;
+    workQueue->AddWorkItem(writeItem_);
+}
+
+void DeferredWriter::WriteWork(const WorkItem* item, unsigned threadIndex)
+{
+    auto writer = static_cast<DeferredWriter*>(item->aux_);
+    writer->writeSucceeded_ = writer->source_->Write();
+}
+
+void DeferredWriter::WaitForWrite()
+{
+    // Write which hasn't started yet is taken back and run here, the rest of the queue is left alone
+    if (GetSubsystem<WorkQueue>()->RemoveWorkItem(writeItem_)) {
+        WriteWork(writeItem_, 0);
+        return;
+    }
+    while (!writeItem_->completed_) {
+        Time::Sleep(1);
+    }
+}
+
+void DeferredWriter::FinishWrite()
+{
+    // Changes made during the write are picked up by the next HandleUpdate
+    writeItem_.Reset();
+    writesFinished_++;
+    if (GetSubsystem<DebugHud>()) {
+        GetSubsystem<DebugHud>()->SetAppStats(name_ + " saves written", writesFinished_);
+    }
+    source_->WriteFinished(writeSucceeded_);
+}
+
+void DeferredWriter::Flush()
+{
+    // Completion event of the waited item is ignored, it no longer matches writeItem_
+    if (writeItem_) {
+        WaitForWrite();
+        FinishWrite();
+    }
+
+    if (dirty_) {
+        dirty_ = false;
+        source_->PrepareWrite();
+        writeSucceeded_ = source_->Write();
+        source_->WriteFinished(writeSucceeded_);
+    }
+}
+
+void DeferredWriter::HandleUpdate(StringHash eventType, VariantMap& eventData)
+{
+    if (dirty_ && !writeItem_ && dirtyTimer_.GetMSec(false) >= delay_) {
+        StartWrite();
+    }
+}
+
+void DeferredWriter::HandleWorkItemCompleted(StringHash eventType, VariantMap& eventData)
+{
+    using namespace WorkItemCompleted;
+    WorkItem* item = static_cast<WorkItem*>(eventData[P_ITEM].GetPtr());
+    if (!writeItem_ || item != writeItem_.Get()) {
+        return;
+    }
+
+    FinishWrite();
+}
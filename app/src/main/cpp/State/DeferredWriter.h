@@ -0,0 +1,97 @@
+#pragma once
+
+#include <Urho3D/Core/Object.h>
+#include <Urho3D/Core/Timer.h>
+#include <Urho3D/Core/WorkQueue.h>
+
+using namespace Urho3D;
+
+/**
+ * Data which is saved through the DeferredWriter
+ */
+class DeferredWriteSource
+{
+public:
+    virtual ~DeferredWriteSource() = default;
+
+    /**
+     * Copy the data which will be written, runs on the main thread
+     */
+    virtual void PrepareWrite() = 0;
+
+    /**
+     * Write the copied data, runs on a worker thread unless the writer is flushed
+     */
+    virtual bool Write() = 0;
+
+    /**
+     * Write finished, runs on the main thread
+     */
+    virtual void WriteFinished(bool succeeded) {}
+};
+
+/**
+ * Write-behind for save files. Changes are collected for the delay before they are written
+ * on a worker thread, only one write runs at a time and changes made meanwhile are written after it finishes
+ */
+class DeferredWriter : public Object
+{
+    URHO3D_OBJECT(DeferredWriter, Object);
+
+public:
+    /**
+     * Name is used for the debug HUD stats
+     */
+    DeferredWriter(Context* context, DeferredWriteSource* source, const String& name, unsigned delay);
+
+    virtual ~DeferredWriter();
+
+    /**
+     * Data changed, write is delayed so that bursts of changes are written once
+     */
+    void MarkDirty();
+
+    /**
+     * Wait for the running write and write pending changes right away
+     */
+    void Flush();
+
+    bool IsDirty() const { return dirty_; }
+
+private:
+    void StartWrite();
+    static void WriteWork(const WorkItem* item, unsigned threadIndex);
+    /**
+     * Block until the running write is finished
+     */
+    void WaitForWrite();
+    void FinishWrite();
+    void HandleUpdate(StringHash eventType, VariantMap& eventData);
+    void HandleWorkItemCompleted(StringHash eventType, VariantMap& eventData);
+
+    DeferredWriteSource* source_;
+    String name_;
+    unsigned delay_;
+
+    /**
+     * Data changed since the last write was started
+     */
+    bool dirty_{false};
+
+    /**
+     * Time since the first unwritten change
+     */
+    Timer dirtyTimer_;
+
+    /**
+     * Write in progress, the source's copy is owned by the worker until it completes
+     */
+    SharedPtr<WorkItem> writeItem_;
+    bool writeSucceeded_{false};
+
+    /**
+     * Changes which were merged into an already scheduled write
+     */
+    unsigned writesSkipped_{0};
+    unsigned writesFinished_{0};
+};
@@ -3,6 +3,8 @@
 #include <Urho3D/IO/PackageFile.h>
 #include <Urho3D/IO/FileSystem.h>
 #include <Urho3D/IO/Log.h>
+#include <Urho3D/IO/File.h>
+#include <Urho3D/Core/CoreEvents.h>
 #include "State.h"
 #include "../Config/ConfigManager.h"
 #include "../Globals/Settings.h"
@@ -13,6 +15,12 @@
 #include <emscripten/bind.h>
 #endif
 
+/**
+ * Changes are collected for this many MS before the savegame is written
+ */
+const unsigned STATE_SAVE_DELAY = 2000;
+const unsigned STATE_BINARY_VERSION = 1;
+
 State::State(Context* context) :
     Object(context)
 {
@@ -21,7 +29,9 @@ State::State(Context* context) :
         GetSubsystem<FileSystem>()->CreateDir(directory);
         URHO3D_LOGINFO("Creating savegame directory " + directory);
     }
-    fileLocation_ = directory + "/save.json";
+    binary_ = GetSubsystem<ConfigManager>()->GetBool("game", "BinarySave", false);
+    fileLocation_ = directory + (binary_ ? "/save.bin" : "/save.json");
+    writer_ = new DeferredWriter(context_, this, "Savegame", STATE_SAVE_DELAY);
     Load();
     SubscribeToEvents();
 }
@@ -43,32 +53,96 @@ void State::SubscribeToEvents()
 
 void State::Load()
 {
-    JSONFile file(context_);
 #ifndef __EMSCRIPTEN__
-    if (file.LoadFile(fileLocation_)) {
-        JSONValue value = file.GetRoot();
-        data_ = value.GetVariantMap();
+    // Savegame from the other format is picked up when the format setting changes
+    String directory = GetPath(fileLocation_);
+    if (LoadFile(fileLocation_, binary_) || LoadFile(directory + (binary_ ? "save.json" : "save.bin"), !binary_)) {
         URHO3D_LOGINFO("Savegame loaded");
     }
 #endif
 }
 
-void State::Save()
+bool State::LoadFile(const String& filename, bool binary)
 {
-    JSONFile file(context_);
-    file.GetRoot().SetVariantMap(data_);
+    if (!GetSubsystem<FileSystem>()->FileExists(filename)) {
+        return false;
+    }
+
+    if (!binary) {
+        JSONFile file(context_);
+        if (!file.LoadFile(filename)) {
+            return false;
+        }
+        data_ = file.GetRoot().GetVariantMap();
+        return true;
+    }
+
+    File file(context_, filename, FILE_READ);
+    if (!file.IsOpen() || file.ReadFileID() != "STAT" || file.ReadUInt() != STATE_BINARY_VERSION) {
+        URHO3D_LOGERROR("Invalid binary savegame " + filename);
+        return false;
+    }
+    data_ = file.ReadVariantMap();
+    return true;
+}
+
+void State::PrepareWrite()
+{
+    pendingData_ = data_;
+}
+
+bool State::Write()
+{
+    bool saved = false;
 #ifndef __EMSCRIPTEN__
-    if (file.SaveFile(fileLocation_)) {
-        URHO3D_LOGINFO("Savegame file saved in " + fileLocation_);
-    } else {
-        URHO3D_LOGERROR("Failed to save state in " + fileLocation_);
+    String tempLocation = fileLocation_ + ".tmp";
+    {
+        File file(context_, tempLocation, FILE_WRITE);
+        if (!file.IsOpen()) {
+            return false;
+        }
+
+        if (binary_) {
+            file.WriteFileID("STAT");
+            file.WriteUInt(STATE_BINARY_VERSION);
+            saved = file.WriteVariantMap(pendingData_);
+        } else {
+            JSONFile json(context_);
+            json.GetRoot().SetVariantMap(pendingData_);
+            saved = json.Save(file);
+        }
+    }
+
+    if (saved) {
+        // Previous savegame stays intact if the game is closed while writing
+        auto fileSystem = GetSubsystem<FileSystem>();
+#ifdef _WIN32
+        fileSystem->Delete(fileLocation_);
+#endif
+        saved = fileSystem->Rename(tempLocation, fileLocation_);
     }
 #else
+    saved = true;
 //    EM_ASM({
 //        console.log('Storing state', $0);
 //        window.localStorage.setItem('name', 'Obaseki Nosa');
 //    }, file.ToString().CString());
 #endif
+    return saved;
+}
+
+void State::Flush()
+{
+    writer_->Flush();
+}
+
+void State::WriteFinished(bool succeeded)
+{
+    if (succeeded) {
+        URHO3D_LOGINFO("Savegame file saved in " + fileLocation_);
+    } else {
+        URHO3D_LOGERROR("Failed to save state in " + fileLocation_);
+    }
 }
 
 void State::HandleSetParameter(StringHash eventType, VariantMap& eventData)
@@ -87,10 +161,10 @@ void State::HandleIncrementParameter(StringHash eventType, VariantMap& eventData
 
 void State::SetValue(const String& name, const Variant& value, bool save)
 {
-    URHO3D_LOGINFO("Updating state parameter: " + name);
+    URHO3D_LOGDEBUG("Updating state parameter: " + name);
     data_[name] = value;
     if (save) {
-        Save();
+        writer_->MarkDirty();
     }
 }
 
@@ -3,10 +3,11 @@
 #include <Urho3D/Core/Object.h>
 #include <Urho3D/Container/Str.h>
 #include <Urho3D/Resource/JSONFile.h>
+#include "DeferredWriter.h"
 
 using namespace Urho3D;
 
-class State : public Object
+class State : public Object, public DeferredWriteSource
 {
     URHO3D_OBJECT(State, Object);
 
@@ -17,16 +18,44 @@ public:
 
     virtual ~State();
 
+    /**
+     * Set state parameter, saving is delayed so that frequent changes are written to disk once
+     */
     void SetValue(const String& name, const Variant& value, bool save = false);
     const Variant& GetValue(const String& name);
 
+    /**
+     * Wait for the running save and write pending changes right away
+     */
+    void Flush();
+
 private:
     void SubscribeToEvents();
     void Load();
-    void Save();
+    bool LoadFile(const String& filename, bool binary);
+    /**
+     * Copy the state for the savegame writer
+     */
+    void PrepareWrite() override;
+    /**
+     * Serialize pending data into temporary file and replace the savegame with it, runs on a worker thread
+     */
+    bool Write() override;
+    void WriteFinished(bool succeeded) override;
     void HandleSetParameter(StringHash eventType, VariantMap& eventData);
     void HandleIncrementParameter(StringHash eventType, VariantMap& eventData);
     String fileLocation_;
 
     VariantMap data_;
+
+    /**
+     * Copy of the state owned by the running save
+     */
+    VariantMap pendingData_;
+    bool binary_{false};
+
+    /**
+     * Declared last, so that it waits for the running save before the saved data is destroyed
+     */
+    SharedPtr<DeferredWriter> writer_;
 };
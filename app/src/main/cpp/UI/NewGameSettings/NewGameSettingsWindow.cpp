@@ -159,6 +159,9 @@ void NewGameSettingsWindow::CreateLevelSelection()
     auto font = cache->GetResource<Font>(APPLICATION_FONT);
 
     auto maps = GetSubsystem<SceneManager>()->GetAvailableMaps();
+    if (!maps.Empty()) {
+        GetSubsystem<SceneManager>()->PreloadMap(maps.Front().map);
+    }
 
     for (auto it = maps.Begin(); it != maps.End(); ++it) {
 
@@ -171,6 +174,13 @@ void NewGameSettingsWindow::CreateLevelSelection()
         button->SetVar("Commands", (*it).commands);
         button->SetStyle("MapSelection");
 
+        // Resources of the map under the cursor start loading before the player picks it
+        SubscribeToEvent(button, E_HOVERBEGIN, [&](StringHash eventType, VariantMap& eventData) {
+            using namespace HoverBegin;
+            Button* button = static_cast<Button*>(eventData[P_ELEMENT].GetPtr());
+            GetSubsystem<SceneManager>()->PreloadMap(button->GetVar("Map").GetString());
+        });
+
         SubscribeToEvent(button, E_RELEASED, [&](StringHash eventType, VariantMap& eventData) {
             using namespace Released;
             Button* button = static_cast<Button*>(eventData[P_ELEMENT].GetPtr());